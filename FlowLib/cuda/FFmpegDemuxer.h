@@ -78,8 +78,9 @@ private:
     /**
     *   @brief  Private constructor to initialize libavformat resources.
     *   @param  fmtc - Pointer to AVFormatContext allocated inside avformat_open_input()
+    *   @param  properties - Rendition policy, see GetStreamProgram()
     */
-    FFmpegDemuxer(AVFormatContext *fmtc, int64_t timeScale = 1000 /*Hz*/) : fmtc(fmtc) {
+    FFmpegDemuxer(AVFormatContext *fmtc, const FlowProperties& properties, int64_t timeScale = 1000 /*Hz*/) : fmtc(fmtc) {
         if (!fmtc) {
             // CV_LOG_ERROR(NULL, "No AVFormatContext provided.");
             throw std::runtime_error("No AVFormatContext provided.");
@@ -87,14 +88,14 @@ private:
 
         CV_LOG_INFO(NULL, "Media format: " << fmtc->iformat->long_name << " (" << fmtc->iformat->name << ")");
 
-        
-        ck(avformat_find_stream_info(fmtc, NULL));
-        streamProgram = GetStreamProgram(fmtc);
+        streamProgram = GetStreamProgram(fmtc, properties);
 
         if (streamProgram.videoStream == nullptr) {
             CV_LOG_ERROR(NULL, "FFmpeg error: " << __FILE__ << " " << __LINE__ << " " << "Could not find stream in input file");
             return;
         }
+        DiscardUnusedStreams(fmtc, streamProgram);
+        IndexPackets(fmtc, streamProgram, properties);
 
         eVideoCodec = streamProgram.videoStream->codecpar->codec_id;
         nWidth = streamProgram.videoStream->codecpar->width;
@@ -201,18 +202,15 @@ private:
     /**
     *   @brief  Allocate and return AVFormatContext*.
     *   @param  szFilePath - Filepath pointing to input stream.
-    *   @return Pointer to AVFormatContext
+    *   @param  properties - Reader settings, see OpenFormatContext()
+    *   @return Pointer to AVFormatContext with its streams probed
     */
-     AVFormatContext *CreateFormatContext(const char *szFilePath) {
-        avformat_network_init();
-
-        AVFormatContext *ctx = NULL;
-        ck(avformat_open_input(&ctx, szFilePath, NULL, NULL));
-        return ctx;
+     AVFormatContext *CreateFormatContext(const char *szFilePath, const FlowProperties& properties) {
+        return OpenFormatContext(szFilePath, properties);
     }
 
 public:
-    FFmpegDemuxer(const char *szFilePath, int64_t timescale = 1000 /*Hz*/) : FFmpegDemuxer(CreateFormatContext(szFilePath), timescale) {}
+    FFmpegDemuxer(const char *szFilePath, const FlowProperties& properties, int64_t timescale = 1000 /*Hz*/) : FFmpegDemuxer(CreateFormatContext(szFilePath, properties), properties, timescale) {}
     
     ~FFmpegDemuxer() {
 
@@ -231,7 +229,7 @@ public:
             av_bsf_free(&bsfc);
         }
 
-        avformat_close_input(&fmtc);
+        CloseFormatContext(&fmtc);
 
         if (pDataWithHeader) {
             av_free(pDataWithHeader);
@@ -255,10 +253,12 @@ public:
     int GetFrameSize() {
         return nWidth * (nHeight + nChromaHeight) * nBPP;
     }
+    /**
+    *   @brief  Seeks to the keyframe at or before frameNr. The next Demux() reports the frame
+    *           number of the keyframe it lands on, which can be earlier than frameNr.
+    */
     bool SeekFrame(int64_t frameNr) {
-        //int ret = av_seek_frame(fmtc, iVideoStream, pts, flags);
-        int ret = avformat_seek_file(fmtc, streamProgram.videoStream->index, 0, frameNr, frameNr, AVSEEK_FLAG_FRAME);
-        //int ret = avformat_seek_file(fmtc, iVideoStream, pts, pts, pts, AVSEEK_FLAG_BACKWARD);
+        int ret = SeekToFrame(fmtc, streamProgram, frameNr);
         if (ret < 0)
         {
             CV_LOG_ERROR(NULL, "FFmpeg seek failed");
@@ -272,7 +272,8 @@ public:
             av_bsf_flush(bsfc);
         }
 
-        frameCount = frameNr;
+        // Resolved from the pts of the first packet after the seek
+        frameCount = -1;
 
         return true;
     }
@@ -317,6 +318,10 @@ public:
             return false;
         }
 
+        if (frameCount < 0) {
+            frameCount = pkt.pts == AV_NOPTS_VALUE ? 0 : streamProgram.PtsToFrame(pkt.pts);
+        }
+
         if (bMp4H264 || bMp4HEVC) {
             if (pktFiltered.data) {
                 av_packet_unref(&pktFiltered);
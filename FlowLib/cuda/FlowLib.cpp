@@ -13,7 +13,10 @@
 #include <opencv2/cudawarping.hpp>
 
 #include <thread>
+#include <atomic>
+#include <mutex>
 #include <algorithm>
+#include <climits>
 #include <condition_variable>
 // #include <format>
 
@@ -22,21 +25,24 @@ using namespace cv;
 
 struct Job {
     Job() {}
-    Job(cuda::GpuMat lastFrame, cuda::GpuMat nextFrame, cuda::GpuMat out, FrameNumber frameNumber): lastFrame(lastFrame), nextFrame(nextFrame), out(out), frameNumber(frameNumber) {}
+    Job(cuda::GpuMat lastFrame, cuda::GpuMat nextFrame, FrameNumber frameNumber): lastFrame(lastFrame), nextFrame(nextFrame), frameNumber(frameNumber) {}
 
     cuda::GpuMat lastFrame;
     cuda::GpuMat nextFrame;
-    cuda::GpuMat out;
     FrameNumber frameNumber;
 };
 
-#define NUM_POOLS 360/2
+struct RangeRequest {
+    FrameRange range;
+    int priority;
+};
+
 #define MAGNITUTE_THRESH 0.01f
 
 class Runner : public FlowLibShared {
 public:
-    Runner(const char* video, FlowProperties& config):
-        demuxer(video), config(config)
+    Runner(const char* video, FlowProperties* properties, int numProperties):
+        config(properties[0]), demuxer(video, properties[0]), properties(properties, properties + numProperties)
     {
         // Setup video reader
         cv::cuda::GpuMat temp(1, 1, CV_8UC1);
@@ -56,13 +62,24 @@ public:
         numFrames = demuxer.GetNumFrames();
         isFrameProcessed = vector<bool>(numFrames);
         fill(isFrameProcessed.begin(), isFrameProcessed.end(), false);
+        rowState = vector<uint8_t>(numFrames, FlowRowMissing);
 
         if (frame_skip > 0) {
             numFrames = ceil(numFrames / (1 + frame_skip));
         }
 
-        out = cuda::GpuMat(numFrames, NUM_POOLS, CV_32S);
-        out.setTo({ 0 });
+        for(auto& p : this->properties) {
+            if(p.outputMode != FlowOutputAngles) {
+                throw std::runtime_error("The cuda reader only supports angle outputs");
+            }
+            cuda::GpuMat out = cuda::GpuMat(numFrames, MakeBinConfig(p, video_size, MAGNITUTE_THRESH).bins, CV_32S);
+            out.setTo({ 0 });
+            outs.push_back(out);
+        }
+
+        if(config.previewWindowMs > 0) {
+            MY_LOG("[FlowLib] preview passes are not supported by the cuda reader, processing in order");
+        }
 
         // tracker_thread = thread(&Runner::TrackThread, this);
         // reader_thread = thread(&Runner::ReadThread, this);
@@ -97,19 +114,23 @@ public:
 
         while(running)
         {
-            // frame_seek need mutex?
-            FrameNumber startPosition=frame_seek;
-            for(FrameNumber f=startPosition; f<isFrameProcessed.size(); f++) {
-                if(isFrameProcessed.at(f) == false) {
-                    startPosition = f;
-                    break;
+            FrameNumber startPosition = NextStartPosition();
+            frame_seek = false;
+            lastGpuFrame = cuda::GpuMat();
+
+            // Seek so the frame before the start is decoded as the reference
+            bool resync = false;
+            if(startPosition > 0 || hasRead) {
+                FrameNumber seekPosition = startPosition > 0 ? startPosition - 1 : 0;
+                if(demuxer.SeekFrame(seekPosition)) {
+                    dec = make_unique<NvDecoder>(true, FFmpeg2NvCodecId(demuxer.GetVideoCodec()), false, false, &cropDim, &resizeDim);
+                    dec->SetOperatingPoint(0, false);
+                    resync = true;
                 }
             }
 
-            frame_seek = 0;
             frame_position = startPosition;
-            // demuxer.SeekFrame(startPosition);
-            lastGpuFrame = cuda::GpuMat();
+            FrameNumber framesRead = 0;
 
             string message = cv::format("[FlowLib] reading from frame %ld", frame_position);
             MY_LOG(message.c_str());
@@ -124,12 +145,15 @@ public:
                     break;
                 }
 
-                if(frame_seek > 0)
+                if(frame_seek)
                     break;
 
-                int nFrameReturned = dec->Decode(pVideo, nVideoBytes, 0, pts);
+                hasRead = true;
+
+                // The frame number travels through the decoder as its timestamp
+                int nFrameReturned = dec->Decode(pVideo, nVideoBytes, 0, frameNr);
 
-                while (jobs.size() > 1500) {
+                while (QueuedJobs() > 1500) {
                     this_thread::sleep_for(chrono::milliseconds(1));
                 }
 
@@ -137,7 +161,14 @@ public:
                     lock_guard<mutex>lock(jobs_mutex);
 
                     while(dec->NumFrames() > 0) {
-                        if(!QueueFrame(dec->GetFrame())) {
+                        int64_t frameTimestamp = 0;
+                        cuda::GpuMat frame = dec->GetFrame(&frameTimestamp);
+                        if(resync) {
+                            frame_position = frameTimestamp;
+                            resync = false;
+                        }
+
+                        if(!QueueFrame(frame)) {
                             string message = cv::format("[FlowLib] queue error at frame %ld", frame_position);
                             MY_LOG(message.c_str());
                             isReading = false;
@@ -145,13 +176,14 @@ public:
                         }
 
                         frame_position++;
+                        framesRead++;
                     }
                 }
 
                 condition.notify_all();
             }
 
-            if(frame_position == startPosition) {
+            if(framesRead == 0 && !frame_seek) {
                 message = cv::format("[FlowLib] reading died at %ld", frame_position);
                 MY_LOG(message.c_str());
                 isReading = false;
@@ -183,17 +215,53 @@ public:
         isReading = false;
     }
 
+    FrameNumber NextStartPosition()
+    {
+        lock_guard<mutex>lock(jobs_mutex);
+
+        // Row r is produced by frame r+1, so a request starts at its first unqueued frame
+        while(!requests.empty()) {
+            auto best = requests.begin();
+            for(auto it = requests.begin(); it != requests.end(); it++) {
+                if(it->priority > best->priority) {
+                    best = it;
+                }
+            }
+
+            FrameNumber toFrame = min<FrameNumber>(best->range.toFrame + 1, isFrameProcessed.size());
+            for(FrameNumber f=best->range.fromFrame + 1; f<toFrame; f++) {
+                if(isFrameProcessed.at(f) == false) {
+                    currentPriority = best->priority;
+                    return f;
+                }
+            }
+
+            requests.erase(best);
+        }
+
+        currentPriority = INT_MIN;
+        for(FrameNumber f=0; f<isFrameProcessed.size(); f++) {
+            if(isFrameProcessed.at(f) == false) {
+                return f;
+            }
+        }
+
+        return 0;
+    }
+
     bool QueueFrame(cuda::GpuMat nextFrame)
     {
+        if(frame_position > isFrameProcessed.size()-1)
+            return false;
+
         if(lastGpuFrame.empty()) {
             lastGpuFrame = nextFrame;
-            isFrameProcessed.at(frame_position) = true;
+            if(frame_position == 0) {
+                isFrameProcessed.at(frame_position) = true;
+            }
             
             return true;
         }
-        
-        if(frame_position > isFrameProcessed.size()-1)
-            return false;
 
         if(isFrameProcessed.at(frame_position) == true) {
             return true;
@@ -202,7 +270,7 @@ public:
         isFrameProcessed.at(frame_position) = true;
 
    //     if (frame_skip_counter < 1) {
-            jobs.emplace_back(lastGpuFrame, nextFrame, out.row(frame_position-1), frame_position);
+            jobs.emplace_back(lastGpuFrame, nextFrame, frame_position);
             frame_skip_counter = frame_skip;
             lastGpuFrame = nextFrame;
             //return true;
@@ -227,6 +295,12 @@ public:
         Size flowSize = video_size / flow->getGridSize();
         cuda::GpuMat flow_frame = cuda::GpuMat(flowSize, CV_16SC2);
 
+        // The ROI applies to the flow grid, one vector per grid cell
+        vector<BinConfig> gridConfigs;
+        for(auto& p : properties) {
+            gridConfigs.push_back(MakeBinConfig(p, flowSize, MAGNITUTE_THRESH));
+        }
+
         Job job;
 
         while (running) {
@@ -245,7 +319,8 @@ public:
             lock.unlock();
             
             flow->calc(job.nextFrame, job.lastFrame, flow_frame);
-            runMatPool(flow_frame, job.out, NUM_POOLS, MAGNITUTE_THRESH);
+            PoolJob(job, flow_frame, gridConfigs);
+            MarkRowDone(job.frameNumber-1);
             last_frame_done = job.frameNumber;
         }
 
@@ -256,7 +331,8 @@ public:
             jobs.pop_front();
             
             flow->calc(job.nextFrame, job.lastFrame, flow_frame);
-            runMatPool(flow_frame, job.out, NUM_POOLS, MAGNITUTE_THRESH);
+            PoolJob(job, flow_frame, gridConfigs);
+            MarkRowDone(job.frameNumber-1);
             last_frame_done = job.frameNumber;
         }
         
@@ -267,9 +343,34 @@ public:
         isTracking = false;
     }
 
+    size_t QueuedJobs()
+    {
+        lock_guard<mutex>lock(jobs_mutex);
+        return jobs.size();
+    }
+
+    // Rows are read by other threads, GetMat waits on rowCondition for them
+    void MarkRowDone(FrameNumber row)
+    {
+        {
+            lock_guard<mutex>lock(rowMutex);
+            rowState.at(row) = FlowRowExact;
+        }
+        rowCondition.notify_all();
+    }
+
+    void PoolJob(Job& job, cuda::GpuMat& flow_frame, vector<BinConfig>& gridConfigs)
+    {
+        // One flow calculation, binned once per output
+        for(size_t o=0; o<outs.size(); o++) {
+            runMatPool(flow_frame(gridConfigs[o].roi), outs[o].row(job.frameNumber-1), gridConfigs[o].bins, gridConfigs[o].threshold);
+        }
+    }
+
     void Run(RunCallback callback, int callbackInterval)
     {
         running = true;
+        isRunning = true;
         last_frame_done = 0;
 
         tracker_thread = thread(&Runner::TrackThread, this);
@@ -317,9 +418,32 @@ public:
 
         reader_thread.join();
         tracker_thread.join();
+        {
+            // Under the lock, so a GetMat between its check and its wait still wakes up
+            lock_guard<mutex>lock(rowMutex);
+            isRunning = false;
+        }
+        rowCondition.notify_all();
         MY_LOG("[FlowLib] finished");
     }
 
+    bool RequestRange(FrameRange range, int priority)
+    {
+        lock_guard<mutex>lock(jobs_mutex);
+        requests.push_back({ range, priority });
+
+        if(priority > currentPriority) {
+            frame_seek = true;
+        }
+
+        return true;
+    }
+
+    void SetCapture(const char* path)
+    {
+        throw std::runtime_error("The cuda reader does not export motion vectors");
+    }
+
     FrameNumber CurrentFrame()
     {
         return last_frame_done;
@@ -335,9 +459,34 @@ public:
         return demuxer.GetDuration();
     }
 
-    bool GetMat(FrameRange range, cv::Mat& buffer)
+    int GetNumOutputs()
     {
-        out.rowRange(range.fromFrame, range.toFrame).download(buffer);
+        return outs.size();
+    }
+
+    BinConfig GetBinConfig(int output)
+    {
+        return MakeBinConfig(properties.at(output), video_size, MAGNITUTE_THRESH);
+    }
+
+    FlowProperties GetProperties()
+    {
+        return config;
+    }
+
+    bool GetMat(FrameRange range, cv::Mat& buffer, int output)
+    {
+        if(config.computeOnRead && !IsRangeDone(range)) {
+            if(!isRunning) {
+                throw std::runtime_error("Range not computed and FlowRun is not active");
+            }
+
+            RequestRange(range, INT_MAX);
+            unique_lock<mutex>lock(rowMutex);
+            rowCondition.wait(lock, [&]() { return !isRunning || IsRangeDoneLocked(range); });
+        }
+
+        outs.at(output).rowRange(range.fromFrame, range.toFrame).download(buffer);
         
         return true;
     }
@@ -347,12 +496,42 @@ public:
         return video_size;
     }
 
+    bool GetRowState(FrameRange range, uint8_t* states)
+    {
+        lock_guard<mutex>lock(rowMutex);
+        for(FrameNumber f=range.fromFrame; f<range.toFrame; f++) {
+            states[f - range.fromFrame] = f < rowState.size() ? rowState.at(f) : FlowRowMissing;
+        }
+        return true;
+    }
+
+    bool IsRangeDone(FrameRange range)
+    {
+        lock_guard<mutex>lock(rowMutex);
+        return IsRangeDoneLocked(range);
+    }
+
 protected:
-    bool isReading = true;
-    bool isTracking = true;
+    bool IsRangeDoneLocked(FrameRange range)
+    {
+        for(FrameNumber f=range.fromFrame; f<range.toFrame && f<rowState.size(); f++) {
+            if(rowState.at(f) != FlowRowExact) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Shared between FlowRun's thread, the reader and tracker threads and the callers of the query functions
+    atomic<bool> isReading{true};
+    atomic<bool> isTracking{true};
     bool had_update = false;
     vector<bool> isFrameProcessed;
-    FlowProperties& config;
+    vector<uint8_t> rowState;
+    mutex rowMutex;
+    condition_variable rowCondition;
+    FlowProperties config;
     
     FFmpegDemuxer demuxer;
     unique_ptr<NvDecoder> dec;
@@ -361,21 +540,28 @@ protected:
     ::Rect cropDim = {};
     Dim resizeDim = {};
 
-    FrameNumber frame_seek = 0;
+    // Set when a request outranks the range being read
+    atomic<bool> frame_seek{false};
+    bool hasRead = false;
+    atomic<bool> isRunning{false};
+    vector<RangeRequest> requests;
+    int currentPriority = INT_MIN;
+
     FrameNumber numFrames;
     FrameNumber frame_position = 0;
-    FrameNumber last_frame_done = 0;
+    atomic<FrameNumber> last_frame_done{0};
 
     int frame_skip = 0;
     int frame_skip_counter = 0;
 
     cuda::GpuMat lastGpuFrame;
-    cuda::GpuMat out;
+    vector<FlowProperties> properties;
+    vector<cuda::GpuMat> outs;
 
     deque<Job> jobs;
     mutex jobs_mutex;
-    bool running = true;
-    bool tracker_thread_waiting = false;
+    atomic<bool> running{true};
+    atomic<bool> tracker_thread_waiting{false};
     thread tracker_thread;
     thread reader_thread;
     std::condition_variable condition = {};
@@ -383,7 +569,7 @@ protected:
     Mat waveBuffer;
 };
 
-FlowLibShared* CreateFlowLib(const char* videoPath, FlowProperties* properties)
+FlowLibShared* CreateFlowLib(const char* videoPath, FlowProperties* properties, int numProperties)
 {
-    return new Runner(videoPath, *properties);
+    return new Runner(videoPath, properties, numProperties);
 }
\ No newline at end of file
@@ -86,14 +86,19 @@ void cartesian_to_polar(float x, float y, float& magnitude, float& angle_degrees
 __global__ void MAT_POOL(
     int16_t* flowPtr,
     size_t flowPitch,
+    int flowCols,
+    int flowRows,
     int32_t* output,
-    uint8_t pools,
+    int pools,
     float threshold
 ){
     const int x = blockIdx.x * blockDim.x + threadIdx.x;
     const int y = blockIdx.y * blockDim.y + threadIdx.y;
 
-    const size_t mFlowPitch = flowPitch >> 2;
+    if (x >= flowCols || y >= flowRows)
+        return;
+
+    const size_t mFlowPitch = flowPitch >> 1;
 
     int flowPtrAddr = (y * mFlowPitch) + (x * 2);
 
@@ -110,7 +115,7 @@ __global__ void MAT_POOL(
         return;
     }
 
-    uint8_t pool =  round(angle * (float)pools);
+    int pool =  round(angle * (float)pools);
     
     if (pool < 0)
         pool = 0;
@@ -121,7 +126,7 @@ __global__ void MAT_POOL(
     ::atomicAdd((int*)output + pool, 1);
 }
 
-void runMatPool(cv::cuda::GpuMat flow, cv::cuda::GpuMat output, uint8_t pools, float threshold)
+void runMatPool(cv::cuda::GpuMat flow, cv::cuda::GpuMat output, int pools, float threshold)
 {
     assert(flow.channels() == 2);
     assert(output.rows == 1 && output.cols == pools);
@@ -132,6 +137,8 @@ void runMatPool(cv::cuda::GpuMat flow, cv::cuda::GpuMat output, uint8_t pools, f
     MAT_POOL << <grid, block >> > (
         flow.ptr<int16_t>(),
         flow.step,
+        flow.cols,
+        flow.rows,
         output.ptr<int32_t>(),
         pools,
         threshold
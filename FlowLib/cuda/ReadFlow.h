@@ -6,4 +6,4 @@ namespace cv { namespace cuda {
     class GpuMat;
 } ; } ;
 
-void runMatPool(cv::cuda::GpuMat flow, cv::cuda::GpuMat output, uint8_t pools, float threshold);
\ No newline at end of file
+void runMatPool(cv::cuda::GpuMat flow, cv::cuda::GpuMat output, int pools, float threshold);
\ No newline at end of file
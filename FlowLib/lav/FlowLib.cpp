@@ -1,6 +1,8 @@
 #include "FlowLibShared.hpp"
+#include "FlowQuery.hpp"
 
 #include "Reader.hpp"
+#include "MotionCapture.hpp"
 // #include "BS_thread_pool.hpp"
 
 extern "C" {
@@ -17,12 +19,33 @@ extern "C" {
 #include <stdexcept>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <climits>
+#include <chrono>
+
+struct RangeRequest {
+    FrameRange range;
+    int priority;
+};
+
+struct FlowOutput {
+    BinConfig config;
+    cv::UMat flow;
+};
+
+// Below every user request, above the gap filling
+#define PREVIEW_PRIORITY (INT_MIN + 1)
 
 class FlowLib : public FlowLibShared {
 public:
-    FlowLib(const char* path)
+    FlowLib(const char* path, FlowProperties* properties, int numProperties)
     {
-        reader = CreateReader(path, [this](AVFrame* frame, int frame_number) { HandleFrame(frame, frame_number); });
+        config = properties[0];
+        live = config.liveWindow > 0;
+
+        reader = CreateReader(path, [this](AVFrame* frame, int frame_number) { HandleFrame(frame, frame_number); }, config);
         printf(".");
         try {
             InitOpencl();
@@ -31,9 +54,23 @@ public:
             printf("OpenCL not available: %s\n", e.what());
         }
 
-        flowOutput = cv::UMat(reader->GetNumFrames(), FLOW_HEIGHT, CV_32SC1, cv::ACCESS_WRITE, cv::USAGE_ALLOCATE_DEVICE_MEMORY);
-        cv::Mat flowOutputZero = cv::Mat(reader->GetNumFrames(), FLOW_HEIGHT, CV_32SC1, cv::Scalar(0, 0, 0));
-        flowOutputZero.copyTo(flowOutput);
+        // A live source has no length, its rows go round a ring of liveWindow slots
+        FrameNumber numRows = live ? config.liveWindow : reader->GetNumFrames();
+
+        // Motion vector positions are in pixels
+        for(int p=0; p<numProperties; p++) {
+            FlowOutput output;
+            output.config = MakeBinConfig(properties[p], reader->GetVideoSize(), MAGNITUDE_THRESHOLD);
+            output.flow = cv::UMat(numRows, output.config.Columns(), output.config.MatType(), cv::ACCESS_WRITE, cv::USAGE_ALLOCATE_DEVICE_MEMORY);
+            cv::Mat flowOutputZero = cv::Mat(numRows, output.config.Columns(), output.config.MatType(), cv::Scalar(0, 0, 0));
+            flowOutputZero.copyTo(output.flow);
+            outputs.push_back(output);
+        }
+
+        rowState = std::vector<uint8_t>(numRows, FlowRowMissing);
+        if(live) {
+            framePts = std::vector<int64_t>(numRows, 0);
+        }
     }
 
     FrameNumber CurrentFrame()
@@ -43,6 +80,10 @@ public:
 
     FrameNumber GetNumFrames()
     {
+        if(live) {
+            std::lock_guard<std::mutex> lock(rowMutex);
+            return liveEnd;
+        }
         return reader->GetNumFrames();
     }
 
@@ -51,53 +92,209 @@ public:
         return reader->GetNumMs();
     }
 
-    bool GetMat(FrameRange range, cv::Mat& buffer)
+    int GetNumOutputs()
+    {
+        return outputs.size();
+    }
+
+    BinConfig GetBinConfig(int output)
     {
-        flowOutput.rowRange(range.fromFrame, range.toFrame).copyTo(buffer);
+        return outputs.at(output).config;
+    }
+
+    FlowProperties GetProperties()
+    {
+        return config;
+    }
+
+    bool GetMat(FrameRange range, cv::Mat& buffer, int output)
+    {
+        if(live) {
+            std::lock_guard<std::mutex> lock(rowMutex);
+            if(range.fromFrame < liveStart || range.toFrame > liveEnd) {
+                throw std::runtime_error("Range outside the live window");
+            }
+
+            // In up to two pieces when the range wraps around the ring
+            for(FrameNumber f=range.fromFrame; f<range.toFrame; ) {
+                FrameNumber slot = f % config.liveWindow;
+                FrameNumber n = std::min<FrameNumber>(range.toFrame - f, config.liveWindow - slot);
+                cv::Mat target = buffer.rowRange(f - range.fromFrame, f - range.fromFrame + n);
+                outputs.at(output).flow.rowRange(slot, slot + n).copyTo(target);
+                f += n;
+            }
+            return true;
+        }
+
+        if(config.computeOnRead) {
+            ComputeRange(range);
+        }
+
+        outputs.at(output).flow.rowRange(range.fromFrame, range.toFrame).copyTo(buffer);
         return true;
     }
 
     void Run(RunCallback cb, int callbackInterval)
     {
         callback = cb;
-        reader->Start();
+
+        std::lock_guard<std::mutex> readerLock(readerMutex);
+        if(live) {
+            // No ranges or seeks, the reader follows the source until it ends
+            reader->Start();
+            return;
+        }
+
+        if(config.previewWindowMs > 0 && config.previewIntervalMs > config.previewWindowMs) {
+            RunPreview();
+        }
+
+        FrameRange range;
+        while(NextRange(range, currentPriority)) {
+            ReadRange(range);
+        }
+    }
+
+    bool GetRowState(FrameRange range, uint8_t* states)
+    {
+        std::lock_guard<std::mutex> lock(rowMutex);
+        for(FrameNumber f=range.fromFrame; f<range.toFrame; f++) {
+            if(live) {
+                states[f - range.fromFrame] = f >= liveStart && f < liveEnd ? rowState[f % config.liveWindow] : FlowRowMissing;
+                continue;
+            }
+            states[f - range.fromFrame] = f < rowState.size() ? rowState[f] : FlowRowMissing;
+        }
+        return true;
+    }
+
+    FrameRange GetLiveRange()
+    {
+        if(!live) {
+            return FrameRange{ 0, (FrameNumber)rowState.size() };
+        }
+        std::lock_guard<std::mutex> lock(rowMutex);
+        return FrameRange{ liveStart, liveEnd };
+    }
+
+    bool GetFramePts(FrameRange range, long long* ptsMs)
+    {
+        if(!live) {
+            return FlowLibShared::GetFramePts(range, ptsMs);
+        }
+        std::lock_guard<std::mutex> lock(rowMutex);
+        if(range.fromFrame < liveStart || range.toFrame > liveEnd) {
+            throw std::runtime_error("Range outside the live window");
+        }
+        for(FrameNumber f=range.fromFrame; f<range.toFrame; f++) {
+            ptsMs[f - range.fromFrame] = framePts[f % config.liveWindow];
+        }
+        return true;
+    }
+
+    bool RequestRange(FrameRange range, int priority)
+    {
+        // Live rows are computed as they arrive
+        if(live) {
+            return true;
+        }
+
+        if(range.toFrame > rowState.size()) {
+            range.toFrame = rowState.size();
+        }
+
+        std::lock_guard<std::mutex> lock(rowMutex);
+        requests.push_back({ range, priority });
+        return true;
+    }
+
+    FlowStats GetStats()
+    {
+        return reader->GetStats();
+    }
+
+    void SetCapture(const char* path)
+    {
+        std::lock_guard<std::mutex> readerLock(readerMutex);
+        capture.reset();
+        if(path) {
+            capture = std::make_unique<MotionCaptureWriter>(path, reader->GetNumFrames(), reader->GetNumMs(), reader->GetVideoSize());
+        }
     }
 
 protected:
     void HandleFrame(AVFrame* frame, int frame_number);
+    bool AdvanceLive(FrameNumber frame);
     void HandleVectorData(AVFrameSideData* sd, int frame_number);
     void InitOpencl();
-    void process_vector(AVMotionVector* vector, int frame_number, cv::Mat writeMat);
+    void process_vector(AVMotionVector* vector, float magnitude, float angle, const BinConfig& bins, int frame_number, cv::Mat writeMat);
+
+    bool NextRange(FrameRange& range, int& priority);
+    void ReadRange(FrameRange range);
+    void ComputeRange(FrameRange range);
+    bool IsRowDone(FrameNumber f);
+    bool IsRangeDone(FrameRange range);
+    void RunPreview();
+    void FillApproximate();
 
     cv::ocl::Program vectorFrame;
     cv::ocl::Context clContext;
     bool useOpenCL = false;
 
     std::unique_ptr<Reader> reader;
+    std::unique_ptr<MotionCaptureWriter> capture;
     RunCallback callback;
-
-    cv::UMat flowOutput;
-    // cv::Mat flowOutput;
-    int FLOW_HEIGHT = 180;
+    FlowProperties config = {};
+
+    // Rows are computed in request order, the rest fills the gaps front to back
+    std::vector<uint8_t> rowState;
+    // Read through without a frame from the reader (missing or unreadable frames), not read again
+    std::vector<RangeRequest> requests;
+    std::mutex rowMutex;
+    std::condition_variable rowCondition;
+    std::mutex readerMutex;
+    int currentPriority = INT_MIN;
+
+    // Live mode, rows [liveStart, liveEnd) are readable and slots up to livePrepared are cleared for their frame
+    bool live = false;
+    FrameNumber liveStart = 0;
+    FrameNumber liveEnd = 0;
+    FrameNumber livePrepared = 0;
+    std::vector<int64_t> framePts;
+
+    std::vector<FlowOutput> outputs;
     float MAGNITUDE_THRESHOLD = 0.5;
 };
 
+// One context and kernel for every handle of the process, a long running host builds them once
+static std::mutex openclMutex;
+static cv::ocl::Context sharedContext;
+static cv::ocl::Program sharedProgram;
+
 void FlowLib::InitOpencl()
 {
+    std::lock_guard<std::mutex> lock(openclMutex);
+    if (sharedProgram.ptr() != nullptr) {
+        clContext = sharedContext;
+        vectorFrame = sharedProgram;
+        return;
+    }
+
     if (!cv::ocl::haveOpenCL())
     {
         throw std::runtime_error("OpenCL is not avaiable...");
     }
     
-    if (!clContext.create(cv::ocl::Device::TYPE_GPU))
+    cv::ocl::Context context;
+    if (!context.create(cv::ocl::Device::TYPE_GPU))
     {
         throw std::runtime_error("Failed creating the context...");
     }
 
-    std::cout << clContext.ndevices() << " GPU devices are detected." << std::endl;
-    for (int i = 0; i < clContext.ndevices(); i++)
+    std::cout << context.ndevices() << " GPU devices are detected." << std::endl;
+    for (int i = 0; i < context.ndevices(); i++)
     {
-        cv::ocl::Device device = clContext.device(i);
+        cv::ocl::Device device = context.device(i);
         std::cout << "name                 : " << device.name() << std::endl;
         std::cout << "available            : " << device.available() << std::endl;
         std::cout << "imageSupport         : " << device.imageSupport() << std::endl;
@@ -106,7 +303,7 @@ void FlowLib::InitOpencl()
     }
 
     // Select the first device
-    cv::ocl::Device(clContext.device(0));
+    cv::ocl::Device(context.device(0));
 
     // Compile the kernel code
     std::ifstream ifs("vectorFrame.ocl");
@@ -118,20 +315,318 @@ void FlowLib::InitOpencl()
 
     cv::String errmsg;
     cv::String buildopt = "";
-    vectorFrame = clContext.getProg(programSource, buildopt, errmsg);
+    cv::ocl::Program program = context.getProg(programSource, buildopt, errmsg);
     if(errmsg.length() > 0) {
         throw std::runtime_error("OCL Error: " + errmsg);
     }
+
+    sharedContext = context;
+    sharedProgram = program;
+    clContext = context;
+    vectorFrame = program;
+}
+
+bool FlowLib::IsRowDone(FrameNumber f)
+{
+    return rowState[f] >= FlowRowExact;
+}
+
+bool FlowLib::IsRangeDone(FrameRange range)
+{
+    for(FrameNumber f=range.fromFrame; f<range.toFrame && f<rowState.size(); f++) {
+        if(!IsRowDone(f)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FlowLib::NextRange(FrameRange& range, int& priority)
+{
+    std::lock_guard<std::mutex> lock(rowMutex);
+
+    // Highest priority request first, finished ones are dropped
+    while(!requests.empty()) {
+        auto best = requests.begin();
+        for(auto it = requests.begin(); it != requests.end(); it++) {
+            if(it->priority > best->priority) {
+                best = it;
+            }
+        }
+
+        FrameRange request = best->range;
+        while(request.fromFrame < request.toFrame && IsRowDone(request.fromFrame)) {
+            request.fromFrame++;
+        }
+
+        if(request.fromFrame >= request.toFrame) {
+            requests.erase(best);
+            continue;
+        }
+
+        range = request;
+        priority = best->priority;
+        return true;
+    }
+
+    // Then the first gap
+    FrameNumber from = 0;
+    while(from < rowState.size() && IsRowDone(from)) {
+        from++;
+    }
+
+    if(from >= rowState.size()) {
+        return false;
+    }
+
+    FrameNumber to = from;
+    while(to < rowState.size() && !IsRowDone(to)) {
+        to++;
+    }
+
+    range = FrameRange{ from, to };
+    priority = INT_MIN;
+    return true;
+}
+
+void FlowLib::ReadRange(FrameRange range)
+{
+    // Reading to the end of the file keeps gaps from seeking when they are contiguous
+    int toFrame = range.toFrame >= rowState.size() ? INT_MAX : range.toFrame;
+    bool complete = reader->ReadRange(range.fromFrame, toFrame);
+    if(!complete) {
+        return;
+    }
+
+    // Only rows that went through HandleFrame are exact, the ones the reader could not deliver are zeroed and skipped
+    {
+        std::lock_guard<std::mutex> lock(rowMutex);
+        for(FrameNumber f=range.fromFrame; f<range.toFrame && f<rowState.size(); f++) {
+            if(rowState[f] < FlowRowExact) {
+                for(auto& output : outputs) {
+                    output.flow.row(f).setTo(cv::Scalar(0));
+                }
+                rowState[f] = FlowRowSkipped;
+            }
+        }
+    }
+    rowCondition.notify_all();
+}
+
+void FlowLib::ComputeRange(FrameRange range)
+{
+    while(true) {
+        {
+            std::lock_guard<std::mutex> lock(rowMutex);
+            if(IsRangeDone(range)) {
+                return;
+            }
+        }
+
+        // Nothing is running, compute it on this thread
+        std::unique_lock<std::mutex> readerLock(readerMutex, std::try_to_lock);
+        if(readerLock.owns_lock()) {
+            FrameRange next;
+            RequestRange(range, INT_MAX);
+            while(NextRange(next, currentPriority) && currentPriority == INT_MAX) {
+                ReadRange(next);
+            }
+            return;
+        }
+
+        // Otherwise let the running reader pick it up first
+        RequestRange(range, INT_MAX);
+        std::unique_lock<std::mutex> lock(rowMutex);
+        rowCondition.wait_for(lock, std::chrono::milliseconds(100), [&] { return IsRangeDone(range); });
+    }
+}
+
+void FlowLib::RunPreview()
+{
+    FrameNumber numFrames = rowState.size();
+    double framesPerMs = (double)numFrames / std::max<FrameNumber>(GetNumMs(), 1);
+    FrameNumber window = std::max<FrameNumber>(config.previewWindowMs * framesPerMs, 2);
+    FrameNumber stride = config.previewIntervalMs * framesPerMs;
+    FrameNumber offset = 0;
+
+    // Every pass samples the midpoints between the windows of the previous passes
+    while(stride > window && offset < stride) {
+        for(FrameNumber from = offset; from < numFrames; from += stride) {
+            RequestRange(FrameRange{ from, std::min(from + window, numFrames) }, PREVIEW_PRIORITY);
+        }
+
+        FrameRange range;
+        while(NextRange(range, currentPriority) && currentPriority != INT_MIN) {
+            ReadRange(range);
+        }
+
+        FillApproximate();
+        MY_LOG(cv::format("[FlowLib] preview pass done, window every %ld frames", offset > 0 ? offset : stride).c_str());
+
+        if(offset == 0) {
+            offset = stride / 2;
+        } else {
+            stride = offset;
+            offset = stride / 2;
+        }
+
+        if(offset < window) {
+            break;
+        }
+    }
+}
+
+void FlowLib::FillApproximate()
+{
+    std::lock_guard<std::mutex> lock(rowMutex);
+    FrameNumber numFrames = rowState.size();
+
+    std::vector<FrameRange> runs;
+    for(FrameNumber f=0; f<numFrames; f++) {
+        if(rowState[f] != FlowRowExact) {
+            continue;
+        }
+
+        FrameNumber from = f;
+        while(f < numFrames && rowState[f] == FlowRowExact) {
+            f++;
+        }
+        runs.push_back(FrameRange{ from, f });
+    }
+
+    if(runs.empty()) {
+        return;
+    }
+
+    auto distance = [](FrameRange run, FrameNumber f) -> FrameNumber {
+        if(f < run.fromFrame) {
+            return run.fromFrame - f;
+        }
+        return f - run.toFrame + 1;
+    };
+
+    for(auto& flowOutput : outputs) {
+        cv::Mat output = flowOutput.flow.getMat(cv::ACCESS_RW);
+
+        // Mean row of every exact run
+        std::vector<cv::Mat> runMeans;
+        for(auto& run : runs) {
+            cv::Mat mean;
+            cv::reduce(output.rowRange(run.fromFrame, run.toFrame), mean, 0, cv::REDUCE_AVG, CV_64F);
+            mean.convertTo(mean, output.type());
+            runMeans.push_back(mean);
+        }
+
+        // Everything that isn't final copies the nearest run
+        size_t run = 0;
+        for(FrameNumber f=0; f<numFrames; f++) {
+            if(rowState[f] >= FlowRowExact) {
+                continue;
+            }
+
+            while(run + 1 < runs.size() && runs[run + 1].fromFrame <= f) {
+                run++;
+            }
+
+            size_t nearest = run;
+            if(run + 1 < runs.size() && distance(runs[run + 1], f) < distance(runs[run], f)) {
+                nearest = run + 1;
+            }
+
+            runMeans[nearest].copyTo(output.row(f));
+        }
+    }
+
+    for(FrameNumber f=0; f<numFrames; f++) {
+        if(rowState[f] < FlowRowExact) {
+            rowState[f] = FlowRowApproximate;
+        }
+    }
+}
+
+// Moves the live window up to frame and clears the slots it reuses, false when frame already left the window
+bool FlowLib::AdvanceLive(FrameNumber frame)
+{
+    if(frame < liveStart) {
+        return false;
+    }
+    if(frame < livePrepared) {
+        return true;
+    }
+
+    // The oldest frame that keeps its slot
+    FrameNumber window = config.liveWindow;
+    FrameNumber oldest = frame + 1 > window ? frame + 1 - window : 0;
+    FrameNumber first = std::max(livePrepared, oldest);
+    liveStart = std::max(liveStart, oldest);
+    liveEnd = std::max(liveEnd, liveStart);
+    for(FrameNumber f=first; f<=frame; f++) {
+        FrameNumber slot = f % config.liveWindow;
+        for(auto& output : outputs) {
+            output.flow.row(slot).setTo(cv::Scalar(0));
+        }
+        rowState[slot] = FlowRowMissing;
+    }
+    livePrepared = frame + 1;
+    return true;
 }
 
 void FlowLib::HandleFrame(AVFrame* frame, int frame_number)
 {
+    FrameNumber row = frame_number;
+    if(live) {
+        std::lock_guard<std::mutex> lock(rowMutex);
+        if(!AdvanceLive(frame_number)) {
+            return;
+        }
+        row = frame_number % config.liveWindow;
+        framePts[row] = reader->CurrentPtsMs();
+    }
+    else {
+        if(frame_number >= rowState.size()) {
+            return;
+        }
+
+        // Overlapping ranges deliver a row twice, its vectors are binned once; skipped rows are final as well
+        std::lock_guard<std::mutex> lock(rowMutex);
+        if(rowState[frame_number] >= FlowRowExact) {
+            return;
+        }
+        if(rowState[frame_number] == FlowRowApproximate) {
+            for(auto& output : outputs) {
+                output.flow.row(frame_number).setTo(cv::Scalar(0));
+            }
+        }
+    }
+
     AVFrameSideData* sd = av_frame_get_side_data(frame, AV_FRAME_DATA_MOTION_VECTORS);
     if(sd) {
-        HandleVectorData(sd, frame_number);
+        HandleVectorData(sd, row);
+    }
+    if(capture) {
+        capture->Write(frame_number, sd ? (AVMotionVector*)sd->data : nullptr, sd ? sd->size / sizeof(AVMotionVector) : 0);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(rowMutex);
+        rowState[row] = FlowRowExact;
+        if(live) {
+            liveEnd = std::max(liveEnd, (FrameNumber)frame_number + 1);
+        }
+
+        // Hand the reader over to a more urgent range
+        for(auto& request : requests) {
+            if(request.priority > currentPriority) {
+                reader->Stop();
+                break;
+            }
+        }
     }
+    rowCondition.notify_all();
 
-    if(callback && frame_number > 0 && frame_number % 120 == 0) {
+    // Live rows are pushed one by one
+    if(callback && (live || (frame_number > 0 && frame_number % 120 == 0))) {
         callback((FlowLibShared*)this, frame_number);
     }
 }
@@ -149,16 +644,35 @@ void cartesian_to_polar(float x, float y, float* magnitude, float* angle_degrees
     }
 }
 
-void FlowLib::process_vector(AVMotionVector* vector, int frame_number, cv::Mat writeMat)
+void FlowLib::process_vector(AVMotionVector* vector, float magnitude, float angle, const BinConfig& bins, int frame_number, cv::Mat writeMat)
 {
-    float magnitude, angle;
-    cartesian_to_polar(vector->motion_x, vector->motion_y, &magnitude, &angle);
-    if (magnitude < MAGNITUDE_THRESHOLD) {
+    if (!bins.roi.contains(cv::Point(vector->dst_x, vector->dst_y))) {
+        return;
+    }
+
+    // Magnitude outputs keep everything with a direction, the threshold is applied when reading
+    bool withMagnitude = bins.mode == FlowOutputAngleMagnitude;
+    if (withMagnitude ? magnitude <= 0.0f : magnitude < bins.threshold) {
         return;
     }
 
-    int myAngle = (int)angle / 2;
-    if (myAngle < 0 || myAngle >= 180) {
+    int myAngle = (int)(angle * bins.bins / 360.0f);
+    if (myAngle < 0 || myAngle >= bins.bins) {
+        return;
+    }
+
+    if (bins.mode == FlowOutputSpatialGrid) {
+        int cellX = (vector->dst_x - bins.roi.x) * bins.grid / bins.roi.width;
+        int cellY = (vector->dst_y - bins.roi.y) * bins.grid / bins.roi.height;
+        writeMat.at<int>(frame_number, (cellY * bins.grid + cellX) * bins.bins + myAngle) += 1;
+        return;
+    }
+
+    if (withMagnitude) {
+        ushort& count = writeMat.at<ushort>(frame_number, myAngle * FLOW_MAGNITUDE_BINS + MagnitudeBin(magnitude));
+        if (count < USHRT_MAX) {
+            count++;
+        }
         return;
     }
 
@@ -171,39 +685,76 @@ void FlowLib::HandleVectorData(AVFrameSideData* sd, int frame_number)
 
     // BS::thread_pool pool;
 
-    if(!useOpenCL) {
-        cv::Mat writeMat = flowOutput.getMat(cv::ACCESS_WRITE);
+    // The kernel only produces angle rows, other modes are binned on the CPU
+    std::vector<size_t> cpuOutputs;
+    std::vector<size_t> oclOutputs;
+    for(size_t o=0; o<outputs.size(); o++) {
+        if(useOpenCL && outputs[o].config.mode == FlowOutputAngles) {
+            oclOutputs.push_back(o);
+        } else {
+            cpuOutputs.push_back(o);
+        }
+    }
+
+    if(!cpuOutputs.empty()) {
+        std::vector<cv::Mat> writeMats;
+        for(size_t o : cpuOutputs) {
+            writeMats.push_back(outputs[o].flow.getMat(cv::ACCESS_WRITE));
+        }
+
+        // The polar conversion is shared, only the binning runs per output
         for(int v=0; v<numVectors; v++) {
             AVMotionVector* vector = (AVMotionVector*)(sd->data + v * sizeof(AVMotionVector));
-            process_vector(vector, frame_number, writeMat);
+
+            // In quarter pixels whatever the encoder, h264 exports quarter pel (scale 4), mpeg4 and mpeg2video half pel
+            float scale = 4.0f / std::max<int>(vector->motion_scale, 1);
+            float magnitude, angle;
+            cartesian_to_polar(vector->motion_x * scale, vector->motion_y * scale, &magnitude, &angle);
+
+            for(size_t i=0; i<cpuOutputs.size(); i++) {
+                process_vector(vector, magnitude, angle, outputs[cpuOutputs[i]].config, frame_number, writeMats[i]);
+            }
             // pool.push_task(&FlowLib::process_vector, this, vector, frame_number);
         }
         // pool.wait_for_tasks();
-    } else {
-        cl::Context theContext((cl_context)clContext.ptr());
-
-        cv::ocl::Kernel kernel("vectorFrame", vectorFrame);
-        cl::Buffer vectorBuffer(theContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sd->size, sd->data);
-
-        kernel.args(
-            MAGNITUDE_THRESHOLD,
-            vectorBuffer,
-            cv::ocl::KernelArg::ReadWrite(flowOutput.row(frame_number))
-        );
 
-        size_t globalThreads[1] = { numVectors };
-        bool success = kernel.run(1, globalThreads, NULL, true);
-        if (!success){
-            throw std::runtime_error("Failed running the kernel...");
+        for(size_t i=0; i<cpuOutputs.size(); i++) {
+            const BinConfig& bins = outputs[cpuOutputs[i]].config;
+            if(bins.mode == FlowOutputSpatialGrid) {
+                GridPrefixSum(writeMats[i].row(frame_number), bins.bins, bins.grid);
+            }
         }
     }
 
-    
+    if(!oclOutputs.empty()) {
+        cl::Context theContext((cl_context)clContext.ptr());
+        cl::Buffer vectorBuffer(theContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sd->size, sd->data);
 
-    
+        for(size_t o : oclOutputs) {
+            cv::ocl::Kernel kernel("vectorFrame", vectorFrame);
+            const BinConfig& bins = outputs[o].config;
+
+            kernel.args(
+                bins.threshold,
+                bins.bins,
+                bins.roi.x,
+                bins.roi.y,
+                bins.roi.width,
+                bins.roi.height,
+                vectorBuffer,
+                cv::ocl::KernelArg::ReadWrite(outputs[o].flow.row(frame_number))
+            );
+
+            size_t globalThreads[1] = { numVectors };
+            bool success = kernel.run(1, globalThreads, NULL, true);
+            if (!success){
+                throw std::runtime_error("Failed running the kernel...");
+            }
+        }
+    }
 }
 
-FlowLibShared* CreateFlowLib(const char* videoPath, FlowProperties* properties)
+FlowLibShared* CreateFlowLib(const char* videoPath, FlowProperties* properties, int numProperties)
 {
-    return new FlowLib(videoPath);
+    return new FlowLib(videoPath, properties, numProperties);
 }
@@ -0,0 +1,382 @@
+#include "MotionCapture.hpp"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+// Captures of long videos pass 2 GB, long is 32 bits on Windows
+static int64_t FileTell(FILE* file)
+{
+#ifdef _WIN32
+    return _ftelli64(file);
+#else
+    return ftello(file);
+#endif
+}
+
+static int FileSeek(FILE* file, int64_t offset, int origin)
+{
+#ifdef _WIN32
+    return _fseeki64(file, offset, origin);
+#else
+    return fseeko(file, (off_t)offset, origin);
+#endif
+}
+
+// -- Columns --
+
+static void PutVarint(std::vector<uint8_t>& out, int64_t value)
+{
+    uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    while(zigzag >= 0x80) {
+        out.push_back((uint8_t)(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    out.push_back((uint8_t)zigzag);
+}
+
+static int64_t GetVarint(const uint8_t*& p, const uint8_t* end)
+{
+    uint64_t zigzag = 0;
+    for(int shift=0; p < end && shift < 64; shift += 7) {
+        uint8_t byte = *p++;
+        zigzag |= (uint64_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) {
+            return (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+        }
+    }
+    throw std::runtime_error("Corrupt motion capture chunk");
+}
+
+// -- MotionCaptureWriter --
+
+MotionCaptureWriter::MotionCaptureWriter(const char* path, int numFrames, int numMs, cv::Size videoSize)
+{
+    file = fopen(path, "wb");
+    if(!file) {
+        throw std::runtime_error(std::string("Could not create capture file ") + path);
+    }
+
+    CaptureHeader header = { CAPTURE_MAGIC, CAPTURE_VERSION, (uint32_t)numFrames, (uint32_t)numMs, (uint32_t)videoSize.width, (uint32_t)videoSize.height };
+    fwrite(&header, sizeof(header), 1, file);
+    frameChunks.assign(numFrames, CAPTURE_NO_CHUNK);
+}
+
+MotionCaptureWriter::~MotionCaptureWriter()
+{
+    // The frames of a chunk that can't be written are left out of the index, the rest stays readable
+    try {
+        FlushChunk();
+    } catch (std::exception& e) {
+        printf("Could not write the last capture chunk: %s\n", e.what());
+        for(uint32_t frame_number : chunkFrames) {
+            frameChunks[frame_number] = CAPTURE_NO_CHUNK;
+        }
+    }
+
+    CaptureTrailer trailer = { (uint64_t)FileTell(file), (uint32_t)chunkOffsets.size(), CAPTURE_INDEX_MAGIC };
+    fwrite(chunkOffsets.data(), sizeof(uint64_t), chunkOffsets.size(), file);
+    fwrite(frameChunks.data(), sizeof(uint32_t), frameChunks.size(), file);
+    fwrite(&trailer, sizeof(trailer), 1, file);
+    fclose(file);
+}
+
+void MotionCaptureWriter::Write(int frame_number, const AVMotionVector* vectors, size_t numVectors)
+{
+    if(frame_number < 0 || frame_number >= (int)frameChunks.size()) {
+        return;
+    }
+
+    frameChunks[frame_number] = (uint32_t)chunkOffsets.size();
+    chunkFrames.push_back(frame_number);
+    chunkCounts.push_back((uint32_t)numVectors);
+    chunkVectors.insert(chunkVectors.end(), vectors, vectors + numVectors);
+
+    if(chunkFrames.size() >= CAPTURE_CHUNK_FRAMES) {
+        FlushChunk();
+    }
+}
+
+void MotionCaptureWriter::FlushChunk()
+{
+    if(chunkFrames.empty()) {
+        return;
+    }
+
+    std::vector<uint8_t> raw;
+    PutVarint(raw, chunkFrames.size());
+    for(size_t i=0; i<chunkFrames.size(); i++) {
+        PutVarint(raw, chunkFrames[i]);
+        PutVarint(raw, chunkCounts[i]);
+    }
+
+    // One column at a time, positions restart their deltas at every frame
+    auto deltaColumn = [&](int16_t AVMotionVector::* field) {
+        size_t v = 0;
+        for(uint32_t count : chunkCounts) {
+            int previous = 0;
+            for(uint32_t i=0; i<count; i++, v++) {
+                int value = chunkVectors[v].*field;
+                PutVarint(raw, value - previous);
+                previous = value;
+            }
+        }
+    };
+    deltaColumn(&AVMotionVector::dst_x);
+    deltaColumn(&AVMotionVector::dst_y);
+    for(const AVMotionVector& vector : chunkVectors) {
+        raw.push_back(vector.w);
+    }
+    for(const AVMotionVector& vector : chunkVectors) {
+        raw.push_back(vector.h);
+    }
+    for(const AVMotionVector& vector : chunkVectors) {
+        PutVarint(raw, vector.motion_x);
+    }
+    for(const AVMotionVector& vector : chunkVectors) {
+        PutVarint(raw, vector.motion_y);
+    }
+    for(const AVMotionVector& vector : chunkVectors) {
+        PutVarint(raw, vector.motion_scale);
+    }
+
+    uLongf compressedSize = compressBound(raw.size());
+    std::vector<uint8_t> compressed(compressedSize);
+    if(compress2(compressed.data(), &compressedSize, raw.data(), raw.size(), Z_BEST_SPEED) != Z_OK) {
+        throw std::runtime_error("Could not compress capture chunk");
+    }
+
+    uint32_t sizes[2] = { (uint32_t)compressedSize, (uint32_t)raw.size() };
+    chunkOffsets.push_back((uint64_t)FileTell(file));
+    fwrite(sizes, sizeof(sizes), 1, file);
+    fwrite(compressed.data(), 1, compressedSize, file);
+
+    chunkFrames.clear();
+    chunkCounts.clear();
+    chunkVectors.clear();
+}
+
+// -- Replay --
+
+bool IsMotionCapture(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if(!file) {
+        return false;
+    }
+
+    uint32_t magic = 0;
+    bool isCapture = fread(&magic, sizeof(magic), 1, file) == 1 && magic == CAPTURE_MAGIC;
+    fclose(file);
+    return isCapture;
+}
+
+class CaptureReader : public Reader
+{
+public:
+    CaptureReader(const char* path, HandleFrameCallback callback): callback(callback)
+    {
+        file = fopen(path, "rb");
+        if(!file) {
+            throw std::runtime_error(std::string("Could not open capture file ") + path);
+        }
+
+        CaptureTrailer trailer;
+        if(fread(&header, sizeof(header), 1, file) != 1 || header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION) {
+            throw std::runtime_error("Not a motion capture file");
+        }
+        if(FileSeek(file, -(int64_t)sizeof(trailer), SEEK_END) != 0 || fread(&trailer, sizeof(trailer), 1, file) != 1 || trailer.magic != CAPTURE_INDEX_MAGIC) {
+            throw std::runtime_error("Motion capture file has no index, it was not closed");
+        }
+
+        chunkOffsets.resize(trailer.numChunks);
+        frameChunks.resize(header.numFrames);
+        FileSeek(file, (int64_t)trailer.indexOffset, SEEK_SET);
+        if(fread(chunkOffsets.data(), sizeof(uint64_t), chunkOffsets.size(), file) != chunkOffsets.size()
+            || fread(frameChunks.data(), sizeof(uint32_t), frameChunks.size(), file) != frameChunks.size()) {
+            throw std::runtime_error("Corrupt motion capture index");
+        }
+
+        frame = av_frame_alloc();
+        if(!frame) {
+            throw std::runtime_error("Could not allocate frame");
+        }
+    }
+
+    ~CaptureReader()
+    {
+        av_frame_free(&frame);
+        if(file) {
+            fclose(file);
+        }
+    }
+
+    void Start()
+    {
+        ReadRange(0, INT_MAX);
+    }
+
+    bool ReadRange(int fromFrame, int toFrame)
+    {
+        running = true;
+        int end = std::min(toFrame, (int)header.numFrames);
+        for(int f=std::max(fromFrame, 0); f<end; f++) {
+            if(!running) {
+                return false;
+            }
+
+            // Frames that were never captured replay without vectors
+            const AVMotionVector* vectors = nullptr;
+            size_t numVectors = 0;
+            if(frameChunks[f] != CAPTURE_NO_CHUNK) {
+                LoadChunk(frameChunks[f]);
+                auto it = std::find(chunkFrames.begin(), chunkFrames.end(), (uint32_t)f);
+                size_t i = it - chunkFrames.begin();
+                vectors = chunkVectors.data() + chunkFirsts[i];
+                numVectors = chunkCounts[i];
+            }
+
+            if(numVectors > 0) {
+                AVFrameSideData* sd = av_frame_new_side_data(frame, AV_FRAME_DATA_MOTION_VECTORS, numVectors * sizeof(AVMotionVector));
+                if(!sd) {
+                    throw std::runtime_error("Could not allocate motion vectors");
+                }
+                memcpy(sd->data, vectors, sd->size);
+            }
+
+            frame_number = f;
+            callback(frame, f);
+            av_frame_remove_side_data(frame, AV_FRAME_DATA_MOTION_VECTORS);
+        }
+
+        running = false;
+        return true;
+    }
+
+    void Stop()
+    {
+        running = false;
+    }
+
+    int CurrentFrame()
+    {
+        return frame_number;
+    }
+
+    int GetNumFrames()
+    {
+        return header.numFrames;
+    }
+
+    int GetNumMs()
+    {
+        return header.numMs;
+    }
+
+    cv::Size GetVideoSize()
+    {
+        return cv::Size(header.width, header.height);
+    }
+
+private:
+    void LoadChunk(uint32_t chunk)
+    {
+        if(chunk == loadedChunk) {
+            return;
+        }
+
+        uint32_t sizes[2];
+        FileSeek(file, (int64_t)chunkOffsets.at(chunk), SEEK_SET);
+        if(fread(sizes, sizeof(sizes), 1, file) != 1) {
+            throw std::runtime_error("Corrupt motion capture chunk");
+        }
+        std::vector<uint8_t> compressed(sizes[0]);
+        std::vector<uint8_t> raw(sizes[1]);
+        uLongf rawSize = sizes[1];
+        if(fread(compressed.data(), 1, compressed.size(), file) != compressed.size()
+            || uncompress(raw.data(), &rawSize, compressed.data(), compressed.size()) != Z_OK) {
+            throw std::runtime_error("Corrupt motion capture chunk");
+        }
+
+        const uint8_t* p = raw.data();
+        const uint8_t* end = p + rawSize;
+        size_t numFrames = GetVarint(p, end);
+        chunkFrames.resize(numFrames);
+        chunkCounts.resize(numFrames);
+        chunkFirsts.resize(numFrames);
+        size_t numVectors = 0;
+        for(size_t i=0; i<numFrames; i++) {
+            chunkFrames[i] = (uint32_t)GetVarint(p, end);
+            chunkCounts[i] = (uint32_t)GetVarint(p, end);
+            chunkFirsts[i] = numVectors;
+            numVectors += chunkCounts[i];
+        }
+
+        chunkVectors.assign(numVectors, AVMotionVector());
+        auto deltaColumn = [&](int16_t AVMotionVector::* field) {
+            size_t v = 0;
+            for(uint32_t count : chunkCounts) {
+                int previous = 0;
+                for(uint32_t i=0; i<count; i++, v++) {
+                    previous += (int)GetVarint(p, end);
+                    chunkVectors[v].*field = (int16_t)previous;
+                }
+            }
+        };
+        deltaColumn(&AVMotionVector::dst_x);
+        deltaColumn(&AVMotionVector::dst_y);
+        if(end - p < (ptrdiff_t)numVectors * 2) {
+            throw std::runtime_error("Corrupt motion capture chunk");
+        }
+        for(AVMotionVector& vector : chunkVectors) {
+            vector.w = *p++;
+        }
+        for(AVMotionVector& vector : chunkVectors) {
+            vector.h = *p++;
+        }
+        for(AVMotionVector& vector : chunkVectors) {
+            vector.motion_x = (int32_t)GetVarint(p, end);
+        }
+        for(AVMotionVector& vector : chunkVectors) {
+            vector.motion_y = (int32_t)GetVarint(p, end);
+        }
+        for(AVMotionVector& vector : chunkVectors) {
+            vector.motion_scale = (uint16_t)GetVarint(p, end);
+            vector.source = -1;
+            int scale = std::max<int>(vector.motion_scale, 1);
+            vector.src_x = vector.dst_x + vector.motion_x / scale;
+            vector.src_y = vector.dst_y + vector.motion_y / scale;
+        }
+
+        loadedChunk = chunk;
+    }
+
+    HandleFrameCallback callback;
+    FILE* file = nullptr;
+    CaptureHeader header = {};
+    std::vector<uint64_t> chunkOffsets;
+    std::vector<uint32_t> frameChunks;
+
+    uint32_t loadedChunk = CAPTURE_NO_CHUNK;
+    std::vector<uint32_t> chunkFrames;
+    std::vector<uint32_t> chunkCounts;
+    std::vector<size_t> chunkFirsts;
+    std::vector<AVMotionVector> chunkVectors;
+
+    AVFrame* frame = nullptr;
+    std::atomic<bool> running = { false };
+    int frame_number = 0;
+};
+
+std::unique_ptr<Reader> CreateCaptureReader(const char* path, HandleFrameCallback callback)
+{
+    return std::make_unique<CaptureReader>(path, callback);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Reader.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavutil/motion_vector.h>
+}
+
+// Motion vectors of decoder 3 in a columnar file, so a video can be binned again without decoding it
+//
+// Header, then zlib compressed chunks of CAPTURE_CHUNK_FRAMES captured frames, then the index and a trailer
+// A chunk holds a frame table (frame number, vector count) and per column all vectors of those frames:
+// dst_x and dst_y delta coded within a frame, w, h, motion_x, motion_y and motion_scale, integers as zigzag varints
+// The fields the binning doesn't use (source, src_x, src_y, flags) are not stored, src is restored from dst and motion
+
+#define CAPTURE_MAGIC 0x564d544a // "JTMV"
+#define CAPTURE_INDEX_MAGIC 0x494d544a // "JTMI"
+#define CAPTURE_VERSION 1
+#define CAPTURE_CHUNK_FRAMES 64
+#define CAPTURE_NO_CHUNK UINT32_MAX
+
+struct CaptureHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numFrames;
+    uint32_t numMs;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct CaptureTrailer {
+    uint64_t indexOffset; // uint64 offset per chunk, then uint32 chunk per frame
+    uint32_t numChunks;
+    uint32_t magic;
+};
+
+class MotionCaptureWriter
+{
+public:
+    MotionCaptureWriter(const char* path, int numFrames, int numMs, cv::Size videoSize);
+    // Writes the last chunk and the index
+    ~MotionCaptureWriter();
+
+    // Frames may come in any order, each at most once
+    void Write(int frame_number, const AVMotionVector* vectors, size_t numVectors);
+
+private:
+    void FlushChunk();
+
+    FILE* file = nullptr;
+    std::vector<uint64_t> chunkOffsets;
+    std::vector<uint32_t> frameChunks;
+
+    std::vector<uint32_t> chunkFrames;
+    std::vector<uint32_t> chunkCounts;
+    std::vector<AVMotionVector> chunkVectors;
+};
+
+// True when the file starts like a capture
+bool IsMotionCapture(const char* path);
+// Replays a capture as frames with motion vector side data, at the speed of inflating the chunks
+std::unique_ptr<Reader> CreateCaptureReader(const char* path, HandleFrameCallback callback);
@@ -0,0 +1,76 @@
+#include "MotionEncoder.hpp"
+
+extern "C" {
+#include <libavutil/opt.h>
+}
+
+#include <stdexcept>
+#include <string>
+
+class X264Encoder : public MotionEncoder
+{
+public:
+    X264Encoder(const FlowProperties& properties): live(properties.liveWindow > 0) {}
+
+    const char* EncoderName() override { return "libx264"; }
+    const char* DecoderName() override { return "h264"; }
+
+    void Configure(AVCodecContext* ctx) override
+    {
+        // No lookahead or frame threads, every frame comes out of the encoder as it goes in
+        if (live) {
+            av_opt_set(ctx->priv_data, "tune", "zerolatency", 0);
+        }
+
+        // av_opt_set(ctx->priv_data, "preset", "slow", 0);
+    }
+
+private:
+    bool live;
+};
+
+// mpeg4 and mpeg2video, the encoders of libavcodec's mpegvideo
+class MpegEncoder : public MotionEncoder
+{
+public:
+    MpegEncoder(const char* name, const FlowProperties& properties)
+        : name(name), search(properties.motionSearch), range(properties.motionRange) {}
+
+    const char* EncoderName() override { return name; }
+    const char* DecoderName() override { return name; }
+
+    void Configure(AVCodecContext* ctx) override
+    {
+        // The pts are frame numbers in the 1/25 time base, MPEG-2 only takes the standard rates
+        ctx->framerate = {25, 1};
+
+        ctx->thread_count = 0;
+        ctx->thread_type = FF_THREAD_SLICE;
+
+        static const char* searches[] = { nullptr, "zero", "epzs", "xone" };
+        if (search > FlowSearchDefault && search <= FlowSearchXone) {
+            av_opt_set(ctx->priv_data, "motion_est", searches[search], 0);
+        }
+        if (range > 0) {
+            ctx->me_range = range;
+        }
+    }
+
+private:
+    const char* name;
+    int search;
+    int range;
+};
+
+std::unique_ptr<MotionEncoder> CreateMotionEncoder(const FlowProperties& properties)
+{
+    switch (properties.motionEncoder) {
+    case FlowEncoderX264:
+        return std::make_unique<X264Encoder>(properties);
+    case FlowEncoderMpeg4:
+        return std::make_unique<MpegEncoder>("mpeg4", properties);
+    case FlowEncoderMpeg2:
+        return std::make_unique<MpegEncoder>("mpeg2video", properties);
+    }
+    throw std::runtime_error("Unknown motion encoder " + std::to_string(properties.motionEncoder));
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <memory>
+
+extern "C" {
+#include "FlowLib.h"
+#include <libavcodec/avcodec.h>
+}
+
+// The encoder (2) and decoder (3) pair between the source decoder and the vectors
+//
+// Frames of decoder (1) are encoded without B-frames and one keyframe, decoder (3) exports the vectors the encoder
+// searched. Only the motion estimation of the encoder matters, its rate control and the quality of the decoded
+// pictures don't.
+
+class MotionEncoder
+{
+public:
+    virtual ~MotionEncoder() = default;
+
+    virtual const char* EncoderName() = 0;
+    virtual const char* DecoderName() = 0;
+    // Before the encoder opens, size, pixel format, time base and frame rate are set
+    virtual void Configure(AVCodecContext* ctx) = 0;
+};
+
+// motionEncoder, motionSearch and motionRange of properties
+std::unique_ptr<MotionEncoder> CreateMotionEncoder(const FlowProperties& properties);
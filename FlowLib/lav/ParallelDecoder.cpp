@@ -0,0 +1,202 @@
+#include "ParallelDecoder.hpp"
+
+#include <stdexcept>
+
+ParallelDecoder::ParallelDecoder(const AVCodec* codec, const AVCodecParameters* par, int numDecoders, const std::function<void(AVCodecContext*)>& configure)
+    : maxInFlight(numDecoders * 2)
+{
+    try {
+        for (int d = 0; d < numDecoders; d++) {
+            AVCodecContext* context = avcodec_alloc_context3(codec);
+            if (!context) {
+                throw std::runtime_error("Could not allocate a decoding context");
+            }
+            contexts.push_back(context);
+
+            if (avcodec_parameters_to_context(context, par) < 0) {
+                throw std::runtime_error("Could not copy codec parameters to decoder context");
+            }
+            // The pool is the parallelism
+            context->thread_count = 1;
+            configure(context);
+
+            if (avcodec_open2(context, codec, NULL) < 0) {
+                throw std::runtime_error("Could not open codec (1)");
+            }
+        }
+    } catch (...) {
+        for (AVCodecContext*& context : contexts) {
+            avcodec_free_context(&context);
+        }
+        throw;
+    }
+
+    for (AVCodecContext* context : contexts) {
+        workers.emplace_back(&ParallelDecoder::Work, this, context);
+    }
+}
+
+ParallelDecoder::~ParallelDecoder()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobCondition.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    for (Job& job : jobs) {
+        av_packet_free(&job.packet);
+    }
+    for (auto& entry : results) {
+        FreeFrames(entry.second);
+    }
+    for (AVCodecContext*& context : contexts) {
+        avcodec_free_context(&context);
+    }
+}
+
+void ParallelDecoder::FreeFrames(Result& result)
+{
+    for (AVFrame*& frame : result.frames) {
+        av_frame_free(&frame);
+    }
+    result.frames.clear();
+}
+
+bool ParallelDecoder::IsIntraOnly(const AVCodecParameters* par)
+{
+    const AVCodecDescriptor* descriptor = avcodec_descriptor_get(par->codec_id);
+    return descriptor && (descriptor->props & AV_CODEC_PROP_INTRA_ONLY);
+}
+
+void ParallelDecoder::Work(AVCodecContext* context)
+{
+    while (true) {
+        Job job;
+        uint64_t jobGeneration;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobCondition.wait(lock, [&] { return stopping || !jobs.empty(); });
+            if (stopping) {
+                break;
+            }
+            job = jobs.front();
+            jobs.pop_front();
+            jobGeneration = generation;
+            busy++;
+        }
+
+        // Drained after every packet, decoders with output delay hold the picture back otherwise
+        Result result = { {}, 0 };
+        int ret = avcodec_send_packet(context, job.packet);
+        av_packet_free(&job.packet);
+        if (ret >= 0) {
+            ret = avcodec_send_packet(context, NULL);
+        }
+        while (ret >= 0) {
+            AVFrame* frame = av_frame_alloc();
+            ret = frame ? avcodec_receive_frame(context, frame) : AVERROR(ENOMEM);
+            if (ret < 0) {
+                av_frame_free(&frame);
+                break;
+            }
+            result.frames.push_back(frame);
+        }
+        result.error = ret == AVERROR_EOF ? 0 : ret;
+        avcodec_flush_buffers(context);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy--;
+            if (jobGeneration == generation) {
+                results[job.sequence] = result;
+            } else {
+                FreeFrames(result);
+            }
+        }
+        resultCondition.notify_all();
+    }
+}
+
+int ParallelDecoder::Send(const AVPacket* pkt)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!pkt) {
+        draining = true;
+        return 0;
+    }
+    if (draining) {
+        return AVERROR_EOF;
+    }
+
+    // Decoded frames count as well, but the caller is the one receiving them
+    resultCondition.wait(lock, [&] { return InFlight() < maxInFlight || results.count(nextReceive); });
+    if (InFlight() >= maxInFlight) {
+        return AVERROR(EAGAIN);
+    }
+
+    AVPacket* packet = av_packet_clone(pkt);
+    if (!packet) {
+        return AVERROR(ENOMEM);
+    }
+    jobs.push_back({ nextSend++, packet });
+    lock.unlock();
+    jobCondition.notify_one();
+    return 0;
+}
+
+int ParallelDecoder::Receive(AVFrame* frame)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        auto it = results.find(nextReceive);
+        if (it != results.end()) {
+            Result& result = it->second;
+            if (!result.frames.empty()) {
+                // One at a time, the result stays until its last frame is taken
+                AVFrame* next = result.frames.front();
+                result.frames.erase(result.frames.begin());
+                av_frame_move_ref(frame, next);
+                av_frame_free(&next);
+                return 0;
+            }
+
+            int error = result.error;
+            results.erase(it);
+            nextReceive++;
+            if (error < 0) {
+                return error;
+            }
+            continue;
+        }
+
+        if (nextReceive == nextSend) {
+            return draining ? AVERROR_EOF : AVERROR(EAGAIN);
+        }
+        if (!draining) {
+            return AVERROR(EAGAIN);
+        }
+        resultCondition.wait(lock);
+    }
+}
+
+void ParallelDecoder::Flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (Job& job : jobs) {
+        av_packet_free(&job.packet);
+    }
+    jobs.clear();
+    generation++;
+
+    resultCondition.wait(lock, [&] { return busy == 0; });
+    for (auto& entry : results) {
+        FreeFrames(entry.second);
+    }
+    results.clear();
+    nextReceive = nextSend;
+    draining = false;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Decoder (1) for intra-only sources, every packet decodes on its own
+//
+// Packets are numbered as they are sent and picked up by a pool of single threaded decoder contexts,
+// frames come back out in the same order. Follows the send/receive calls of a decoder context.
+
+class ParallelDecoder
+{
+public:
+    // A context per decoder is opened like the serial one, configure is applied to each before opening
+    ParallelDecoder(const AVCodec* codec, const AVCodecParameters* par, int numDecoders, const std::function<void(AVCodecContext*)>& configure);
+    ~ParallelDecoder();
+
+    // Like avcodec_send_packet, blocks while the pool is decoding a full pool of packets, NULL starts draining
+    // AVERROR(EAGAIN) when the pool is full and the next frame is ready, it has to be received first
+    int Send(const AVPacket* pkt);
+    // Like avcodec_receive_frame, AVERROR(EAGAIN) when the next frame isn't decoded yet
+    int Receive(AVFrame* frame);
+    // Drops everything in flight, after a seek
+    void Flush();
+
+    // Intra-only by codec, every packet carries what it takes to decode it
+    static bool IsIntraOnly(const AVCodecParameters* par);
+
+private:
+    struct Job {
+        uint64_t sequence;
+        AVPacket* packet;
+    };
+    struct Result {
+        std::vector<AVFrame*> frames; // Empty when the packet produced no frame
+        int error;
+    };
+
+    void Work(AVCodecContext* context);
+    static void FreeFrames(Result& result);
+    size_t InFlight() const { return jobs.size() + busy + results.size(); }
+
+    std::vector<AVCodecContext*> contexts;
+    std::vector<std::thread> workers;
+    size_t maxInFlight;
+
+    std::mutex mutex;
+    std::condition_variable jobCondition;
+    std::condition_variable resultCondition;
+    std::deque<Job> jobs;
+    std::map<uint64_t, Result> results;
+    uint64_t nextSend = 0;
+    uint64_t nextReceive = 0;
+    uint64_t generation = 0; // Bumped by Flush, results of older jobs are dropped
+    int busy = 0;
+    bool draining = false;
+    bool stopping = false;
+};
@@ -1,18 +1,40 @@
 #include "Reader.hpp"
 #include "SharedReader.hpp"
+#include "MotionCapture.hpp"
+#include "ParallelDecoder.hpp"
+#include "MotionEncoder.hpp"
 
 extern "C" {
 #include <libavutil/error.h>
 #include <libavutil/motion_vector.h>
 #include <libavutil/timestamp.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>	
 }
 
 #include <string>
 #include <stdexcept>
+#include <deque>
 #include <map>
 #include <cmath>
+#include <climits>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+#include <cstring>
 
 #ifdef av_err2str
 #undef av_err2str
@@ -27,7 +49,7 @@ av_always_inline std::string av_err2string(int errnum) {
 class MyReader : public Reader
 {
 public:
-    MyReader(const char* path, HandleFrameCallback callback): path(path), callback(callback)
+    MyReader(const char* path, HandleFrameCallback callback, const FlowProperties& properties): path(path), callback(callback), properties(properties)
     {
         av_log_set_level(AV_LOG_ERROR);
 
@@ -43,10 +65,11 @@ public:
 
     void Start()
     {
-        running = true;
-        decode_loop_1();
+        ReadRange(0, INT_MAX);
     }
 
+    bool ReadRange(int fromFrame, int toFrame);
+
     void Stop()
     {
         running = false;
@@ -72,20 +95,76 @@ public:
         return cv::Size(dec_ctx_1->width, dec_ctx_1->height);
     }
 
+    FlowStats GetStats()
+    {
+        std::lock_guard<std::mutex> lock(latency_mutex);
+        FlowStats stats;
+        stats.framesDecoded = frames_decoded;
+        stats.framesDuplicate = frames_duplicate;
+        stats.latencyLastMs = latency_last;
+        stats.latencyMeanMs = latency_count > 0 ? latency_sum / latency_count : 0;
+        stats.latencyMaxMs = latency_max;
+        return stats;
+    }
+
+    int64_t CurrentPtsMs()
+    {
+        return current_pts_ms;
+    }
+
 protected:
     void init_decoder_1(const char* src_filename);
     void init_encoder_2();
     void init_decoder_3();
 
+    void seek_1(int frame);
+    void reset_encoder_2();
+
     void decode_loop_1();
-    void encode_loop_2();
-    void decode_loop_3();
+    void receive_loop_1();
+    void fallback_1(int error);
+    void encode_loop_2(AVFrame* frame);
+    void decode_loop_3(AVPacket* pkt);
+    void report_frame(AVFrame* frame, int frame_index);
+    void report_duplicates(int passed);
 
     bool running = false;
     const char* path;
     HandleFrameCallback callback;
+    FlowProperties properties;
     int frame_number = 0;
 
+    // Range state, the reference frame only primes the encoder and is not reported
+    int range_ref = 0;
+    int range_first = 0;
+    int range_to = INT_MAX;
+    bool range_done = false;
+    bool at_start = true;
+    bool encoder_used = false;
+    int next_frame_1 = 0;
+    int next_frame_3 = 0;
+    int last_encoded = 0;
+    // Duplicate frames and the encoded frame decoder (3) has to pass before they are reported in order
+    std::deque<std::pair<int, int>> held_duplicates;
+
+    std::atomic<long long> frames_decoded = { 0 };
+    std::atomic<long long> frames_duplicate = { 0 };
+
+    // When the packet of a frame was read, by packet pts and then by frame number, for the latency of its row
+    typedef std::chrono::steady_clock Clock;
+    struct PendingFrame {
+        Clock::time_point arrival;
+        int64_t ptsMs;
+    };
+    std::map<int64_t, Clock::time_point> packet_arrival;
+    std::map<int, PendingFrame> pending_frames;
+    int64_t current_pts_ms = 0;
+    std::mutex latency_mutex;
+    double latency_last = 0;
+    double latency_sum = 0;
+    double latency_max = 0;
+    long long latency_count = 0;
+
     StreamProgram streamProgram;
     AVFormatContext *fmt_ctx = NULL;
     // int video_stream_idx = -1;
@@ -103,11 +182,20 @@ protected:
     // AVStream *video_stream_1 = NULL;
     AVFrame *frame_1 = NULL;
     AVPacket* pkt_dec_1 = NULL;
+    // The last frame sent to the encoder, duplicates are compared against it
+    AVFrame *prev_1 = NULL;
+    // Without side data, reported for duplicates
+    AVFrame *blank_1 = NULL;
+    // Replaces dec_ctx_1 for decoding intra-only sources, dec_ctx_1 still describes the stream
+    std::unique_ptr<ParallelDecoder> parallel_1;
 
     // Endoder 2
+    std::unique_ptr<MotionEncoder> motion_2;
     AVCodecContext *enc_ctx_2 = NULL;
     const AVCodec* enc_2 = NULL;
     AVPacket* pkt_enc_2 = NULL;
+    // The luma of sources in a pixel format the encoder doesn't take, with grey chroma
+    AVFrame *gray_2 = NULL;
 
     // Decoder 3
     AVCodecContext *dec_ctx_3 = NULL;
@@ -119,9 +207,13 @@ protected:
 MyReader::~MyReader()
 {
     if (fmt_ctx != NULL)
-        avformat_close_input(&fmt_ctx);
+        CloseFormatContext(&fmt_ctx);
     if(frame_1 != NULL)
         av_frame_free(&frame_1);
+    if(prev_1 != NULL)
+        av_frame_free(&prev_1);
+    if(blank_1 != NULL)
+        av_frame_free(&blank_1);
     if(dec_ctx_1 != NULL)
         avcodec_free_context(&dec_ctx_1);
     if(pkt_dec_1 != NULL)
@@ -132,6 +224,8 @@ MyReader::~MyReader()
         avcodec_free_context(&enc_ctx_2);
     if(pkt_enc_2 != NULL)
         av_packet_free(&pkt_enc_2);
+    if(gray_2 != NULL)
+        av_frame_free(&gray_2);
 
 
     if(frame_3 != NULL)
@@ -142,12 +236,26 @@ MyReader::~MyReader()
 
 // Initialization
 
+static void ApplyFastDecode(AVCodecContext* ctx, const AVCodec* codec, int flags)
+{
+    if (flags & FlowFastSkipLoopFilter)
+        ctx->skip_loop_filter = AVDISCARD_ALL;
+    if (flags & FlowFastSkipIdct)
+        ctx->skip_idct = AVDISCARD_ALL;
+    if (flags & FlowFastFlags)
+        ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+    if ((flags & FlowFastLowres) && codec->max_lowres > 0)
+        ctx->lowres = 1;
+}
+
 void MyReader::init_decoder_1(const char* src_filename)
 {
     int ret = 0;
 
     frame_1 = av_frame_alloc();
-	if (!frame_1) {
+    prev_1 = av_frame_alloc();
+    blank_1 = av_frame_alloc();
+	if (!frame_1 || !prev_1 || !blank_1) {
         throw std::runtime_error("Could not allocate frame");
 	}
 
@@ -159,22 +267,15 @@ void MyReader::init_decoder_1(const char* src_filename)
     // av_register_all();
     // avcodec_register_all();
 
-    ret = avformat_open_input(&fmt_ctx, src_filename, NULL, NULL);
-    if (ret < 0) {
-        throw std::runtime_error("Could not open source file: " + av_err2str(ret));
-	}
+    fmt_ctx = OpenFormatContext(src_filename, properties);
 
-    if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
-		throw std::runtime_error("Could not find stream information");
-	}
-
-    av_dump_format(fmt_ctx, 0, src_filename, 0);
-
-    streamProgram = GetStreamProgram(fmt_ctx);
+    streamProgram = GetStreamProgram(fmt_ctx, properties);
 
 	if (streamProgram.videoStream == nullptr) {
         throw std::runtime_error("Could not find stream");
 	}
+    DiscardUnusedStreams(fmt_ctx, streamProgram);
+    IndexPackets(fmt_ctx, streamProgram, properties);
 
     dec_1 = avcodec_find_decoder(streamProgram.videoStream->codecpar->codec_id);
     if (!dec_1) {
@@ -197,19 +298,55 @@ void MyReader::init_decoder_1(const char* src_filename)
 
     dec_ctx_1->thread_count = 0;
 
-    if (dec_1->capabilities & AV_CODEC_CAP_FRAME_THREADS)
+    // Frame threads hold a frame per thread, live mode can't wait for them
+    if ((dec_1->capabilities & AV_CODEC_CAP_FRAME_THREADS) && properties.liveWindow <= 0)
         dec_ctx_1->thread_type = FF_THREAD_FRAME;
     else if (dec_1->capabilities & AV_CODEC_CAP_SLICE_THREADS)
         dec_ctx_1->thread_type = FF_THREAD_SLICE;
     else
         dec_ctx_1->thread_count = 1; //don't use multithreading
 
+    // The encoder and the vector grid take the size the decoder opens with, lowres included
+    ApplyFastDecode(dec_ctx_1, dec_1, properties.fastDecode1);
+
     av_dict_set(&opts_1, "flags2", "+export_mvs", 0);
     ret = avcodec_open2(dec_ctx_1, dec_1, &opts_1);
     av_dict_free(&opts_1);
     if (ret < 0) {
         throw std::runtime_error("Could not open codec");
     }
+
+    // Intra-only frames don't depend on each other, a pool of decoders beats the threads of one
+    // All-keyframe h264 or hevc doesn't qualify, a context that never saw the in-band SPS/PPS can't decode
+    int numDecoders = properties.intraDecoders > 0 ? properties.intraDecoders : std::min((int)std::thread::hardware_concurrency(), 16);
+    if (numDecoders > 1 && ParallelDecoder::IsIntraOnly(streamProgram.videoStream->codecpar)) {
+        int fastDecode = properties.fastDecode1;
+        parallel_1 = std::make_unique<ParallelDecoder>(dec_1, streamProgram.videoStream->codecpar, numDecoders, [=](AVCodecContext* ctx) {
+            ApplyFastDecode(ctx, dec_1, fastDecode);
+            av_opt_set(ctx, "flags2", "+export_mvs", 0);
+        });
+    }
+}
+
+static bool SupportsPixelFormat(const AVCodec* codec, AVPixelFormat format)
+{
+    if (!codec->pix_fmts) {
+        return true;
+    }
+    for (const AVPixelFormat* f = codec->pix_fmts; *f != AV_PIX_FMT_NONE; f++) {
+        if (*f == format) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 8 bit luma in the first plane, the motion search only looks at it
+static bool HasPlanarLuma(AVPixelFormat format)
+{
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+    return desc && desc->comp[0].depth == 8 && desc->comp[0].step == 1 && desc->comp[0].plane == 0
+        && !(desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL));
 }
 
 void MyReader::init_encoder_2()
@@ -221,9 +358,13 @@ void MyReader::init_encoder_2()
         throw std::runtime_error("Could not allocate packet");
     }
 
-    enc_2 = avcodec_find_encoder_by_name("libx264");
+    if (!motion_2) {
+        motion_2 = CreateMotionEncoder(properties);
+    }
+
+    enc_2 = avcodec_find_encoder_by_name(motion_2->EncoderName());
     if(!enc_2) {
-        throw std::runtime_error("Could not find encoder");
+        throw std::runtime_error(std::string("Could not find encoder ") + motion_2->EncoderName());
     }
 
     enc_ctx_2 = avcodec_alloc_context3(enc_2);
@@ -234,6 +375,18 @@ void MyReader::init_encoder_2()
     enc_ctx_2->width = dec_ctx_1->width;
     enc_ctx_2->height = dec_ctx_1->height;
     enc_ctx_2->pix_fmt = dec_ctx_1->pix_fmt;
+    if (!SupportsPixelFormat(enc_2, dec_ctx_1->pix_fmt)) {
+        if (!HasPlanarLuma(dec_ctx_1->pix_fmt) || !SupportsPixelFormat(enc_2, AV_PIX_FMT_YUV420P)) {
+            throw std::runtime_error(std::string("Encoder ") + motion_2->EncoderName() + " doesn't take pixel format " + av_get_pix_fmt_name(dec_ctx_1->pix_fmt));
+        }
+        enc_ctx_2->pix_fmt = AV_PIX_FMT_YUV420P;
+        if (!gray_2) {
+            gray_2 = av_frame_alloc();
+            if (!gray_2) {
+                throw std::runtime_error("Could not allocate frame");
+            }
+        }
+    }
 
     enc_ctx_2->time_base = {1, 25};
     enc_ctx_2->framerate = {25, 1};
@@ -242,7 +395,12 @@ void MyReader::init_encoder_2()
     enc_ctx_2->max_b_frames = 0;
     enc_ctx_2->gop_size = 100000;
 
-    // av_opt_set(enc_ctx_2->priv_data, "preset", "slow", 0);
+    // A live stream may not announce its rate
+    if (enc_ctx_2->framerate.num <= 0 || enc_ctx_2->framerate.den <= 0) {
+        enc_ctx_2->framerate = {25, 1};
+    }
+
+    motion_2->Configure(enc_ctx_2);
 
     ret = avcodec_open2(enc_ctx_2, enc_2, NULL);
     if (ret < 0) {
@@ -259,25 +417,27 @@ void MyReader::init_decoder_3()
         throw std::runtime_error("Could not allocate frame");
 	}
 
+    dec_3 = avcodec_find_decoder_by_name(motion_2->DecoderName());
+    if(!dec_3) {
+        throw std::runtime_error(std::string("Could not find decoder ") + motion_2->DecoderName());
+    }
+
     dec_ctx_3 = avcodec_alloc_context3(dec_3);
     if (!dec_ctx_3) {
         throw std::runtime_error("Could not allocate a decoding context");
     }
 
-    dec_3 = avcodec_find_decoder_by_name("h264");
-    if(!dec_3) {
-        throw std::runtime_error("Could not find decoder");
-    }
-
     dec_ctx_3->thread_count = 0;
 
-    if (dec_3->capabilities & AV_CODEC_CAP_FRAME_THREADS)
+    if ((dec_3->capabilities & AV_CODEC_CAP_FRAME_THREADS) && properties.liveWindow <= 0)
         dec_ctx_3->thread_type = FF_THREAD_FRAME;
     else if (dec_3->capabilities & AV_CODEC_CAP_SLICE_THREADS)
         dec_ctx_3->thread_type = FF_THREAD_SLICE;
     else
         dec_ctx_3->thread_count = 1; //don't use multithreading
 
+    ApplyFastDecode(dec_ctx_3, dec_3, properties.fastDecode3);
+
     av_dict_set(&opts_3, "flags2", "+export_mvs", 0);
     ret = avcodec_open2(dec_ctx_3, dec_3, &opts_3);
     av_dict_free(&opts_3);
@@ -287,48 +447,299 @@ void MyReader::init_decoder_3()
     }
 }
 
+// Seeking
+
+void MyReader::seek_1(int frame)
+{
+    if (at_start && frame == 0) {
+        next_frame_1 = 0;
+        return;
+    }
+
+    int ret = SeekToFrame(fmt_ctx, streamProgram, frame);
+    if (ret < 0) {
+        throw std::runtime_error("Could not seek to frame " + std::to_string(frame) + ": " + av_err2str(ret));
+    }
+
+    avcodec_flush_buffers(dec_ctx_1);
+    if (parallel_1) {
+        parallel_1->Flush();
+    }
+    at_start = false;
+
+    // Resolved from the first decoded timestamp after the seek
+    next_frame_1 = -1;
+}
+
+void MyReader::reset_encoder_2()
+{
+    if (!encoder_used) {
+        return;
+    }
+
+    // Encoders can't be flushed after draining, a fresh context also makes the first frame an I frame
+    avcodec_free_context(&enc_ctx_2);
+    av_packet_free(&pkt_enc_2);
+    init_encoder_2();
+
+    avcodec_flush_buffers(dec_ctx_3);
+    encoder_used = false;
+}
+
 // Reading loop
 
+// Sum of absolute differences of 16 bytes
+static uint32_t Sad16(const uint8_t* a, const uint8_t* b)
+{
+#if defined(__SSE2__) || defined(_M_X64)
+    // Two sums of 8 bytes, in the low 16 bits of each half
+    __m128i sad = _mm_sad_epu8(_mm_loadu_si128((const __m128i*)a), _mm_loadu_si128((const __m128i*)b));
+    return (uint32_t)(_mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4));
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    return vaddlvq_u8(vabdq_u8(vld1q_u8(a), vld1q_u8(b)));
+#else
+    uint32_t sad = 0;
+    for (int i = 0; i < 16; i++) {
+        sad += std::abs(a[i] - b[i]);
+    }
+    return sad;
+#endif
+}
+
+// Every 16x16 block of the luma plane within threshold of the previous frame, for 8 bit planar formats
+static bool IsDuplicate(const AVFrame* frame, const AVFrame* previous, float threshold)
+{
+    if (threshold <= 0 || !previous->data[0] || frame->format != previous->format
+        || frame->width != previous->width || frame->height != previous->height || frame->width < 16 || frame->height < 16) {
+        return false;
+    }
+
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    if (!desc || desc->comp[0].depth != 8 || desc->comp[0].step != 1
+        || (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL))) {
+        return false;
+    }
+
+    int blocksX = frame->width / 16;
+    uint32_t limit = (uint32_t)(threshold * 16 * 16);
+    std::vector<uint32_t> sums(blocksX);
+    for (int y0 = 0; y0 + 16 <= frame->height; y0 += 16) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int y = y0; y < y0 + 16; y++) {
+            const uint8_t* a = frame->data[0] + y * frame->linesize[0];
+            const uint8_t* b = previous->data[0] + y * previous->linesize[0];
+            for (int bx = 0; bx < blocksX; bx++) {
+                sums[bx] += Sad16(a + bx * 16, b + bx * 16);
+            }
+        }
+
+        for (uint32_t sum : sums) {
+            if (sum > limit) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool MyReader::ReadRange(int fromFrame, int toFrame)
+{
+    running = true;
+    range_done = false;
+    range_ref = std::max(0, fromFrame - 1);
+    range_to = toFrame;
+
+    reset_encoder_2();
+    av_frame_unref(prev_1);
+    packet_arrival.clear();
+    pending_frames.clear();
+    held_duplicates.clear();
+    seek_1(range_ref);
+    decode_loop_1();
+
+    if (!range_done && !running) {
+        return false;
+    }
+
+    // Drain the encoder lookahead so the tail of the range is delivered as well
+    if (encoder_used) {
+        encode_loop_2(NULL);
+        decode_loop_3(NULL);
+        report_duplicates(INT_MAX);
+    }
+
+    running = false;
+    return true;
+}
+
 void MyReader::decode_loop_1()
 {
     int ret = 0;
 
-    while (av_read_frame(fmt_ctx, pkt_dec_1) >= 0 && running) {
+    while (running) {
+        ret = av_read_frame(fmt_ctx, pkt_dec_1);
+        if (ret < 0) {
+            break;
+        }
+
+        at_start = false;
+
 		if (pkt_dec_1->stream_index != streamProgram.videoStream->index) {
             av_packet_unref(pkt_dec_1);
             continue;
         }
 
-        ret = avcodec_send_packet(dec_ctx_1, pkt_dec_1);
+        if (pkt_dec_1->pts != AV_NOPTS_VALUE) {
+            packet_arrival[pkt_dec_1->pts] = Clock::now();
+        }
+
+        ret = parallel_1 ? parallel_1->Send(pkt_dec_1) : avcodec_send_packet(dec_ctx_1, pkt_dec_1);
+        // The pool holds as many decoded frames as it takes, they go on to the encoder first
+        while (ret == AVERROR(EAGAIN) && parallel_1 && running) {
+            receive_loop_1();
+            // After a fallback the packet is from before the seek, the serial decoder reads it again
+            ret = parallel_1 ? parallel_1->Send(pkt_dec_1) : 0;
+        }
+        av_packet_unref(pkt_dec_1);
+        if (!running) {
+            break;
+        }
         if (ret < 0) {
             throw std::runtime_error("Error while sending a packet to the decoder (1) " + av_err2str(ret));
         }
 
-        while (ret >= 0) {
-            ret = avcodec_receive_frame(dec_ctx_1, frame_1);
-            
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                break;
-            }
-            
-            if (ret < 0) {
-                throw std::runtime_error("Error while receiving a frame from the decoder (1)");
-            }
+        receive_loop_1();
+	}
+
+    if (running) {
+        // End of file, the decoder still holds its delayed frames
+        bool pooled = parallel_1 != nullptr;
+        if (parallel_1) {
+            parallel_1->Send(NULL);
+        } else {
+            avcodec_send_packet(dec_ctx_1, NULL);
+        }
+        receive_loop_1();
+        if (pooled && !parallel_1 && running) {
+            // The pool failed on one of the last packets, the serial decoder reads them again
+            decode_loop_1();
+            return;
+        }
+        range_done = true;
+    }
+}
 
-            encode_loop_2();
+void MyReader::fallback_1(int error)
+{
+    // Frames before the failed one are already on their way, the serial decoder picks up at it
+    int resume = next_frame_1 < 0 ? range_ref : next_frame_1;
+    av_log(NULL, AV_LOG_ERROR, "Decoder pool failed at frame %d (%s), decoding serially\n", resume, av_err2str(error).c_str());
 
-            av_frame_unref(frame_1);
+    parallel_1.reset();
+    range_ref = resume;
+    seek_1(resume);
+}
+
+void MyReader::receive_loop_1()
+{
+    int ret = 0;
+
+    while (running) {
+        ret = parallel_1 ? parallel_1->Receive(frame_1) : avcodec_receive_frame(dec_ctx_1, frame_1);
+        
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            break;
         }
-            
-		av_packet_unref(pkt_dec_1);
-	}
+        
+        if (ret < 0 && parallel_1) {
+            fallback_1(ret);
+            continue;
+        }
+        if (ret < 0) {
+            throw std::runtime_error("Error while receiving a frame from the decoder (1)");
+        }
+
+        if (next_frame_1 < 0) {
+            next_frame_1 = frame_1->best_effort_timestamp == AV_NOPTS_VALUE ? range_ref : streamProgram.PtsToFrame(frame_1->best_effort_timestamp);
+        }
+        int frame_index = next_frame_1++;
+
+        if (frame_index >= range_to) {
+            range_done = true;
+            running = false;
+        }
+        else if (frame_index >= range_ref) {
+            frames_decoded++;
+
+            // Frames come out in pts order, earlier packets are done with
+            PendingFrame pending = { Clock::now(), 0 };
+            int64_t pts = frame_1->best_effort_timestamp;
+            if (pts != AV_NOPTS_VALUE) {
+                auto arrival = packet_arrival.find(pts);
+                if (arrival != packet_arrival.end()) {
+                    pending.arrival = arrival->second;
+                }
+                packet_arrival.erase(packet_arrival.begin(), packet_arrival.upper_bound(pts));
+                pending.ptsMs = av_rescale_q(pts, streamProgram.videoStream->time_base, {1, 1000});
+            }
+            pending_frames[frame_index] = pending;
+
+            if (encoder_used && IsDuplicate(frame_1, prev_1, properties.duplicateThreshold)) {
+                // No motion since the previous frame, the row stays zero without encoding it
+                // Reported once the frames still in the encoder are, rows are done in frame order
+                frames_duplicate++;
+                held_duplicates.push_back({ frame_index, last_encoded });
+                report_duplicates(next_frame_3 - 1);
+            }
+            else {
+                if (!encoder_used) {
+                    range_first = frame_index;
+                    next_frame_3 = frame_index;
+                }
+
+                // The pts carries the frame number through the encoder and decoder (3)
+                frame_1->pts = frame_index;
+                frame_1->pict_type = AV_PICTURE_TYPE_NONE;
+                encode_loop_2(frame_1);
+                encoder_used = true;
+                last_encoded = frame_index;
+
+                if (properties.duplicateThreshold > 0) {
+                    av_frame_unref(prev_1);
+                    av_frame_ref(prev_1, frame_1);
+                }
+            }
+        }
+
+        av_frame_unref(frame_1);
+    }
 }
 
-void MyReader::encode_loop_2()
+void MyReader::encode_loop_2(AVFrame* frame)
 {
     int ret = 0;
 
-    ret = avcodec_send_frame(enc_ctx_2, frame_1);
+    if (frame && gray_2) {
+        // The encoder may still hold the previous one
+        av_frame_unref(gray_2);
+        gray_2->format = AV_PIX_FMT_YUV420P;
+        gray_2->width = frame->width;
+        gray_2->height = frame->height;
+        if (av_frame_get_buffer(gray_2, 0) < 0) {
+            throw std::runtime_error("Could not allocate frame");
+        }
+
+        av_image_copy_plane(gray_2->data[0], gray_2->linesize[0], frame->data[0], frame->linesize[0], frame->width, frame->height);
+        int chromaHeight = (frame->height + 1) / 2;
+        for (int p = 1; p < 3; p++) {
+            memset(gray_2->data[p], 128, (size_t)gray_2->linesize[p] * chromaHeight);
+        }
+        gray_2->pts = frame->pts;
+        gray_2->pict_type = frame->pict_type;
+        frame = gray_2;
+    }
+
+    ret = avcodec_send_frame(enc_ctx_2, frame);
     if (ret < 0) {
         throw std::runtime_error("Error sending a frame for encoding (2)");
     }
@@ -344,17 +755,17 @@ void MyReader::encode_loop_2()
             throw std::runtime_error("Error during encoding (2)");
         }
 
-        decode_loop_3();
+        decode_loop_3(pkt_enc_2);
         
         av_packet_unref(pkt_enc_2);
     }
 }
 
-void MyReader::decode_loop_3()
+void MyReader::decode_loop_3(AVPacket* pkt)
 {
     int ret = 0;
 
-    ret = avcodec_send_packet(dec_ctx_3, pkt_enc_2);
+    ret = avcodec_send_packet(dec_ctx_3, pkt);
     if (ret < 0) {
         throw std::runtime_error("Error while sending a packet to the decoder (3)");
     }
@@ -370,14 +781,51 @@ void MyReader::decode_loop_3()
             throw std::runtime_error("Error while receiving a frame from the decoder (3)");
         }
 
-        callback(frame_3, frame_number);
-        frame_number ++;
+        int frame_index = frame_3->pts == AV_NOPTS_VALUE ? next_frame_3 : (int)frame_3->pts;
+        next_frame_3 = frame_index + 1;
+
+        // The first frame after a seek has no motion to report
+        if (frame_index != range_first || range_first == 0) {
+            report_frame(frame_3, frame_index);
+        }
         
         av_frame_unref(frame_3);
+        report_duplicates(frame_index);
     }
 }
 
-std::unique_ptr<Reader> CreateReader(const char* path, HandleFrameCallback callback)
+void MyReader::report_duplicates(int passed)
 {
-    return std::make_unique<MyReader>(path, callback);
+    while (!held_duplicates.empty() && held_duplicates.front().second <= passed) {
+        report_frame(blank_1, held_duplicates.front().first);
+        held_duplicates.pop_front();
+    }
+}
+
+void MyReader::report_frame(AVFrame* frame, int frame_index)
+{
+    auto pending = pending_frames.find(frame_index);
+    current_pts_ms = pending != pending_frames.end() ? pending->second.ptsMs : av_rescale_q(streamProgram.FrameToPts(frame_index), streamProgram.videoStream->time_base, {1, 1000});
+
+    frame_number = frame_index;
+    callback(frame, frame_number);
+
+    // The row is binned once the callback returns
+    if (pending != pending_frames.end()) {
+        double latency = std::chrono::duration<double, std::milli>(Clock::now() - pending->second.arrival).count();
+        std::lock_guard<std::mutex> lock(latency_mutex);
+        latency_last = latency;
+        latency_sum += latency;
+        latency_max = std::max(latency_max, latency);
+        latency_count++;
+    }
+    pending_frames.erase(pending_frames.begin(), pending_frames.upper_bound(frame_index));
+}
+
+std::unique_ptr<Reader> CreateReader(const char* path, HandleFrameCallback callback, const FlowProperties& properties)
+{
+    if(IsMotionCapture(path)) {
+        return CreateCaptureReader(path, callback);
+    }
+    return std::make_unique<MyReader>(path, callback, properties);
 }
\ No newline at end of file
@@ -4,6 +4,10 @@
 #include <functional>
 #include <opencv2/core.hpp>
 
+extern "C" {
+#include "FlowLib.h"
+}
+
 struct AVFrame;
 
 typedef std::function<void(AVFrame* frame, int frame_number)> HandleFrameCallback;
@@ -13,11 +17,18 @@ class Reader
 public:
     virtual ~Reader() = default;
     virtual void Start() = 0;
+    // Decodes [fromFrame, toFrame), returns false when it was interrupted by Stop()
+    virtual bool ReadRange(int fromFrame, int toFrame) = 0;
+    virtual void Stop() = 0;
 
     virtual int CurrentFrame() = 0;
     virtual int GetNumFrames() = 0;
     virtual int GetNumMs() = 0;
-    cv::Size GetVideoSize();
+    virtual cv::Size GetVideoSize() = 0;
+    virtual FlowStats GetStats() { return FlowStats(); }
+    // Source timestamp of the frame being handed to the callback
+    virtual int64_t CurrentPtsMs() { return 0; }
 };
 
-std::unique_ptr<Reader> CreateReader(const char* path, HandleFrameCallback callback);
\ No newline at end of file
+// Uses the reader settings of properties (fastOpen, readAheadMb, mappedIO)
+std::unique_ptr<Reader> CreateReader(const char* path, HandleFrameCallback callback, const FlowProperties& properties);
\ No newline at end of file
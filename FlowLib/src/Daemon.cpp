@@ -0,0 +1,321 @@
+#include "Daemon.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// -- Messages --
+
+static bool WriteAll(int fd, const void* data, size_t size)
+{
+    const char* p = (const char*)data;
+    while(size > 0) {
+        ssize_t written = send(fd, p, size, MSG_NOSIGNAL);
+        if(written <= 0) {
+            return false;
+        }
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool ReadAll(int fd, void* data, size_t size)
+{
+    char* p = (char*)data;
+    while(size > 0) {
+        ssize_t got = recv(fd, p, size, 0);
+        if(got <= 0) {
+            return false;
+        }
+        p += got;
+        size -= got;
+    }
+    return true;
+}
+
+// Header and payload parts in one call, rows are sent straight from their buffer
+static bool WriteMessage(int fd, uint8_t type, std::initializer_list<std::pair<const void*, size_t>> parts)
+{
+    uint32_t length = 1;
+    for(auto& part : parts) {
+        length += (uint32_t)part.second;
+    }
+
+    char header[5];
+    memcpy(header, &length, 4);
+    header[4] = (char)type;
+    if(!WriteAll(fd, header, sizeof(header))) {
+        return false;
+    }
+    for(auto& part : parts) {
+        if(!WriteAll(fd, part.first, part.second)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ReadMessage(int fd, uint8_t& type, std::vector<char>& payload)
+{
+    uint32_t length;
+    if(!ReadAll(fd, &length, 4) || length == 0) {
+        return false;
+    }
+    if(!ReadAll(fd, &type, 1)) {
+        return false;
+    }
+    payload.resize(length - 1);
+    return ReadAll(fd, payload.data(), payload.size());
+}
+
+static sockaddr_un SocketAddress(const char* socketPath)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+    return address;
+}
+
+// -- Daemon --
+
+struct Job {
+    int fd;
+    bool connected = true; // False once the client is gone or was sent an error
+    FrameNumber sentFrame = 0;
+    std::vector<char> rows;
+};
+
+// FlowRunCallback carries no user data, jobs are found by their handle
+static std::mutex jobsMutex;
+static std::map<FlowHandle, Job*> jobs;
+
+static std::mutex slotMutex;
+static std::condition_variable slotCondition;
+static int freeSlots = 0;
+
+static void SendError(int fd, const char* error)
+{
+    WriteMessage(fd, FlowMessageError, { { error, strlen(error) } });
+}
+
+// Sends the rows that became final since the last call, in order
+// A failed read ends the job for the client with FlowMessageError, no messages follow
+static void SendRows(FlowHandle handle, Job* job)
+{
+    FrameNumber numFrames = FlowGetLength(handle);
+    FrameNumber to = job->sentFrame;
+    std::vector<unsigned char> states(1024);
+    while(to < numFrames) {
+        FrameNumber blockEnd = std::min<FrameNumber>(to + states.size(), numFrames);
+        if(!FlowGetRowState(handle, FrameRange{ to, blockEnd }, states.data())) {
+            SendError(job->fd, FlowLastError());
+            job->connected = false;
+            return;
+        }
+
+        FrameNumber blockFrom = to;
+        while(to < blockEnd && states[to - blockFrom] >= FlowRowExact) {
+            to++;
+        }
+        if(to < blockEnd) {
+            break;
+        }
+    }
+    if(to == job->sentFrame) {
+        return;
+    }
+
+    FrameRange range = { job->sentFrame, to };
+    job->rows.resize((size_t)FlowGetOutputRowSize(handle, 0) * (to - job->sentFrame));
+    if(!FlowGetOutputData(handle, 0, range, job->rows.data())) {
+        SendError(job->fd, FlowLastError());
+        job->connected = false;
+        return;
+    }
+    job->sentFrame = to;
+
+    uint64_t from64 = range.fromFrame, to64 = range.toFrame;
+    job->connected = WriteMessage(job->fd, FlowMessageRows, {
+        { &from64, 8 }, { &to64, 8 }, { job->rows.data(), job->rows.size() }
+    });
+}
+
+static void RunCallback(FlowHandle handle, int frame_number)
+{
+    Job* job;
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        job = jobs[handle];
+    }
+
+    // FlowRun can't be stopped, a gone client only stops the messages
+    if(!job->connected) {
+        return;
+    }
+
+    uint64_t frame = frame_number;
+    job->connected = WriteMessage(job->fd, FlowMessageProgress, { { &frame, 8 } });
+    if(job->connected) {
+        SendRows(handle, job);
+    }
+}
+
+static void ServeJob(int fd, FlowProperties properties)
+{
+    uint8_t type;
+    std::vector<char> payload;
+    if(!ReadMessage(fd, type, payload) || type != FlowMessageJob || payload.size() < 4) {
+        SendError(fd, "Expected a job");
+        close(fd);
+        return;
+    }
+
+    uint32_t callbackInterval;
+    memcpy(&callbackInterval, payload.data(), 4);
+    std::string path(payload.begin() + 4, payload.end());
+
+    {
+        std::unique_lock<std::mutex> lock(slotMutex);
+        slotCondition.wait(lock, []() { return freeSlots > 0; });
+        freeSlots--;
+    }
+
+    FlowHandle handle = FlowCreateHandle(path.c_str(), &properties);
+    if(handle == nullptr) {
+        SendError(fd, FlowLastError());
+    } else {
+        Job job;
+        job.fd = fd;
+
+        uint64_t numFrames = FlowGetLength(handle);
+        uint64_t lengthMs = FlowGetLengthMs(handle);
+        uint32_t rowSize = FlowGetOutputRowSize(handle, 0);
+        job.connected = WriteMessage(fd, FlowMessageInfo, { { &numFrames, 8 }, { &lengthMs, 8 }, { &rowSize, 4 } });
+
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            jobs[handle] = &job;
+        }
+
+        bool success = FlowRun(handle, RunCallback, callbackInterval > 0 ? (int)callbackInterval : 120);
+
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            jobs.erase(handle);
+        }
+
+        if(!success) {
+            SendError(fd, FlowLastError());
+        } else if(job.connected) {
+            SendRows(handle, &job);
+            if(job.connected && job.sentFrame < FlowGetLength(handle)) {
+                SendError(fd, "Rows missing after the run");
+            } else if(job.connected) {
+                WriteMessage(fd, FlowMessageDone, {});
+            }
+        }
+        FlowDestroyHandle(handle);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(slotMutex);
+        freeSlots++;
+    }
+    slotCondition.notify_one();
+    close(fd);
+}
+
+int RunDaemon(const char* socketPath, int maxJobs, const FlowProperties& properties)
+{
+    freeSlots = std::max(maxJobs, 1);
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = SocketAddress(socketPath);
+    unlink(socketPath);
+    if(listenFd < 0 || bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+        perror("Daemon socket");
+        return 1;
+    }
+
+    std::cout << "Listening on " << socketPath << ", " << freeSlots << " jobs at a time" << std::endl;
+    while(true) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if(fd < 0) {
+            perror("Daemon accept");
+            continue;
+        }
+        std::thread(ServeJob, fd, properties).detach();
+    }
+}
+
+// -- Client --
+
+int RunClient(const char* socketPath, const char* videoPath, const char* outputFile)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = SocketAddress(socketPath);
+    if(fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        perror("Client connect");
+        return 1;
+    }
+
+    uint32_t callbackInterval = 120;
+    if(!WriteMessage(fd, FlowMessageJob, { { &callbackInterval, 4 }, { videoPath, strlen(videoPath) } })) {
+        perror("Client send");
+        close(fd);
+        return 1;
+    }
+
+    FILE* output = fopen(outputFile, "wb");
+    if(!output) {
+        perror("Client output");
+        close(fd);
+        return 1;
+    }
+
+    int result = 1;
+    uint64_t numFrames = 0;
+    uint8_t type;
+    std::vector<char> payload;
+    while(ReadMessage(fd, type, payload)) {
+        if(type == FlowMessageInfo && payload.size() >= 20) {
+            uint64_t lengthMs;
+            uint32_t rowSize;
+            memcpy(&numFrames, payload.data(), 8);
+            memcpy(&lengthMs, payload.data() + 8, 8);
+            memcpy(&rowSize, payload.data() + 16, 4);
+            std::cout << "Length frames: " << numFrames << "\n";
+            std::cout << "Length ms: " << lengthMs << "\n";
+        } else if(type == FlowMessageProgress && payload.size() >= 8) {
+            uint64_t frame;
+            memcpy(&frame, payload.data(), 8);
+            std::cout << frame << " / " << numFrames << "\n";
+        } else if(type == FlowMessageRows && payload.size() >= 16) {
+            // Rows arrive in order, appending keeps them at their frame
+            fwrite(payload.data() + 16, 1, payload.size() - 16, output);
+        } else if(type == FlowMessageDone) {
+            result = 0;
+            break;
+        } else if(type == FlowMessageError) {
+            std::cout << "Error: " << std::string(payload.begin(), payload.end()) << "\n";
+            break;
+        }
+    }
+
+    fclose(output);
+    close(fd);
+    return result;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+extern "C" {
+#include "FlowLib.h"
+}
+
+// JTFlowUtil --daemon: jobs over a Unix domain socket, one job per connection
+// The library, the OpenCL kernel and the Python model stay loaded between jobs
+//
+// Every message is a uint32 length, then a uint8 type and length-1 bytes of payload, in host byte order
+// Client: FlowMessageJob (uint32 callbackInterval, video path)
+// Daemon: FlowMessageInfo (uint64 frames, uint64 ms, uint32 row size), FlowMessageProgress (uint64 frame)
+//         and FlowMessageRows (uint64 from, uint64 to, rows of output 0) until FlowMessageDone or FlowMessageError (text)
+
+enum FlowMessageType {
+    FlowMessageJob = 1,
+    FlowMessageInfo = 2,
+    FlowMessageProgress = 3,
+    FlowMessageRows = 4,
+    FlowMessageDone = 5,
+    FlowMessageError = 6
+};
+
+// Serves until the process is killed, at most maxJobs run at the same time
+int RunDaemon(const char* socketPath, int maxJobs, const FlowProperties& properties);
+// Submits one job, prints its progress and writes the rows to outputFile
+int RunClient(const char* socketPath, const char* videoPath, const char* outputFile);
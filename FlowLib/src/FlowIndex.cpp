@@ -0,0 +1,65 @@
+#include "FlowIndex.hpp"
+
+#include <stdexcept>
+
+void FlowPrefixIndex::Init(int bins)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(this->bins > 0) {
+        return;
+    }
+
+    this->bins = bins;
+}
+
+int64_t* FlowPrefixIndex::Row(FrameNumber f)
+{
+    size_t chunk = f / PREFIX_CHUNK_ROWS;
+    while(chunks.size() <= chunk) {
+        chunks.emplace_back((size_t)PREFIX_CHUNK_ROWS * bins, 0);
+    }
+    return &chunks[chunk][(f % PREFIX_CHUNK_ROWS) * bins];
+}
+
+void FlowPrefixIndex::Push(FrameNumber fromFrame, const cv::Mat& rows)
+{
+    CV_Assert(rows.type() == CV_32SC1 && rows.cols == bins);
+    std::lock_guard<std::mutex> lock(mutex);
+    if(fromFrame > numIndexed) {
+        throw std::runtime_error("Index rows pushed out of order");
+    }
+
+    for(int r=(int)(numIndexed - fromFrame); r<rows.rows; r++) {
+        const int* src = rows.ptr<int>(r);
+        const int64_t* before = Row(numIndexed);
+        int64_t* after = Row(numIndexed + 1);
+        for(int b=0; b<bins; b++) {
+            after[b] = before[b] + src[b];
+        }
+        numIndexed++;
+    }
+}
+
+FrameNumber FlowPrefixIndex::GetNumIndexed()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return numIndexed;
+}
+
+void FlowPrefixIndex::AddRangeSum(FrameRange range, long long* out)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(range.fromFrame > range.toFrame || range.toFrame > numIndexed) {
+        throw std::runtime_error("Range is not indexed");
+    }
+
+    if(range.fromFrame == range.toFrame) {
+        return;
+    }
+
+    const int64_t* from = Row(range.fromFrame);
+    const int64_t* to = Row(range.toFrame);
+    for(int b=0; b<bins; b++) {
+        out[b] += to[b] - from[b];
+    }
+}
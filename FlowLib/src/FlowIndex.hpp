@@ -0,0 +1,35 @@
+#pragma once
+
+extern "C" {
+#include "FlowLib.h"
+}
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Rows of prefix sums per allocation, about 6 MB at 180 bins
+#define PREFIX_CHUNK_ROWS 4096
+
+// Prefix sums (int64) per bin of angle rows, appended in frame order, for constant time range sums
+// Memory grows in chunks with the indexed rows instead of covering the whole video up front
+class FlowPrefixIndex {
+public:
+    void Init(int bins);
+    // Angle rows (CV_32S) from frame fromFrame on, rows that are already indexed are skipped
+    void Push(FrameNumber fromFrame, const cv::Mat& rows);
+    FrameNumber GetNumIndexed();
+    // Adds the sum of an indexed range to out (bins values)
+    void AddRangeSum(FrameRange range, long long* out);
+
+private:
+    // Row f holds the sum of the rows before frame f, its chunk is allocated on the first use
+    int64_t* Row(FrameNumber f);
+
+    std::mutex mutex;
+    int bins = 0;
+    FrameNumber numIndexed = 0;
+    std::vector<std::vector<int64_t>> chunks;
+};
@@ -4,6 +4,13 @@ typedef void* FlowHandle;
 typedef void(*DrawCallback)(void* data, int width, int height, void* userData);
 typedef void(*LoggingCallback)(int level, const char* message);
 typedef void(*FlowRunCallback)(FlowHandle handle, int frame_number);
+typedef enum FlowActionEvent {
+    FlowActionsProvisional = 0, // Detected while decoding, after the ones already reported
+    FlowActionsRetracted = 1, // Provisional actions a rescale of the rows changed, the ones after them follow again
+    FlowActionsFinal = 2 // The batch result of the whole video, replaces every provisional action
+} FlowActionEvent;
+// Actions as frame, position pairs, event is a FlowActionEvent
+typedef void(*ActionCallback)(FlowHandle handle, void* actions, int numActions, int event, void* userData);
 
 typedef unsigned long FrameNumber;
 typedef struct FrameRange {
@@ -11,6 +18,56 @@ typedef struct FrameRange {
     FrameNumber toFrame;
 } FrameRange;
 
+typedef enum FlowRowState {
+    FlowRowMissing = 0,
+    FlowRowApproximate = 1, // Copied from the nearest computed window by the preview passes
+    FlowRowExact = 2,
+    FlowRowSkipped = 3 // The reader could not deliver the frame, the row is zero; rows from FlowRowExact on are final
+} FlowRowState;
+
+typedef enum FlowOutputMode {
+    FlowOutputAngles = 0, // int32 count per angle bin
+    FlowOutputAngleMagnitude = 1, // uint16 count per angle bin and magnitude bin, read with FlowGetThresholdData
+    FlowOutputSpatialGrid = 2 // int32 2D prefix sums of the angle counts per grid cell, read with FlowGetRegionData
+} FlowOutputMode;
+
+// Magnitude bins are [0, 1), [1, 2), [2, 4) ... [64, inf) in the units of the backend, quarter pixels for the ffmpeg one whatever the motionEncoder
+#define FLOW_MAGNITUDE_BINS 8
+
+typedef enum FlowLevelFormat {
+    FlowLevelGray = 0, // uint8 per angle bin, truncated at 1% of a 720p frame
+    FlowLevelRGB = 1 // Colorized like the browser extension, the first half of the bins against the second
+} FlowLevelFormat;
+
+typedef enum FlowRenditionPolicy {
+    FlowRenditionHighest = 0, // The program with the highest bitrate
+    FlowRenditionAtLeast = 1, // The lowest rendition at least renditionHeight high, otherwise the highest
+    FlowRenditionMaxHeight = 2 // The highest rendition at most renditionHeight high, otherwise the lowest
+} FlowRenditionPolicy;
+
+// Reconstruction the lav decoders may skip, where the codec supports it
+typedef enum FlowFastDecode {
+    FlowFastSkipLoopFilter = 1,
+    FlowFastSkipIdct = 2,
+    FlowFastFlags = 4, // AV_CODEC_FLAG2_FAST
+    FlowFastLowres = 8 // Half resolution
+} FlowFastDecode;
+
+// The intermediate encoder of the lav implementation, its motion estimation produces the vectors
+typedef enum FlowMotionEncoder {
+    FlowEncoderX264 = 0,
+    FlowEncoderMpeg4 = 1, // libavcodec's own encoders, cheaper searches with 16x16 and 8x8 blocks
+    FlowEncoderMpeg2 = 2
+} FlowMotionEncoder;
+
+// Search of the mpeg encoders
+typedef enum FlowMotionSearch {
+    FlowSearchDefault = 0,
+    FlowSearchZero = 1, // No search, only for measuring the cost of the rest
+    FlowSearchEpzs = 2,
+    FlowSearchXone = 3
+} FlowMotionSearch;
+
 typedef struct FlowProperties {
     int numberOfPools;
     float maxValue;
@@ -18,8 +75,42 @@ typedef struct FlowProperties {
     float focusPoint;
     float focusSize;
     float waveSmoothing1;
+    bool computeOnRead; // FlowGetData computes missing rows before returning
+    int previewWindowMs; // Preview passes sample windows of this length first, 0 disables
+    int previewIntervalMs; // Spacing between the windows of the first preview pass
+    float magnitudeThreshold; // Shorter vectors are not binned, 0 uses the backend default
+    float roiX; // Region of interest as fractions of the frame, a zero size covers the whole frame
+    float roiY;
+    float roiWidth;
+    float roiHeight;
+    int outputMode; // FlowOutputMode
+    int gridSize; // Cells per side of a FlowOutputSpatialGrid output over the ROI, 0 uses 4
+    bool pythonModel; // FlowCalcWave runs Model/jtmodel.py instead of the native port, needs a FLOW_PYTHON_MODEL build
+    bool prefixIndex; // Keep int64 prefix sums of the angle rows of output 0 for FlowGetRangeSum, 8 bytes per bin and frame
+    bool fastOpen; // Bounded probing of the source, stream parameters are cached per source for the next open
+    int readAheadMb; // Network sources are fetched ahead of the decoder into a buffer of this size over parallel range requests, 0 reads them synchronously
+    bool mappedIO; // Local files are memory mapped and read ahead by the kernel instead of going through the file protocol
+    int renditionPolicy; // FlowRenditionPolicy for sources with several programs (HLS variants), bin counts scale with the picked resolution
+    int renditionHeight; // Target height in pixels of the rendition policy
+    int fastDecode1; // FlowFastDecode flags of the source decoder, changes the pixels the vectors are estimated from, measure with FlowLibUtil --fast-decode-diff
+    int fastDecode3; // FlowFastDecode flags of the vector decoder, the exported vectors don't depend on its reconstruction
+    bool packetIndex; // Index the packets of local files before decoding for exact frame counts and seeks, cached as <video>.jtidx
+    float duplicateThreshold; // Mean absolute luma difference of every 16x16 block under which a frame repeats the previous one, it skips the encoder and gets a zero row, 0 disables
+    int liveWindow; // Live mode when > 0: the source is read as it grows, only the last liveWindow rows are kept and ranges use absolute frame numbers, see FlowGetLiveRange
+    int intraDecoders; // Decoder contexts for intra-only sources (MJPEG, ProRes, DNxHD), 0 is one per core, 1 decodes serially
+    int motionEncoder; // FlowMotionEncoder, compare one against x264 with FlowLibUtil --encoder-diff
+    int motionSearch; // FlowMotionSearch of the mpeg encoders
+    int motionRange; // Search range in pixels of the mpeg encoders, 0 keeps the encoder default
 } FlowProperties;
 
+typedef struct FlowStats {
+    long long framesDecoded; // Source frames passed on for the rows
+    long long framesDuplicate; // Of those, repeats of the previous frame that skipped the encoder
+    double latencyLastMs; // From reading the packet of a frame to its row being available
+    double latencyMeanMs;
+    double latencyMaxMs;
+} FlowStats;
+
 #ifdef _WIN32
 #ifdef FLOWLIB_IMPORT
 #define FLOWLIB_API __declspec(dllimport)
@@ -31,14 +122,51 @@ typedef struct FlowProperties {
 #endif
 
 FLOWLIB_API FlowHandle FlowCreateHandle(const char* videoPath, FlowProperties* properties);
+// One output per property set, all computed from the same decode
+FLOWLIB_API FlowHandle FlowCreateHandleMulti(const char* videoPath, FlowProperties* properties, int numProperties);
 FLOWLIB_API bool FlowDestroyHandle(FlowHandle handle);
 FLOWLIB_API bool FlowSetLogger(LoggingCallback callback);
 FLOWLIB_API bool FlowRun(FlowHandle handle, FlowRunCallback callback, int callbackInterval);
+// FlowRun that also detects actions over the completed rows while decoding, not for liveWindow handles
+FLOWLIB_API bool FlowRunActions(FlowHandle handle, FlowRunCallback callback, int callbackInterval, ActionCallback actionCallback, void* userData);
+FLOWLIB_API bool FlowRequestRange(FlowHandle handle, FrameRange range, int priority);
+// Writes the raw motion vectors of every decoded frame to path, call before FlowRun, NULL closes the file
+// A capture opens like a video and replays the vectors without decoding
+FLOWLIB_API bool FlowSetCapture(FlowHandle handle, const char* path);
+// Counters of the reader so far
+FLOWLIB_API bool FlowGetStats(FlowHandle handle, FlowStats* stats);
+// Rows that can be read, the rolling window in live mode and [0, length) otherwise
+FLOWLIB_API bool FlowGetLiveRange(FlowHandle handle, FrameRange* range);
+// Source timestamp in ms of every frame in range, live rows are stamped as they arrive
+FLOWLIB_API bool FlowGetFramePts(FlowHandle handle, FrameRange range, long long* ptsMs);
 
 FLOWLIB_API FrameNumber FlowGetLength(FlowHandle handle);
 FLOWLIB_API FrameNumber FlowGetLengthMs(FlowHandle handle);
 FLOWLIB_API bool FlowGetData(FlowHandle handle, FrameRange range, void* buffer);
+FLOWLIB_API int FlowGetNumOutputs(FlowHandle handle);
+FLOWLIB_API int FlowGetOutputBins(FlowHandle handle, int output);
+FLOWLIB_API int FlowGetOutputRowSize(FlowHandle handle, int output);
+FLOWLIB_API bool FlowGetOutputData(FlowHandle handle, int output, FrameRange range, void* buffer);
+// Angle rows of a FlowOutputAngleMagnitude output, the threshold snaps up to the next magnitude bin edge
+FLOWLIB_API bool FlowGetThresholdData(FlowHandle handle, int output, FrameRange range, float threshold, bool weighted, void* buffer);
+// Angle rows of the cells [cellX0, cellX1) x [cellY0, cellY1) of a FlowOutputSpatialGrid output
+FLOWLIB_API bool FlowGetRegionData(FlowHandle handle, int output, FrameRange range, int cellX0, int cellY0, int cellX1, int cellY1, void* buffer);
+FLOWLIB_API bool FlowGetRowState(FlowHandle handle, FrameRange range, unsigned char* states);
+// Temporal pyramid of output 0 for previews, level n has one row per 2^n frames and the range is in rows of that level
+// Kept from the first FlowGetLevel on, about 2 bytes per bin and frame
+// FlowLevelGray rows are bins bytes, FlowLevelRGB rows bins / 2 RGB pixels; rows that aren't exact yet come from the current data
+FLOWLIB_API int FlowGetNumLevels(FlowHandle handle);
+FLOWLIB_API FrameNumber FlowGetLevelLength(FlowHandle handle, int level);
+FLOWLIB_API bool FlowGetLevel(FlowHandle handle, int level, FrameRange range, int format, void* buffer);
+// Sum of the angle rows of output 0 over a range, bins values; constant time over the final rows with prefixIndex
+FLOWLIB_API bool FlowGetRangeSum(FlowHandle handle, FrameRange range, long long* out);
+// Same for numRanges ranges, out holds numRanges rows of bins values
+FLOWLIB_API bool FlowGetRangeSums(FlowHandle handle, const FrameRange* ranges, int numRanges, long long* out);
 FLOWLIB_API bool FlowCalcWave(FlowHandle handle, FrameRange range, DrawCallback callback, void* userData);
+// The native wave port on numRows rows of bins angle values, without a handle, for comparing it with Model/jtmodel.py
+FLOWLIB_API bool FlowProcessWave(const int* rows, int numRows, int bins, DrawCallback callback, void* userData);
+// Reload Model/jtmodel.py before every pythonModel call
+FLOWLIB_API bool FlowSetModelReload(bool reload);
 FLOWLIB_API float FlowProgress(FlowHandle handle);
 FLOWLIB_API bool FlowSave(FlowHandle handle, const char* path);
 FLOWLIB_API char* FlowLastError();
@@ -1,53 +1,138 @@
 // #include <opencv2/core/utils/logger.hpp>
 #include "FlowLibShared.hpp"
+#include "FlowQuery.hpp"
+#include "WaveModel.hpp"
+#include "PythonModel.hpp"
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <stdexcept>
 #include <string>
+#include <vector>
 #include <chrono>
-#include <Python.h>
-#include "numpy/arrayobject.h"
+#include <cmath>
 
 LoggingCallback logger = nullptr;
-std::string lastError;
+// Per thread, a host may run jobs on several threads at once
+thread_local std::string lastError;
 
-int loadarr()
+// Standard angle rows of output 0, whatever its mode
+static void GetAngleMat(FlowLibShared* handle, FrameRange range, cv::Mat& mat)
 {
-   if(PyArray_API == NULL) {
-       import_array1(-1);
+    BinConfig config = handle->GetBinConfig(0);
+    if(config.mode == FlowOutputAngles) {
+        handle->GetMat(range, mat, 0);
+        return;
+    }
+
+    cv::Mat hist;
+    handle->GetMat(range, hist, 0);
+    if(config.mode == FlowOutputSpatialGrid) {
+        ReduceGridRegion(hist, config.bins, config.grid, cv::Rect(0, 0, config.grid, config.grid), mat);
+    } else {
+        ReduceAngleMagnitude(hist, config.bins, config.threshold, false, mat);
     }
-    return 0;
 }
 
-class ResourceHolder {
-public:
-    ResourceHolder() {
-        Py_Initialize();
-        loadarr();
+// End of the final rows from frame from on, skipped rows count as the zero rows they are
+static FrameNumber FinalRowsEnd(FlowLibShared* handle, FrameNumber from)
+{
+    FrameNumber numFrames = handle->GetNumFrames();
+    FrameNumber to = from;
+    std::vector<uint8_t> states(1024);
+    while(to < numFrames) {
+        FrameNumber blockEnd = std::min<FrameNumber>(to + states.size(), numFrames);
+        handle->GetRowState(FrameRange{ to, blockEnd }, states.data());
+
+        FrameNumber blockFrom = to;
+        while(to < blockEnd && states[to - blockFrom] >= FlowRowExact) {
+            to++;
+        }
+        if(to < blockEnd) {
+            break;
+        }
+    }
+    return to;
+}
 
-        PyRun_SimpleString("import sys");
-        PyObject *sys_path = PySys_GetObject("path");
-        PyList_Append(sys_path, PyUnicode_FromString("."));
-        PyList_Append(sys_path, PyUnicode_FromString("/usr/local/src/model"));
+// Adds the rows that became final since the last call to the pyramid and the prefix index
+// The pyramid is only kept once a level was asked for, the first FlowGetLevel catches it up from frame 0
+static void UpdateIndexes(FlowLibShared* handle)
+{
+    // Both cover the whole video, a live window has no fixed rows to index
+    if(handle->GetProperties().liveWindow > 0) {
+        return;
     }
 
-    ~ResourceHolder() {
-        Py_Finalize();
+    bool indexed = handle->GetProperties().prefixIndex;
+    bool pyramid = handle->pyramid.IsInitialized();
+    if(!indexed && !pyramid) {
+        return;
+    }
+    if(indexed) {
+        handle->prefixIndex.Init(handle->GetBinConfig(0).bins);
     }
-};
 
-ResourceHolder theHolder;
+    FrameNumber from = pyramid ? handle->pyramid.GetNumPushed() : handle->prefixIndex.GetNumIndexed();
+    if(pyramid && indexed) {
+        from = std::min(from, handle->prefixIndex.GetNumIndexed());
+    }
+    FrameNumber to = FinalRowsEnd(handle, from);
+    if(to > from) {
+        cv::Mat rows;
+        GetAngleMat(handle, FrameRange{ from, to }, rows);
+        if(pyramid) {
+            handle->pyramid.Push(from, rows);
+        }
+        if(indexed) {
+            handle->prefixIndex.Push(from, rows);
+        }
+    }
+}
 
 char* FlowLastError()
 {
     return (char*)lastError.c_str();
 }
 
+BinConfig MakeBinConfig(const FlowProperties& properties, cv::Size gridSize, float defaultThreshold)
+{
+    BinConfig config;
+    config.mode = properties.outputMode;
+    config.bins = properties.numberOfPools > 0 ? properties.numberOfPools : 180;
+    config.grid = properties.gridSize > 0 ? properties.gridSize : 4;
+    config.threshold = properties.magnitudeThreshold > 0 ? properties.magnitudeThreshold : defaultThreshold;
+    config.roi = cv::Rect(cv::Point(0, 0), gridSize);
+
+    if(properties.roiWidth > 0 && properties.roiHeight > 0) {
+        cv::Rect roi(
+            properties.roiX * gridSize.width,
+            properties.roiY * gridSize.height,
+            std::ceil(properties.roiWidth * gridSize.width),
+            std::ceil(properties.roiHeight * gridSize.height)
+        );
+        config.roi &= roi;
+        // Outside the frame the bins would cover no blocks and the backends divide by the empty size
+        if(config.roi.empty()) {
+            throw std::runtime_error("The region of interest is outside the frame");
+        }
+    }
+
+    return config;
+}
+
 FlowHandle FlowCreateHandle(const char* videoPath, FlowProperties* config)
+{
+    return FlowCreateHandleMulti(videoPath, config, 1);
+}
+
+FlowHandle FlowCreateHandleMulti(const char* videoPath, FlowProperties* config, int numProperties)
 {
     try {
-        FlowLibShared* handle = CreateFlowLib(videoPath, config);
+        if(config == nullptr || numProperties < 1) {
+            throw std::runtime_error("No properties");
+        }
+        FlowLibShared* handle = CreateFlowLib(videoPath, config, numProperties);
         MY_LOG("[FlowLib] handle created");
         return (FlowHandle)handle;
     } catch (std::exception& e) {
@@ -102,11 +187,72 @@ FrameNumber FlowGetLengthMs(FlowHandle handlePtr)
 }
 
 bool FlowGetData(FlowHandle handlePtr, FrameRange range, void* buffer)
+{
+    return FlowGetOutputData(handlePtr, 0, range, buffer);
+}
+
+int FlowGetNumOutputs(FlowHandle handlePtr)
 {
     try {
+        if(handlePtr == nullptr) {
+            throw std::runtime_error("Invalid handle");
+        }
         FlowLibShared* handle = (FlowLibShared*)handlePtr;
-        cv::Mat bufferMat = cv::Mat(range.toFrame - range.fromFrame, 180, CV_32SC1, buffer);
-        return handle->GetMat(range, bufferMat);
+        return handle->GetNumOutputs();
+    } catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] get outputs failed: %s", e.what()).c_str());
+        return 0;
+    }
+}
+
+int FlowGetOutputBins(FlowHandle handlePtr, int output)
+{
+    try {
+        if(handlePtr == nullptr) {
+            throw std::runtime_error("Invalid handle");
+        }
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        if(output < 0 || output >= handle->GetNumOutputs()) {
+            throw std::runtime_error("Invalid output");
+        }
+        return handle->GetBinConfig(output).bins;
+    } catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] get output bins failed: %s", e.what()).c_str());
+        return 0;
+    }
+}
+
+int FlowGetOutputRowSize(FlowHandle handlePtr, int output)
+{
+    try {
+        if(handlePtr == nullptr) {
+            throw std::runtime_error("Invalid handle");
+        }
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        if(output < 0 || output >= handle->GetNumOutputs()) {
+            throw std::runtime_error("Invalid output");
+        }
+        BinConfig config = handle->GetBinConfig(output);
+        return config.Columns() * CV_ELEM_SIZE(config.MatType());
+    } catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] get output row size failed: %s", e.what()).c_str());
+        return 0;
+    }
+}
+
+bool FlowGetOutputData(FlowHandle handlePtr, int output, FrameRange range, void* buffer)
+{
+    try {
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        if(output < 0 || output >= handle->GetNumOutputs()) {
+            throw std::runtime_error("Invalid output");
+        }
+        BinConfig config = handle->GetBinConfig(output);
+        cv::Mat bufferMat = cv::Mat(range.toFrame - range.fromFrame, config.Columns(), config.MatType(), buffer);
+        return handle->GetMat(range, bufferMat, output);
     }
     catch (std::exception& e) {
         lastError = e.what();
@@ -117,82 +263,289 @@ bool FlowGetData(FlowHandle handlePtr, FrameRange range, void* buffer)
     return true;
 }
 
-bool FlowCalcWave(FlowHandle handlePtr, FrameRange range, DrawCallback callback, void* userData)
+bool FlowGetRegionData(FlowHandle handlePtr, int output, FrameRange range, int cellX0, int cellY0, int cellX1, int cellY1, void* buffer)
+{
+    try {
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        if(output < 0 || output >= handle->GetNumOutputs()) {
+            throw std::runtime_error("Invalid output");
+        }
+        BinConfig config = handle->GetBinConfig(output);
+        if(config.mode != FlowOutputSpatialGrid) {
+            throw std::runtime_error("Output has no spatial grid");
+        }
+
+        cv::Rect cells(cv::Point(cellX0, cellY0), cv::Point(cellX1, cellY1));
+        if(cells.empty() || (cells & cv::Rect(0, 0, config.grid, config.grid)) != cells) {
+            throw std::runtime_error("Invalid cell region");
+        }
+
+        cv::Mat prefix;
+        if(!handle->GetMat(range, prefix, output)) {
+            return false;
+        }
+
+        cv::Mat bufferMat = cv::Mat(range.toFrame - range.fromFrame, config.bins, CV_32SC1, buffer);
+        ReduceGridRegion(prefix, config.bins, config.grid, cells, bufferMat);
+        return true;
+    }
+    catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] region data failed: %s", e.what()).c_str());
+        return false;
+    }
+}
+
+bool FlowGetThresholdData(FlowHandle handlePtr, int output, FrameRange range, float threshold, bool weighted, void* buffer)
 {
-    PyObject* m_PyModule = NULL;
-    PyObject* processFunc = NULL;
-    PyObject* pyMat = NULL;
-    PyObject* result = NULL;
-    PyObject* resultArr = NULL;
-    bool ret = true;
+    try {
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        if(output < 0 || output >= handle->GetNumOutputs()) {
+            throw std::runtime_error("Invalid output");
+        }
+        BinConfig config = handle->GetBinConfig(output);
+        if(config.mode != FlowOutputAngleMagnitude) {
+            throw std::runtime_error("Output has no magnitude bins");
+        }
+
+        cv::Mat hist;
+        if(!handle->GetMat(range, hist, output)) {
+            return false;
+        }
 
+        cv::Mat bufferMat = cv::Mat(range.toFrame - range.fromFrame, config.bins, CV_32SC1, buffer);
+        ReduceAngleMagnitude(hist, config.bins, threshold, weighted, bufferMat);
+        return true;
+    }
+    catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] threshold data failed: %s", e.what()).c_str());
+        return false;
+    }
+}
+
+bool FlowGetRowState(FlowHandle handlePtr, FrameRange range, unsigned char* states)
+{
     try {
+        if(handlePtr == nullptr) {
+            throw std::runtime_error("Invalid handle");
+        }
         FlowLibShared* handle = (FlowLibShared*)handlePtr;
-        cv::Mat mat;
-        handle->GetMat(FrameRange{ range.fromFrame, range.toFrame }, mat);
+        return handle->GetRowState(range, states);
+    }
+    catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] get row state failed: %s", e.what()).c_str());
+        return false;
+    }
+}
 
-        if(range.fromFrame < 0 || range.toFrame > mat.rows) {
-            throw std::runtime_error("Invalid range");
+int FlowGetNumLevels(FlowHandle handlePtr)
+{
+    try {
+        if(handlePtr == nullptr) {
+            throw std::runtime_error("Invalid handle");
         }
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        return FlowPyramid::GetNumLevels(handle->GetNumFrames());
+    }
+    catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] get num levels failed: %s", e.what()).c_str());
+        return 0;
+    }
+}
 
-        PyRun_SimpleString("import sys");
-        PyObject *sys_path = PySys_GetObject("path");
-        PyList_Append(sys_path, PyUnicode_FromString("."));
-        PyList_Append(sys_path, PyUnicode_FromString("/usr/local/src/model"));
-        
-        m_PyModule = PyImport_ImportModule("jtmodel"); 
+FrameNumber FlowGetLevelLength(FlowHandle handlePtr, int level)
+{
+    try {
+        if(handlePtr == nullptr) {
+            throw std::runtime_error("Invalid handle");
+        }
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        return FlowPyramid::GetLevelLength(handle->GetNumFrames(), level);
+    }
+    catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] get level length failed: %s", e.what()).c_str());
+        return 0;
+    }
+}
 
-        if(!m_PyModule) {
-            PyErr_Print();
-            throw std::runtime_error("Failed to load jtmodel.py");
+bool FlowGetLevel(FlowHandle handlePtr, int level, FrameRange range, int format, void* buffer)
+{
+    try {
+        if(handlePtr == nullptr) {
+            throw std::runtime_error("Invalid handle");
         }
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        handle->pyramid.Init(handle->GetNumFrames(), handle->GetBinConfig(0).bins);
+        UpdateIndexes(handle);
 
-        PyObject* processFunc = PyObject_GetAttrString(m_PyModule, "process");
-        if (!PyCallable_Check(processFunc)) {
-            PyErr_Print();
-            throw std::runtime_error("Cannot find function 'process'");
+        FlowPyramid& pyramid = handle->pyramid;
+        if(range.fromFrame > range.toFrame || range.toFrame > pyramid.GetLevelLength(level)) {
+            throw std::runtime_error("Invalid range");
+        }
+        if(format != FlowLevelGray && format != FlowLevelRGB) {
+            throw std::runtime_error("Invalid format");
+        }
+        if(range.fromFrame == range.toFrame) {
+            return true;
+        }
+
+        int bins = handle->GetBinConfig(0).bins;
+        cv::Mat gray(range.toFrame - range.fromFrame, bins, CV_8UC1);
+        FrameNumber split = std::min(std::max(pyramid.GetNumFinished(level), range.fromFrame), range.toFrame);
+        if(split > range.fromFrame) {
+            cv::Mat finished;
+            pyramid.GetRows(level, FrameRange{ range.fromFrame, split }, finished);
+            finished.copyTo(gray.rowRange(0, split - range.fromFrame));
         }
-        
-        npy_intp mdim[] = { mat.rows, mat.cols };
 
-        PyObject* pyMat = PyArray_SimpleNewFromData(2, mdim, NPY_INT32, mat.ptr<int>(0));
-        PyObject* result = PyObject_CallFunctionObjArgs(processFunc, pyMat, NULL);
+        // The rest is built the same way from the current rows, it may still change
+        if(split < range.toFrame) {
+            FrameNumber scale = (FrameNumber)1 << level;
+            FrameRange source = { split * scale, std::min(range.toFrame * scale, handle->GetNumFrames()) };
+
+            cv::Mat rows;
+            GetAngleMat(handle, source, rows);
+            cv::Mat current = PyramidNormalize(rows);
+            for(int l=0; l<level; l++) {
+                current = PyramidHalve(current);
+            }
+            current.copyTo(gray.rowRange(split - range.fromFrame, gray.rows));
+        }
 
-        if (result == NULL) {
-            PyErr_Print();
-            throw std::runtime_error("Call failed");
+        if(format == FlowLevelRGB) {
+            PyramidColorize(gray).copyTo(cv::Mat(gray.rows, bins / 2, CV_8UC3, buffer));
+        } else {
+            gray.copyTo(cv::Mat(gray.rows, bins, CV_8UC1, buffer));
         }
+        return true;
+    }
+    catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] get level failed: %s", e.what()).c_str());
+        return false;
+    }
+}
 
-        PyArrayObject *resultArr = reinterpret_cast<PyArrayObject*>(result);
+bool FlowGetRangeSums(FlowHandle handlePtr, const FrameRange* ranges, int numRanges, long long* out)
+{
+    try {
+        if(handlePtr == nullptr) {
+            throw std::runtime_error("Invalid handle");
+        }
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        FrameNumber numFrames = handle->GetNumFrames();
+        int bins = handle->GetBinConfig(0).bins;
+
+        // Rows past the index, or all of them without prefixIndex, are summed directly
+        FrameNumber numIndexed = 0;
+        if(handle->GetProperties().prefixIndex) {
+            UpdateIndexes(handle);
+            numIndexed = handle->prefixIndex.GetNumIndexed();
+        }
 
-        if(PyArray_TYPE(resultArr) != NPY_INT32) {
-            throw std::runtime_error("Invalid result type");
+        std::fill(out, out + (size_t)numRanges * bins, 0LL);
+        for(int i=0; i<numRanges; i++) {
+            FrameRange range = ranges[i];
+            if(range.fromFrame > range.toFrame || range.toFrame > numFrames) {
+                throw std::runtime_error("Invalid range");
+            }
+            long long* sum = out + (size_t)i * bins;
+
+            FrameNumber split = std::min(std::max(numIndexed, range.fromFrame), range.toFrame);
+            if(split > range.fromFrame) {
+                handle->prefixIndex.AddRangeSum(FrameRange{ range.fromFrame, split }, sum);
+            }
+            if(split < range.toFrame) {
+                cv::Mat rows, total;
+                GetAngleMat(handle, FrameRange{ split, range.toFrame }, rows);
+                cv::reduce(rows, total, 0, cv::REDUCE_SUM, CV_64F);
+                for(int b=0; b<bins; b++) {
+                    sum[b] += (long long)total.at<double>(0, b);
+                }
+            }
         }
+        return true;
+    }
+    catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] get range sums failed: %s", e.what()).c_str());
+        return false;
+    }
+}
 
-        int nDims = PyArray_NDIM(resultArr);
-        npy_intp* dims = PyArray_SHAPE(resultArr);
+bool FlowGetRangeSum(FlowHandle handlePtr, FrameRange range, long long* out)
+{
+    return FlowGetRangeSums(handlePtr, &range, 1, out);
+}
+
+bool FlowCalcWave(FlowHandle handlePtr, FrameRange range, DrawCallback callback, void* userData)
+{
+    try {
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        cv::Mat mat;
+        GetAngleMat(handle, FrameRange{ range.fromFrame, range.toFrame }, mat);
 
-        if(nDims != 2 || dims[1] != 2) {
-            throw std::runtime_error("Invalid result dimensions");
+        if(range.fromFrame < 0 || range.toFrame > mat.rows) {
+            throw std::runtime_error("Invalid range");
         }
 
-        int* data = (int*)PyArray_DATA(resultArr);
-        callback(data, dims[0], dims[1], userData);
+        if(handle->GetProperties().pythonModel) {
+#ifdef FLOW_PYTHON_MODEL
+            cv::Mat actions = PythonModel::Get().Process(mat);
+            callback(actions.ptr<int>(0), actions.rows, actions.cols, userData);
+            printf("Python model call success\n");
+            return true;
+#else
+            throw std::runtime_error("Built without the Python model");
+#endif
+        }
 
-        printf("Python model call success\n");
+        cv::Mat actions = WaveProcess(mat);
+        callback(actions.ptr<int>(0), actions.rows, actions.cols, userData);
+        return true;
     } catch (std::exception& e) {
         MY_LOG(cv::format("[FlowLib] calc wave failed: %s", e.what()).c_str());
         lastError = e.what();
-        ret = false;
+        return false;
     }
-    
-    if(m_PyModule != NULL) Py_DECREF(m_PyModule);
-    if(processFunc != NULL) Py_DECREF(processFunc);
-    if(pyMat != NULL) Py_DECREF(pyMat);
-    if(result != NULL) Py_DECREF(result);
-    if(resultArr != NULL) Py_DECREF(resultArr);
-    
-    return ret;
+}
+
+bool FlowProcessWave(const int* rows, int numRows, int bins, DrawCallback callback, void* userData)
+{
+    try {
+        if(numRows < 0 || bins <= 0) {
+            throw std::runtime_error("Invalid rows");
+        }
+        cv::Mat mat(numRows, bins, CV_32SC1, (void*)rows);
+        cv::Mat actions = WaveProcess(mat);
+        callback(actions.ptr<int>(0), actions.rows, actions.cols, userData);
+        return true;
+    } catch (std::exception& e) {
+        MY_LOG(cv::format("[FlowLib] process wave failed: %s", e.what()).c_str());
+        lastError = e.what();
+        return false;
+    }
+}
+
+bool FlowSetModelReload(bool reload)
+{
+#ifdef FLOW_PYTHON_MODEL
+    try {
+        PythonModel::Get().SetReload(reload);
+        return true;
+    } catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] model reload failed: %s", e.what()).c_str());
+        return false;
+    }
+#else
+    lastError = "Built without the Python model";
+    return false;
+#endif
 }
 
 bool FlowSetLogger(LoggingCallback callback)
@@ -204,83 +557,111 @@ bool FlowSetLogger(LoggingCallback callback)
 
 bool FlowSave(FlowHandle handlePtr, const char* path)
 {
-    PyObject* m_PyModule = NULL;
-    PyObject* processFunc = NULL;
-    PyObject* pyMat = NULL;
-    PyObject* result = NULL;
-    PyObject* resultArr = NULL;
-    bool ret = true;
-
     try {
         FlowLibShared* handle = (FlowLibShared*)handlePtr;
         cv::Mat oMat;
-        handle->GetMat(FrameRange{ 0, handle->GetNumFrames() }, oMat);
+        GetAngleMat(handle, FrameRange{ 0, handle->GetNumFrames() }, oMat);
         cv::imwrite(path, oMat);
         return true;
-        
-        cv::Mat mat = oMat.clone();
-        cv::Mat outputMat;
-        
-        m_PyModule = PyImport_ImportModule("jtmodel");
-        m_PyModule = PyImport_ReloadModule(m_PyModule);
+    } catch (std::exception& e) {
+        MY_LOG(cv::format("[FlowLib] save flow failed: %s", e.what()).c_str());
+        lastError = e.what();
+        return false;
+    } catch(...) {
+        MY_LOG("[FlowLib] save flow failed: unknown error");
+        lastError = "Unknown error";
+        return false;
+    }
+}
 
-        if(!m_PyModule) {
-            PyErr_Print();
-            throw std::runtime_error("Failed to load jtmodel.py");
+bool FlowRequestRange(FlowHandle handlePtr, FrameRange range, int priority)
+{
+    try {
+        if(handlePtr == nullptr) {
+            throw std::runtime_error("Invalid handle");
         }
-
-        PyObject* processFunc = PyObject_GetAttrString(m_PyModule, "normalize");
-        if (!PyCallable_Check(processFunc)) {
-            PyErr_Print();
-            throw std::runtime_error("Cannot find function 'normalize'");
+        if(range.toFrame <= range.fromFrame) {
+            throw std::runtime_error("Invalid range");
         }
-        
-        npy_intp mdim[] = { mat.rows, mat.cols };
-
-        PyObject* pyMat = PyArray_SimpleNewFromData(2, mdim, NPY_INT32, mat.ptr<int32_t>(0));
-        PyObject* result = PyObject_CallFunctionObjArgs(processFunc, pyMat, NULL);
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        return handle->RequestRange(range, priority);
+    } catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] request range failed: %s", e.what()).c_str());
+        return false;
+    }
+}
 
-        if (result == NULL) {
-            PyErr_Print();
-            throw std::runtime_error("Call failed");
+bool FlowSetCapture(FlowHandle handlePtr, const char* path)
+{
+    try {
+        if(handlePtr == nullptr) {
+            throw std::runtime_error("Invalid handle");
         }
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        handle->SetCapture(path);
+        return true;
+    } catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] set capture failed: %s", e.what()).c_str());
+        return false;
+    }
+}
 
-        PyArrayObject *resultArr = reinterpret_cast<PyArrayObject*>(result);
-
-        if(PyArray_TYPE(resultArr) != NPY_UINT8) {
-            throw std::runtime_error("Invalid result type");
+bool FlowGetStats(FlowHandle handlePtr, FlowStats* stats)
+{
+    try {
+        if(handlePtr == nullptr) {
+            throw std::runtime_error("Invalid handle");
         }
-
-        int nDims = PyArray_NDIM(resultArr);
-        npy_intp* dims = PyArray_SHAPE(resultArr);
-
-        outputMat = cv::Mat(dims[0], dims[1], CV_8UC1, PyArray_DATA(resultArr));
-        cv::imwrite(path, outputMat);
-
-        printf("Python model call success\n");
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        *stats = handle->GetStats();
+        return true;
     } catch (std::exception& e) {
-        MY_LOG(cv::format("[FlowLib] save flow failed: %s", e.what()).c_str());
         lastError = e.what();
-        ret = false;
-    } catch(...) {
-        MY_LOG("[FlowLib] save flow failed: unknown error");
-        lastError = "Unknown error";
-        ret = false;
+        MY_LOG(cv::format("[FlowLib] get stats failed: %s", e.what()).c_str());
+        return false;
     }
+}
 
-    if(m_PyModule != NULL) Py_DECREF(m_PyModule);
-    if(processFunc != NULL) Py_DECREF(processFunc);
-    if(pyMat != NULL) Py_DECREF(pyMat);
-    if(result != NULL) Py_DECREF(result);
-    if(resultArr != NULL) Py_DECREF(resultArr);
+bool FlowGetLiveRange(FlowHandle handlePtr, FrameRange* range)
+{
+    try {
+        if(handlePtr == nullptr) {
+            throw std::runtime_error("Invalid handle");
+        }
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        *range = handle->GetLiveRange();
+        return true;
+    } catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] get live range failed: %s", e.what()).c_str());
+        return false;
+    }
+}
 
-    return ret;
+bool FlowGetFramePts(FlowHandle handlePtr, FrameRange range, long long* ptsMs)
+{
+    try {
+        if(handlePtr == nullptr) {
+            throw std::runtime_error("Invalid handle");
+        }
+        if(range.fromFrame > range.toFrame) {
+            throw std::runtime_error("Invalid range");
+        }
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        return handle->GetFramePts(range, ptsMs);
+    } catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] get frame pts failed: %s", e.what()).c_str());
+        return false;
+    }
 }
 
 float FlowProgress(FlowHandle handlePtr)
 {
     FlowLibShared* handle = (FlowLibShared*)handlePtr;
-    return handle->CurrentFrame() / handle->GetNumFrames();
+    return (float)handle->CurrentFrame() / handle->GetNumFrames();
 }
 
 bool FlowRun(FlowHandle handlePtr, FlowRunCallback callback, int callbackInterval)
@@ -289,7 +670,13 @@ bool FlowRun(FlowHandle handlePtr, FlowRunCallback callback, int callbackInterva
         clock_t start = std::clock();
         
         FlowLibShared* handle = (FlowLibShared*)handlePtr;
-        handle->Run(callback, callbackInterval);
+        handle->Run([&](FlowLibShared* h, int frame_number) {
+            UpdateIndexes(handle);
+            if(callback) {
+                callback(h, frame_number);
+            }
+        }, callbackInterval);
+        UpdateIndexes(handle);
         
         clock_t end = std::clock();
         double elapsed_time = (double)(end - start) / CLOCKS_PER_SEC;
@@ -301,4 +688,55 @@ bool FlowRun(FlowHandle handlePtr, FlowRunCallback callback, int callbackInterva
         MY_LOG(cv::format("[FlowLib] run failed: %s", e.what()).c_str());
         return false;
     }
-}
\ No newline at end of file
+}
+bool FlowRunActions(FlowHandle handlePtr, FlowRunCallback callback, int callbackInterval, ActionCallback actionCallback, void* userData)
+{
+    try {
+        FlowLibShared* handle = (FlowLibShared*)handlePtr;
+        // The stream and the final batch pass both read the rows from frame 0, a live window has dropped them
+        if(handle->GetProperties().liveWindow > 0) {
+            throw std::runtime_error("FlowRunActions does not take a live handle, use FlowRun and FlowGetLiveRange");
+        }
+        FrameNumber numFrames = handle->GetNumFrames();
+        WaveStream stream;
+
+        // Feeds the rows that became final since the last call, in order
+        auto feed = [&]() {
+            FrameNumber from = stream.GetNumRows();
+            FrameNumber to = FinalRowsEnd(handle, from);
+            if(to == from) {
+                return;
+            }
+
+            cv::Mat rows;
+            GetAngleMat(handle, FrameRange{ from, to }, rows);
+            cv::Mat retracted;
+            cv::Mat actions = stream.Push(rows, retracted);
+            if(retracted.rows > 0) {
+                actionCallback(handlePtr, retracted.ptr<int>(0), retracted.rows, FlowActionsRetracted, userData);
+            }
+            if(actions.rows > 0) {
+                actionCallback(handlePtr, actions.ptr<int>(0), actions.rows, FlowActionsProvisional, userData);
+            }
+        };
+
+        handle->Run([&](FlowLibShared* h, int frame_number) {
+            UpdateIndexes(handle);
+            if(callback) {
+                callback(h, frame_number);
+            }
+            feed();
+        }, callbackInterval);
+        UpdateIndexes(handle);
+
+        cv::Mat mat;
+        GetAngleMat(handle, FrameRange{ 0, numFrames }, mat);
+        cv::Mat actions = WaveProcess(mat);
+        actionCallback(handlePtr, actions.ptr<int>(0), actions.rows, FlowActionsFinal, userData);
+        return true;
+    } catch (std::exception& e) {
+        lastError = e.what();
+        MY_LOG(cv::format("[FlowLib] run actions failed: %s", e.what()).c_str());
+        return false;
+    }
+}
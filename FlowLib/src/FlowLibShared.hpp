@@ -5,8 +5,13 @@ extern "C" {
 };
 
 #include <functional>
+#include <algorithm>
+#include <cmath>
 #include <opencv2/core.hpp>
 
+#include "FlowPyramid.hpp"
+#include "FlowIndex.hpp"
+
 namespace cv {
     class Mat;
 };
@@ -14,6 +19,44 @@ namespace cv {
 class FlowLibShared;
 typedef std::function<void(FlowLibShared* handle, int frame_number)> RunCallback;
 
+// Binning settings of one output
+struct BinConfig {
+    int mode;
+    int bins;
+    int grid;
+    float threshold;
+    cv::Rect roi; // In the coordinates of the vector grid
+
+    int Columns() const
+    {
+        if(mode == FlowOutputAngleMagnitude) {
+            return bins * FLOW_MAGNITUDE_BINS;
+        }
+        if(mode == FlowOutputSpatialGrid) {
+            return grid * grid * bins;
+        }
+        return bins;
+    }
+
+    int MatType() const
+    {
+        return mode == FlowOutputAngleMagnitude ? CV_16UC1 : CV_32SC1;
+    }
+};
+
+inline int MagnitudeBin(float magnitude)
+{
+    if(magnitude < 1.0f) {
+        return 0;
+    }
+
+    int exponent;
+    std::frexp(magnitude, &exponent);
+    return std::min(exponent, FLOW_MAGNITUDE_BINS - 1);
+}
+
+BinConfig MakeBinConfig(const FlowProperties& properties, cv::Size gridSize, float defaultThreshold);
+
 class FlowLibShared
 {
 public:
@@ -23,12 +66,38 @@ public:
     virtual FrameNumber GetNumFrames() = 0;
     virtual FrameNumber GetNumMs() = 0;
     virtual cv::Size GetVideoSize() = 0;
-    virtual bool GetMat(FrameRange range, cv::Mat& buffer) = 0;
+    virtual int GetNumOutputs() = 0;
+    virtual BinConfig GetBinConfig(int output) = 0;
+    // Properties of the first output
+    virtual FlowProperties GetProperties() = 0;
+    virtual bool GetMat(FrameRange range, cv::Mat& buffer, int output) = 0;
+    // One FlowRowState per row
+    virtual bool GetRowState(FrameRange range, uint8_t* states) = 0;
 
     virtual void Run(RunCallback callback, int callbackInterval) = 0;
+    // Moves a range to the front of the processing order, higher priorities go first
+    virtual bool RequestRange(FrameRange range, int priority) = 0;
+    virtual void SetCapture(const char* path) = 0;
+    // Backends without counters report zeros
+    virtual FlowStats GetStats() { return FlowStats(); }
+    // The readable rows, only a window of them in live mode
+    virtual FrameRange GetLiveRange() { return FrameRange{ 0, GetNumFrames() }; }
+    // Spread evenly over the duration unless the backend stamps its rows
+    virtual bool GetFramePts(FrameRange range, long long* ptsMs)
+    {
+        FrameNumber numFrames = std::max<FrameNumber>(GetNumFrames(), 1);
+        for(FrameNumber f=range.fromFrame; f<range.toFrame; f++) {
+            ptsMs[f - range.fromFrame] = (long long)f * GetNumMs() / numFrames;
+        }
+        return true;
+    }
+
+    // Preview tiles and, with prefixIndex, range sums of output 0, filled by the shared run functions
+    FlowPyramid pyramid;
+    FlowPrefixIndex prefixIndex;
 };
 
-FlowLibShared* CreateFlowLib(const char* videoPath, FlowProperties* properties);
+FlowLibShared* CreateFlowLib(const char* videoPath, FlowProperties* properties, int numProperties);
 
 extern LoggingCallback logger;
 // #define MY_LOG(message) if(logger) { logger(0, message); } else { CV_LOG_INFO(NULL, message); }
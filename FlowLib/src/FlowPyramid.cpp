@@ -0,0 +1,159 @@
+#include "FlowPyramid.hpp"
+
+#include <opencv2/imgproc.hpp>
+
+#include <stdexcept>
+
+// Same maximum as WaveNormalize
+#define PYRAMID_MAX_VALUE (1280 * 720 * 0.01f)
+
+cv::Mat PyramidNormalize(const cv::Mat& rows)
+{
+    cv::Mat values, out;
+    rows.convertTo(values, CV_32F);
+    cv::min(values, PYRAMID_MAX_VALUE, values);
+    values.convertTo(out, CV_8U, 255.0 / PYRAMID_MAX_VALUE);
+    return out;
+}
+
+cv::Mat PyramidHalve(const cv::Mat& rows)
+{
+    cv::Mat out((rows.rows + 1) / 2, rows.cols, CV_8UC1);
+    for(int r=0; r<out.rows; r++) {
+        const uchar* a = rows.ptr<uchar>(r * 2);
+        const uchar* b = r * 2 + 1 < rows.rows ? rows.ptr<uchar>(r * 2 + 1) : a;
+        uchar* o = out.ptr<uchar>(r);
+        for(int c=0; c<rows.cols; c++) {
+            o[c] = (uchar)((a[c] + b[c] + 1) >> 1);
+        }
+    }
+    return out;
+}
+
+cv::Mat PyramidColorize(const cv::Mat& gray)
+{
+    int half = gray.cols / 2;
+    cv::Mat top, bottom, middle, color;
+    gray.colRange(0, half).convertTo(top, CV_8U, 0.5);
+    gray.colRange(half, half * 2).convertTo(bottom, CV_8U, 0.5);
+
+    middle = cv::Mat(gray.rows, half, CV_8UC1, cv::Scalar(128));
+    cv::add(top, middle, middle);
+    cv::subtract(middle, bottom, middle);
+
+    cv::applyColorMap(middle, color, cv::COLORMAP_JET);
+    cv::cvtColor(color, color, cv::COLOR_BGR2RGB);
+    return color;
+}
+
+void FlowPyramid::Init(FrameNumber numFrames, int bins)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!levels.empty()) {
+        return;
+    }
+
+    this->numFrames = numFrames;
+    FrameNumber length = numFrames;
+    do {
+        levels.push_back(cv::Mat::zeros((int)length, bins, CV_8UC1));
+        finished.push_back(0);
+        length = (length + 1) / 2;
+    } while(levels.back().rows > 1);
+}
+
+int FlowPyramid::GetNumLevels()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int)levels.size();
+}
+
+FrameNumber FlowPyramid::GetLevelLength(int level)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(level < 0 || level >= (int)levels.size()) {
+        throw std::runtime_error("Invalid level");
+    }
+    return levels[level].rows;
+}
+
+int FlowPyramid::GetNumLevels(FrameNumber numFrames)
+{
+    int numLevels = 1;
+    for(FrameNumber length = numFrames; length > 1; length = (length + 1) / 2) {
+        numLevels++;
+    }
+    return numLevels;
+}
+
+FrameNumber FlowPyramid::GetLevelLength(FrameNumber numFrames, int level)
+{
+    if(level < 0 || level >= GetNumLevels(numFrames)) {
+        throw std::runtime_error("Invalid level");
+    }
+    FrameNumber length = numFrames;
+    for(int l=0; l<level; l++) {
+        length = (length + 1) / 2;
+    }
+    return length;
+}
+
+bool FlowPyramid::IsInitialized()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return !levels.empty();
+}
+
+FrameNumber FlowPyramid::GetNumPushed()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return finished.empty() ? 0 : finished[0];
+}
+
+FrameNumber FlowPyramid::GetNumFinished(int level)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(level < 0 || level >= (int)levels.size()) {
+        throw std::runtime_error("Invalid level");
+    }
+    return finished[level];
+}
+
+void FlowPyramid::Push(FrameNumber fromFrame, const cv::Mat& rows)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(levels.empty() || fromFrame > finished[0]) {
+        throw std::runtime_error("Pyramid rows pushed out of order");
+    }
+
+    FrameNumber skip = finished[0] - fromFrame;
+    if(skip >= (FrameNumber)rows.rows) {
+        return;
+    }
+
+    cv::Mat added = PyramidNormalize(rows.rowRange((int)skip, rows.rows));
+    added.copyTo(levels[0].rowRange((int)finished[0], (int)finished[0] + added.rows));
+    finished[0] += added.rows;
+
+    // A row is finished once both rows below it are, the last one once the level below is complete
+    for(size_t l=1; l<levels.size(); l++) {
+        FrameNumber below = finished[l - 1];
+        FrameNumber target = below == (FrameNumber)levels[l - 1].rows ? levels[l].rows : below / 2;
+        if(target <= finished[l]) {
+            break;
+        }
+
+        cv::Mat children = levels[l - 1].rowRange((int)finished[l] * 2, (int)std::min(target * 2, below));
+        PyramidHalve(children).copyTo(levels[l].rowRange((int)finished[l], (int)target));
+        finished[l] = target;
+    }
+}
+
+void FlowPyramid::GetRows(int level, FrameRange range, cv::Mat& out)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(level < 0 || level >= (int)levels.size() || range.toFrame > finished[level] || range.fromFrame > range.toFrame) {
+        throw std::runtime_error("Invalid pyramid range");
+    }
+    levels[level].rowRange((int)range.fromFrame, (int)range.toFrame).copyTo(out);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+extern "C" {
+#include "FlowLib.h"
+}
+
+#include <opencv2/core.hpp>
+
+#include <mutex>
+#include <vector>
+
+// Temporal pyramid of angle rows, level n holds one CV_8U row per 2^n frames
+// Level 0 is truncated at 1% of a 720p frame like WaveNormalize, but scaled by that fixed maximum so finished tiles never change
+// Every higher level averages pairs of rows of the level below, built as the rows of level 0 come in
+class FlowPyramid {
+public:
+    int GetNumLevels();
+    FrameNumber GetLevelLength(int level);
+    // Angle rows (CV_32S) from frame fromFrame on, rows that are already in the pyramid are skipped
+    void Push(FrameNumber fromFrame, const cv::Mat& rows);
+    // Rows of level 0 that were pushed
+    FrameNumber GetNumPushed();
+    // Rows of a level, the range must be finished, see GetNumFinished
+    void GetRows(int level, FrameRange range, cv::Mat& out);
+    FrameNumber GetNumFinished(int level);
+
+    // Allocates the levels, the shape is known before through the static functions
+    void Init(FrameNumber numFrames, int bins);
+    bool IsInitialized();
+
+    static int GetNumLevels(FrameNumber numFrames);
+    static FrameNumber GetLevelLength(FrameNumber numFrames, int level);
+
+private:
+    std::mutex mutex;
+    FrameNumber numFrames = 0;
+    std::vector<cv::Mat> levels;
+    std::vector<FrameNumber> finished;
+};
+
+// Angle rows (CV_32S) to the CV_8U rows of level 0
+cv::Mat PyramidNormalize(const cv::Mat& rows);
+// Averages pairs of rows, an odd last row is kept as is
+cv::Mat PyramidHalve(const cv::Mat& rows);
+// Gray rows to RGB like visualize() of the browser extension, the first half of the bins against the second on a jet color map
+cv::Mat PyramidColorize(const cv::Mat& gray);
@@ -0,0 +1,102 @@
+#include "FlowQuery.hpp"
+
+#include <opencv2/core/hal/intrin.hpp>
+
+static_assert(FLOW_MAGNITUDE_BINS == 8, "The reduction loads one angle bin as 8 x uint16");
+
+static float MagnitudeBinLower(int bin)
+{
+    return bin == 0 ? 0.0f : std::ldexp(1.0f, bin - 1);
+}
+
+static float MagnitudeBinCenter(int bin)
+{
+    return bin == 0 ? 0.5f : MagnitudeBinLower(bin) * 1.5f;
+}
+
+void ReduceAngleMagnitude(const cv::Mat& hist, int bins, float threshold, bool weighted, cv::Mat& out)
+{
+    CV_Assert(hist.type() == CV_16UC1 && hist.cols == bins * FLOW_MAGNITUDE_BINS);
+    out.create(hist.rows, bins, CV_32SC1);
+
+    // Factor per magnitude bin, zero below the threshold
+    float factors[FLOW_MAGNITUDE_BINS];
+    for(int m=0; m<FLOW_MAGNITUDE_BINS; m++) {
+        float factor = weighted ? MagnitudeBinCenter(m) : 1.0f;
+        factors[m] = MagnitudeBinLower(m) >= threshold ? factor : 0.0f;
+    }
+
+    for(int r=0; r<hist.rows; r++) {
+        const ushort* src = hist.ptr<ushort>(r);
+        int* dst = out.ptr<int>(r);
+        int a = 0;
+
+#if CV_SIMD128
+        cv::v_float32x4 factorsLow = cv::v_load(factors);
+        cv::v_float32x4 factorsHigh = cv::v_load(factors + 4);
+
+        for(; a<bins; a++) {
+            cv::v_uint32x4 low, high;
+            cv::v_expand(cv::v_load(src + a * FLOW_MAGNITUDE_BINS), low, high);
+
+            cv::v_float32x4 sum = cv::v_fma(cv::v_cvt_f32(cv::v_reinterpret_as_s32(low)), factorsLow, cv::v_setzero_f32());
+            sum = cv::v_fma(cv::v_cvt_f32(cv::v_reinterpret_as_s32(high)), factorsHigh, sum);
+            dst[a] = cvRound(cv::v_reduce_sum(sum));
+        }
+#endif
+
+        for(; a<bins; a++) {
+            float sum = 0.0f;
+            for(int m=0; m<FLOW_MAGNITUDE_BINS; m++) {
+                sum += src[a * FLOW_MAGNITUDE_BINS + m] * factors[m];
+            }
+            dst[a] = cvRound(sum);
+        }
+    }
+}
+
+void GridPrefixSum(cv::Mat row, int bins, int grid)
+{
+    CV_Assert(row.type() == CV_32SC1 && row.rows == 1 && row.cols == grid * grid * bins);
+    int* data = row.ptr<int>(0);
+
+    for(int cy=0; cy<grid; cy++) {
+        for(int cx=0; cx<grid; cx++) {
+            int* cell = data + (cy * grid + cx) * bins;
+            const int* up = cy > 0 ? cell - grid * bins : nullptr;
+            const int* left = cx > 0 ? cell - bins : nullptr;
+            const int* upLeft = cy > 0 && cx > 0 ? cell - (grid + 1) * bins : nullptr;
+
+            for(int b=0; b<bins; b++) {
+                cell[b] += (up ? up[b] : 0) + (left ? left[b] : 0) - (upLeft ? upLeft[b] : 0);
+            }
+        }
+    }
+}
+
+void ReduceGridRegion(const cv::Mat& prefix, int bins, int grid, cv::Rect cells, cv::Mat& out)
+{
+    CV_Assert(prefix.type() == CV_32SC1 && prefix.cols == grid * grid * bins);
+
+    // Inclusive prefix sums, so the corners are one cell in from the rectangle
+    auto corner = [&](int cx, int cy) {
+        int cell = cy * grid + cx;
+        return prefix.colRange(cell * bins, (cell + 1) * bins);
+    };
+
+    int x1 = cells.x + cells.width - 1;
+    int y1 = cells.y + cells.height - 1;
+
+    cv::Mat sum = corner(x1, y1).clone();
+    if(cells.y > 0) {
+        cv::subtract(sum, corner(x1, cells.y - 1), sum);
+    }
+    if(cells.x > 0) {
+        cv::subtract(sum, corner(cells.x - 1, y1), sum);
+    }
+    if(cells.x > 0 && cells.y > 0) {
+        cv::add(sum, corner(cells.x - 1, cells.y - 1), sum);
+    }
+
+    sum.copyTo(out);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "FlowLibShared.hpp"
+
+#include <opencv2/core.hpp>
+
+// Angle rows (CV_32S) from an angle x magnitude histogram (CV_16U), bins below the threshold are skipped
+void ReduceAngleMagnitude(const cv::Mat& hist, int bins, float threshold, bool weighted, cv::Mat& out);
+
+// Turns one row of per cell angle counts (CV_32S, cells row major) into inclusive 2D prefix sums, in place
+void GridPrefixSum(cv::Mat row, int bins, int grid);
+
+// Angle rows (CV_32S) of a rectangle of cells, from rows written by GridPrefixSum
+void ReduceGridRegion(const cv::Mat& prefix, int bins, int grid, cv::Rect cells, cv::Mat& out);
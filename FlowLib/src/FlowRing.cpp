@@ -0,0 +1,168 @@
+#include "FlowRing.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+// -- FlowRingWriter --
+
+FlowRingWriter::~FlowRingWriter()
+{
+    if(header) {
+        munmap(header, size);
+    }
+}
+
+void FlowRingWriter::Create(const char* name, uint64_t numFrames, uint64_t lengthMs, uint32_t rowSize, uint64_t capacity)
+{
+    if(capacity == 0 || capacity > numFrames) {
+        capacity = numFrames > 0 ? numFrames : 1;
+    }
+    size = FLOW_RING_DATA_OFFSET + capacity * rowSize;
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0) {
+        throw std::runtime_error(std::string("Cannot create shared memory ") + name + ": " + strerror(errno));
+    }
+    if(ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        throw std::runtime_error(std::string("Cannot size shared memory ") + name + ": " + strerror(errno));
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        shm_unlink(name);
+        throw std::runtime_error(std::string("Cannot map shared memory ") + name + ": " + strerror(errno));
+    }
+
+    // ftruncate zeroed the object, which is a valid header apart from the magic
+    header = (FlowRingHeader*)data;
+    header->rowSize = rowSize;
+    header->numFrames = numFrames;
+    header->capacity = capacity;
+    header->lengthMs = lengthMs;
+    header->magic.store(FLOW_RING_MAGIC, std::memory_order_release);
+}
+
+void* FlowRingWriter::Reserve(uint64_t fromFrame, uint64_t toFrame)
+{
+    while(toFrame - header->readFrame.load(std::memory_order_acquire) > header->capacity) {
+        if(header->cancel.load(std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if(header->cancel.load(std::memory_order_relaxed)) {
+        return nullptr;
+    }
+
+    return (char*)header + FLOW_RING_DATA_OFFSET + (fromFrame % header->capacity) * header->rowSize;
+}
+
+void FlowRingWriter::Publish(uint64_t toFrame)
+{
+    header->writeFrame.store(toFrame, std::memory_order_release);
+}
+
+void FlowRingWriter::Finish()
+{
+    header->status.store(FlowRingDone, std::memory_order_release);
+}
+
+void FlowRingWriter::Fail(const char* error)
+{
+    strncpy(header->error, error ? error : "", FLOW_RING_ERROR_SIZE - 1);
+    header->status.store(FlowRingFailed, std::memory_order_release);
+}
+
+// -- FlowRingReader --
+
+FlowRingReader::~FlowRingReader()
+{
+    Close();
+}
+
+bool FlowRingReader::Open(const char* name)
+{
+    int fd = shm_open(name, O_RDWR, 0600);
+    if(fd < 0) {
+        if(errno == ENOENT) {
+            return false;
+        }
+        throw std::runtime_error(std::string("Cannot open shared memory ") + name + ": " + strerror(errno));
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < FLOW_RING_DATA_OFFSET) {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        throw std::runtime_error(std::string("Cannot map shared memory ") + name + ": " + strerror(errno));
+    }
+
+    FlowRingHeader* mapped = (FlowRingHeader*)data;
+    if(mapped->magic.load(std::memory_order_acquire) != FLOW_RING_MAGIC) {
+        munmap(data, st.st_size);
+        return false;
+    }
+
+    header = mapped;
+    size = st.st_size;
+    strncpy(this->name, name, sizeof(this->name) - 1);
+    return true;
+}
+
+void FlowRingReader::Close()
+{
+    if(!header) {
+        return;
+    }
+
+    header->cancel.store(1, std::memory_order_relaxed);
+    munmap(header, size);
+    shm_unlink(name);
+    header = nullptr;
+}
+
+uint64_t FlowRingReader::Wait(uint64_t fromFrame, const void** rows, int timeoutMs)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    uint64_t toFrame = header->writeFrame.load(std::memory_order_acquire);
+    while(toFrame <= fromFrame && GetStatus() == FlowRingRunning && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        toFrame = header->writeFrame.load(std::memory_order_acquire);
+    }
+    // The last rows are published before the status changes
+    toFrame = header->writeFrame.load(std::memory_order_acquire);
+    if(toFrame <= fromFrame) {
+        return fromFrame;
+    }
+
+    // Contiguous up to the end of the ring
+    uint64_t slot = fromFrame % header->capacity;
+    if(toFrame - fromFrame > header->capacity - slot) {
+        toFrame = fromFrame + header->capacity - slot;
+    }
+
+    *rows = (char*)header + FLOW_RING_DATA_OFFSET + slot * header->rowSize;
+    return toFrame;
+}
+
+void FlowRingReader::Release(uint64_t toFrame)
+{
+    header->readFrame.store(toFrame, std::memory_order_release);
+}
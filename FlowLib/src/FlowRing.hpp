@@ -0,0 +1,83 @@
+#pragma once
+
+// Rows of one output of a worker job in POSIX shared memory, published by JTFlowWorker and read in another process
+// Row f lives in slot f % capacity, the worker waits for the reader before overwriting a slot
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define FLOW_RING_MAGIC 0x474e5246 // "FRNG"
+#define FLOW_RING_ERROR_SIZE 256
+
+enum FlowRingStatus {
+    FlowRingRunning = 0,
+    FlowRingDone = 1,
+    FlowRingFailed = 2
+};
+
+struct FlowRingHeader {
+    std::atomic<uint32_t> magic; // Set last by the worker, the other fields are valid once it matches
+    uint32_t rowSize; // Bytes per row
+    uint64_t numFrames;
+    uint64_t capacity; // Rows in the ring
+    uint64_t lengthMs;
+    std::atomic<uint64_t> writeFrame; // Rows below are published
+    std::atomic<uint64_t> readFrame; // Rows below are consumed, their slots may be overwritten
+    std::atomic<int32_t> status; // FlowRingStatus
+    std::atomic<int32_t> cancel; // Set by the reader, the worker exits
+    char error[FLOW_RING_ERROR_SIZE]; // Valid once status is FlowRingFailed
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "FlowRingHeader needs lock-free 64 bit atomics");
+
+// Rows start at the first cache line after the header
+#define FLOW_RING_DATA_OFFSET ((sizeof(FlowRingHeader) + 63) & ~(size_t)63)
+
+// Worker side, creates the shared memory object
+class FlowRingWriter {
+public:
+    ~FlowRingWriter();
+
+    void Create(const char* name, uint64_t numFrames, uint64_t lengthMs, uint32_t rowSize, uint64_t capacity);
+    // Slots for rows [fromFrame, toFrame), waits until the reader released them
+    // Returns nullptr when the reader cancelled, the range may not cross the end of the ring
+    void* Reserve(uint64_t fromFrame, uint64_t toFrame);
+    void Publish(uint64_t toFrame);
+    void Finish();
+    void Fail(const char* error);
+
+    uint64_t GetCapacity() { return header->capacity; }
+
+private:
+    FlowRingHeader* header = nullptr;
+    size_t size = 0;
+};
+
+// Client side, rows are read in place
+class FlowRingReader {
+public:
+    ~FlowRingReader();
+
+    // False while the worker hasn't published its header yet
+    bool Open(const char* name);
+    // Unmaps and removes the shared memory object, cancels the worker if it is still running
+    void Close();
+
+    uint64_t GetLength() { return header->numFrames; }
+    uint64_t GetLengthMs() { return header->lengthMs; }
+    uint32_t GetRowSize() { return header->rowSize; }
+    int GetStatus() { return header->status.load(std::memory_order_acquire); }
+    const char* GetError() { return header->error; }
+
+    // Waits up to timeoutMs for rows from fromFrame on, returns the end of the readable rows
+    // *rows points at fromFrame, the rows are contiguous up to the end of the ring and valid until Release
+    uint64_t Wait(uint64_t fromFrame, const void** rows, int timeoutMs);
+    // Hands the slots of rows below toFrame back to the worker
+    void Release(uint64_t toFrame);
+
+private:
+    FlowRingHeader* header = nullptr;
+    size_t size = 0;
+    char name[256] = {};
+};
@@ -1,15 +1,155 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
 
 extern "C" {
 #include "FlowLib.h"
 }
 
+#ifndef _WIN32
+#include "Daemon.hpp"
+#endif
+
+// Runs the video with both properties and compares the histograms row by row
+static int CompareRuns(const char* video, FlowProperties* runs[2], const char* names[2])
+{
+    std::vector<int> rows[2];
+    int columns = 0;
+    for (int r = 0; r < 2; r++) {
+        FlowHandle handle = FlowCreateHandle(video, runs[r]);
+        if (!handle) {
+            std::cout << "Open failed: " << FlowLastError() << "\n";
+            return 1;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        FlowRun(handle, NULL, 120);
+        auto end = std::chrono::steady_clock::now();
+
+        FrameNumber length = FlowGetLength(handle);
+        columns = FlowGetOutputRowSize(handle, 0) / sizeof(int);
+        rows[r].resize((size_t)length * columns);
+        FlowGetData(handle, { 0, length }, rows[r].data());
+        FlowDestroyHandle(handle);
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        std::cout << names[r] << ": " << seconds << " s, " << length << " frames, " << length / std::max(seconds, 1e-6) << " fps\n";
+    }
+
+    size_t numRows = std::min(rows[0].size(), rows[1].size()) / std::max(columns, 1);
+    if (numRows == 0) {
+        return 1;
+    }
+
+    // Total variation distance of the normalized histograms, 0 is identical and 1 disjoint
+    std::vector<double> distances;
+    for (size_t y = 0; y < numRows; y++) {
+        const int* a = &rows[0][y * columns];
+        const int* b = &rows[1][y * columns];
+        double sumA = 0, sumB = 0;
+        for (int x = 0; x < columns; x++) {
+            sumA += a[x];
+            sumB += b[x];
+        }
+        if (sumA == 0 && sumB == 0) {
+            distances.push_back(0);
+            continue;
+        }
+        if (sumA == 0 || sumB == 0) {
+            distances.push_back(1);
+            continue;
+        }
+        double distance = 0;
+        for (int x = 0; x < columns; x++) {
+            distance += std::abs(a[x] / sumA - b[x] / sumB);
+        }
+        distances.push_back(distance / 2);
+    }
+
+    double mean = 0;
+    for (double distance : distances) {
+        mean += distance;
+    }
+    mean /= distances.size();
+    std::sort(distances.begin(), distances.end());
+
+    std::cout << "Histogram distance per row: mean " << mean
+        << ", p95 " << distances[distances.size() * 95 / 100]
+        << ", max " << distances.back() << "\n";
+    return 0;
+}
+
+// Runs the video with and without the fast-decode flags
+static int FastDecodeDiff(const char* video, FlowProperties properties, int fastDecode1, int fastDecode3)
+{
+    FlowProperties fast = properties;
+    properties.fastDecode1 = 0;
+    properties.fastDecode3 = 0;
+    fast.fastDecode1 = fastDecode1;
+    fast.fastDecode3 = fastDecode3;
+
+    FlowProperties* runs[2] = { &properties, &fast };
+    const char* names[2] = { "Full decode", "Fast decode" };
+    return CompareRuns(video, runs, names);
+}
+
+// Runs the video through x264 and another intermediate encoder
+static int EncoderDiff(const char* video, FlowProperties properties, int motionEncoder, int motionSearch, int motionRange)
+{
+    FlowProperties other = properties;
+    properties.motionEncoder = FlowEncoderX264;
+    other.motionEncoder = motionEncoder;
+    other.motionSearch = motionSearch;
+    other.motionRange = motionRange;
+
+    FlowProperties* runs[2] = { &properties, &other };
+    const char* names[2] = { "x264", motionEncoder == FlowEncoderMpeg4 ? "mpeg4" : motionEncoder == FlowEncoderMpeg2 ? "mpeg2video" : "Other" };
+    return CompareRuns(video, runs, names);
+}
+
+// Follows a live stream and reports the window and the latency of its rows
+static int RunLive(const char* url, FlowProperties properties, int window)
+{
+    properties.liveWindow = std::max(window, 1);
+    properties.packetIndex = false;
+    FlowHandle handle = FlowCreateHandle(url, &properties);
+    if (!handle) {
+        std::cout << "Open failed: " << FlowLastError() << "\n";
+        return 1;
+    }
+
+    bool success = FlowRun(handle, [](FlowHandle handle, int frame_number) {
+        if (frame_number % 25 != 0) {
+            return;
+        }
+        FrameRange range;
+        FlowStats stats;
+        FlowGetLiveRange(handle, &range);
+        FlowGetStats(handle, &stats);
+        std::cout << "Rows " << range.fromFrame << " - " << range.toFrame << ", latency " << stats.latencyLastMs
+            << " ms (mean " << stats.latencyMeanMs << ", max " << stats.latencyMaxMs << ")\n";
+    }, 1);
+
+    FlowDestroyHandle(handle);
+    return success ? 0 : 1;
+}
+
 int main(int argc, char* argv[])
 {
     if (argc < 3) {
-        std::cout << "Usage: FlowLibUtil.exe <input video> <output file>\n";
+        std::cout << "Usage: FlowLibUtil.exe <input video or capture> <output file> [capture file]\n";
+#ifndef _WIN32
+        std::cout << "       FlowLibUtil --daemon <socket> [max jobs]\n";
+        std::cout << "       FlowLibUtil --client <socket> <input video> <output file>\n";
+#endif
+        std::cout << "       FlowLibUtil --fast-decode-diff <input video> <fastDecode1> [fastDecode3]\n";
+        std::cout << "       FlowLibUtil --encoder-diff <input video> <motionEncoder> [motionSearch] [motionRange]\n";
+        std::cout << "       FlowLibUtil --live <stream url> [window frames]\n";
         return 0;
     }
 
@@ -19,9 +159,58 @@ int main(int argc, char* argv[])
         false, // overlayHalf
         0.5f, // focusPoint
         0.5f, // focusSize
-        0.5f // waveSmoothing1
+        0.5f, // waveSmoothing1
+        false, // computeOnRead
+        0, // previewWindowMs
+        0, // previewIntervalMs
+        0.0f, // magnitudeThreshold
+        0.0f, // roiX
+        0.0f, // roiY
+        0.0f, // roiWidth
+        0.0f, // roiHeight
+        FlowOutputAngles, // outputMode
+        0, // gridSize
+        false, // pythonModel
+        false, // prefixIndex
+        false, // fastOpen
+        0, // readAheadMb
+        false, // mappedIO
+        FlowRenditionHighest, // renditionPolicy
+        0, // renditionHeight
+        0, // fastDecode1
+        0, // fastDecode3
+        false, // packetIndex
+        0.0f, // duplicateThreshold
+        0, // liveWindow
+        0, // intraDecoders
+        FlowEncoderX264, // motionEncoder
+        FlowSearchDefault, // motionSearch
+        0 // motionRange
     };
 
+    if (strcmp(argv[1], "--live") == 0) {
+        return RunLive(argv[2], properties, argc > 3 ? atoi(argv[3]) : 1000);
+    }
+    if (strcmp(argv[1], "--fast-decode-diff") == 0) {
+        return FastDecodeDiff(argv[2], properties, argc > 3 ? atoi(argv[3]) : 0, argc > 4 ? atoi(argv[4]) : properties.fastDecode3);
+    }
+    if (strcmp(argv[1], "--encoder-diff") == 0) {
+        return EncoderDiff(argv[2], properties, argc > 3 ? atoi(argv[3]) : FlowEncoderMpeg4, argc > 4 ? atoi(argv[4]) : FlowSearchDefault, argc > 5 ? atoi(argv[5]) : 0);
+    }
+
+#ifndef _WIN32
+    if (strcmp(argv[1], "--daemon") == 0) {
+        return RunDaemon(argv[2], argc > 3 ? atoi(argv[3]) : 1, properties);
+    }
+    if (strcmp(argv[1], "--client") == 0) {
+        if (argc < 5) {
+            std::cout << "Usage: FlowLibUtil --client <socket> <input video> <output file>\n";
+            return 1;
+        }
+        return RunClient(argv[2], argv[3], argv[4]);
+    }
+#endif
+
 
     try {
 
@@ -30,6 +219,10 @@ int main(int argc, char* argv[])
         std::cout << "Length frames: " << FlowGetLength(handle) << "\n";
         std::cout << "Length ms: " << FlowGetLengthMs(handle) << "\n";
 
+        if (argc > 3 && !FlowSetCapture(handle, argv[3])) {
+            std::cout << "Capture failed: " << FlowLastError() << "\n";
+        }
+
         clock_t start = clock();
         FlowRun(handle, [](FlowHandle handle, int frame_number) {
             FrameNumber length = FlowGetLength(handle);
@@ -39,6 +232,11 @@ int main(int argc, char* argv[])
         double elapsed_time = (double)(end - start) / CLOCKS_PER_SEC;
 	    fprintf(stderr, "Elapsed time: %f seconds\n", elapsed_time);
 
+        FlowStats stats;
+        if (FlowGetStats(handle, &stats)) {
+            std::cout << "Frames decoded: " << stats.framesDecoded << ", duplicates: " << stats.framesDuplicate << "\n";
+        }
+
         FlowSave(handle, argv[2]);
         FlowDestroyHandle(handle);
     } catch (const std::runtime_error& e) {
@@ -0,0 +1,245 @@
+#include "PacketIndex.hpp"
+#include "StreamCache.hpp"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#define PACKET_INDEX_MAGIC 0x49505a4a // "JZPI"
+#define PACKET_INDEX_VERSION 1
+
+struct PacketIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t streamIndex;
+    int32_t codecId;
+    AVRational timeBase;
+    int64_t fileSize;
+    int64_t fileTime;
+    int64_t numPackets;
+};
+
+int64_t PacketIndex::FrameToPts(int64_t frame) const
+{
+    if (packets.empty()) {
+        return 0;
+    }
+    if (frame < 0) {
+        return packets.front().pts;
+    }
+    if (frame < NumFrames()) {
+        return packets[frame].pts;
+    }
+
+    // Past the end, continues at the rate of the last frames
+    int64_t last = NumFrames() - 1;
+    int64_t duration = last > 0 ? std::max<int64_t>(packets[last].pts - packets[last - 1].pts, 1) : 1;
+    return packets[last].pts + (frame - last) * duration;
+}
+
+int64_t PacketIndex::PtsToFrame(int64_t pts) const
+{
+    auto it = std::lower_bound(packets.begin(), packets.end(), pts, [](const IndexedPacket& packet, int64_t pts) {
+        return packet.pts < pts;
+    });
+    return it - packets.begin();
+}
+
+int64_t PacketIndex::KeyframeBefore(int64_t frame) const
+{
+    auto it = std::upper_bound(keyframes.begin(), keyframes.end(), frame);
+    if (it == keyframes.begin()) {
+        return keyframes.empty() ? 0 : keyframes.front();
+    }
+    return *(it - 1);
+}
+
+std::vector<int64_t> PacketIndex::SplitPoints(int parts) const
+{
+    std::vector<int64_t> points = { 0 };
+    for (int p = 1; p < parts; p++) {
+        int64_t keyframe = KeyframeBefore(NumFrames() * p / parts);
+        if (keyframe > points.back()) {
+            points.push_back(keyframe);
+        }
+    }
+    return points;
+}
+
+void PacketIndex::Finish()
+{
+    std::stable_sort(packets.begin(), packets.end(), [](const IndexedPacket& a, const IndexedPacket& b) {
+        return a.pts < b.pts;
+    });
+
+    keyframes.clear();
+    for (size_t i = 0; i < packets.size(); i++) {
+        if (packets[i].keyframe) {
+            keyframes.push_back((int64_t)i);
+        }
+    }
+}
+
+bool BuildPacketIndex(AVFormatContext* fmt_ctx, AVStream* stream, PacketIndex& index)
+{
+    AVPacket* pkt = av_packet_alloc();
+    if (!pkt) {
+        throw std::runtime_error("Could not allocate packet");
+    }
+
+    bool timestamps = true;
+    index.packets.clear();
+    while (av_read_frame(fmt_ctx, pkt) >= 0) {
+        // Packets the demuxer marks as discarded (edit lists) are decoded but never shown
+        if (pkt->stream_index == stream->index && !(pkt->flags & AV_PKT_FLAG_DISCARD)) {
+            int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+            if (pts == AV_NOPTS_VALUE) {
+                timestamps = false;
+            }
+            index.packets.push_back({ pts, pkt->pos, pkt->size, (pkt->flags & AV_PKT_FLAG_KEY) ? 1 : 0 });
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+
+    // Back to the first packet for the reader, by timestamp or else by byte
+    int64_t start = index.packets.empty() || !timestamps ? 0 : std::min_element(index.packets.begin(), index.packets.end(), [](const IndexedPacket& a, const IndexedPacket& b) {
+        return a.pts < b.pts;
+    })->pts;
+    if (av_seek_frame(fmt_ctx, stream->index, start, AVSEEK_FLAG_BACKWARD) < 0 && av_seek_frame(fmt_ctx, -1, 0, AVSEEK_FLAG_BYTE) < 0) {
+        throw std::runtime_error("Could not seek back after indexing the packets");
+    }
+    avformat_flush(fmt_ctx);
+
+    if (!timestamps || index.packets.empty()) {
+        index.packets.clear();
+        index.keyframes.clear();
+        return false;
+    }
+    index.Finish();
+    return true;
+}
+
+static const char* LocalPath(const char* path)
+{
+    return strncmp(path, "file:", 5) == 0 ? path + 5 : path;
+}
+
+static std::string CachePath(const char* path)
+{
+    std::string dir = StreamCacheDirectory();
+    if (dir.empty()) {
+        return "";
+    }
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (const char* c = path; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 1099511628211ull;
+    }
+
+    char name[40];
+    snprintf(name, sizeof(name), "/index-%016llx.jtidx", (unsigned long long)hash);
+    return dir + name;
+}
+
+static bool MakeHeader(const char* path, AVStream* stream, PacketIndexHeader& header)
+{
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = PACKET_INDEX_MAGIC;
+    header.version = PACKET_INDEX_VERSION;
+    header.streamIndex = stream->index;
+    header.codecId = stream->codecpar->codec_id;
+    header.timeBase = stream->time_base;
+    header.fileSize = (int64_t)info.st_size;
+    header.fileTime = (int64_t)info.st_mtime;
+    return true;
+}
+
+static bool ReadIndex(const std::string& indexPath, const PacketIndexHeader& expected, PacketIndex& index)
+{
+    FILE* file = indexPath.empty() ? nullptr : fopen(indexPath.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    PacketIndexHeader header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1
+        && header.magic == expected.magic && header.version == expected.version
+        && header.streamIndex == expected.streamIndex && header.codecId == expected.codecId
+        && av_cmp_q(header.timeBase, expected.timeBase) == 0
+        && header.fileSize == expected.fileSize && header.fileTime == expected.fileTime
+        && header.numPackets > 0 && header.numPackets < (1 << 28);
+    if (valid) {
+        index.packets.resize(header.numPackets);
+        valid = fread(index.packets.data(), sizeof(IndexedPacket), index.packets.size(), file) == index.packets.size();
+    }
+    fclose(file);
+
+    if (!valid) {
+        index.packets.clear();
+        return false;
+    }
+    index.Finish();
+    return true;
+}
+
+static bool WriteIndex(const std::string& indexPath, const PacketIndexHeader& header, const PacketIndex& index)
+{
+    if (indexPath.empty()) {
+        return false;
+    }
+
+    // Written next to the index and renamed, concurrent readers never see half a file
+    std::string tempPath = indexPath + "." + std::to_string((long long)(uintptr_t)&index) + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(index.packets.data(), sizeof(IndexedPacket), index.packets.size(), file) == index.packets.size();
+    written = fclose(file) == 0 && written;
+
+#ifdef _WIN32
+    remove(indexPath.c_str());
+#endif
+    if (!written || rename(tempPath.c_str(), indexPath.c_str()) != 0) {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool LoadPacketIndex(const char* path, AVStream* stream, PacketIndex& index)
+{
+    path = LocalPath(path);
+    PacketIndexHeader header;
+    if (!MakeHeader(path, stream, header)) {
+        return false;
+    }
+    return ReadIndex(std::string(path) + ".jtidx", header, index) || ReadIndex(CachePath(path), header, index);
+}
+
+void SavePacketIndex(const char* path, AVStream* stream, const PacketIndex& index)
+{
+    path = LocalPath(path);
+    PacketIndexHeader header;
+    if (!MakeHeader(path, stream, header)) {
+        return;
+    }
+    header.numPackets = (int64_t)index.packets.size();
+
+    if (!WriteIndex(std::string(path) + ".jtidx", header, index)) {
+        WriteIndex(CachePath(path), header, index);
+    }
+}
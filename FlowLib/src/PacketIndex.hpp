@@ -0,0 +1,52 @@
+#pragma once
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include <cstdint>
+#include <vector>
+
+// Every packet of the video stream, read once without decoding
+//
+// Frame n is the packet with the n-th smallest pts, so frame counts and frame numbers don't depend on the
+// container duration or a constant frame rate. Cached as <video>.jtidx, or in the stream cache directory when
+// the directory of the video isn't writable, keyed by the size and modification time of the file.
+
+struct IndexedPacket {
+    int64_t pts;
+    int64_t pos; // Byte offset in the file, -1 when the demuxer doesn't know it
+    int32_t size;
+    int32_t keyframe;
+};
+
+class PacketIndex
+{
+public:
+    // In presentation order
+    std::vector<IndexedPacket> packets;
+    // Frame numbers of the keyframes, ascending
+    std::vector<int64_t> keyframes;
+
+    int64_t NumFrames() const { return (int64_t)packets.size(); }
+
+    int64_t FrameToPts(int64_t frame) const;
+    // The first frame at or after pts
+    int64_t PtsToFrame(int64_t pts) const;
+    // The keyframe decoding has to start at for frame
+    int64_t KeyframeBefore(int64_t frame) const;
+    // Keyframes that divide the video into at most parts ranges of similar length, starting with frame 0
+    std::vector<int64_t> SplitPoints(int parts) const;
+
+    // Sorts the packets read in decode order and collects the keyframes
+    void Finish();
+};
+
+// Reads every packet of stream and seeks back to the start, false when the packets have no timestamps
+// The other streams should be discarded first, their packets are read as well otherwise
+bool BuildPacketIndex(AVFormatContext* fmt_ctx, AVStream* stream, PacketIndex& index);
+
+// False when the video has no index yet or it changed since
+bool LoadPacketIndex(const char* path, AVStream* stream, PacketIndex& index);
+// Best effort, next to the video or in the stream cache directory
+void SavePacketIndex(const char* path, AVStream* stream, const PacketIndex& index);
@@ -0,0 +1,590 @@
+// jtflow, a CPython module around the FlowLib C API
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "numpy/arrayobject.h"
+
+extern "C" {
+#include "FlowLib.h"
+};
+
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <string>
+
+typedef struct {
+    PyObject_HEAD
+    FlowHandle handle;
+    std::vector<FlowProperties>* properties;
+    // Host rows of every output, the arrays returned by output() point into these
+    std::vector<std::vector<char>>* mirrors;
+    PyObject* progress;
+} HandleObject;
+
+// FlowRunCallback carries no user data, so handles are found by their FlowHandle
+static std::mutex runningMutex;
+static std::map<FlowHandle, HandleObject*> running;
+
+enum FieldType { FieldInt, FieldFloat, FieldBool };
+
+struct PropertyField {
+    const char* name;
+    size_t offset;
+    FieldType type;
+};
+
+static const PropertyField propertyFields[] = {
+    { "numberOfPools", offsetof(FlowProperties, numberOfPools), FieldInt },
+    { "maxValue", offsetof(FlowProperties, maxValue), FieldFloat },
+    { "overlayHalf", offsetof(FlowProperties, overlayHalf), FieldBool },
+    { "focusPoint", offsetof(FlowProperties, focusPoint), FieldFloat },
+    { "focusSize", offsetof(FlowProperties, focusSize), FieldFloat },
+    { "waveSmoothing1", offsetof(FlowProperties, waveSmoothing1), FieldFloat },
+    { "computeOnRead", offsetof(FlowProperties, computeOnRead), FieldBool },
+    { "previewWindowMs", offsetof(FlowProperties, previewWindowMs), FieldInt },
+    { "previewIntervalMs", offsetof(FlowProperties, previewIntervalMs), FieldInt },
+    { "magnitudeThreshold", offsetof(FlowProperties, magnitudeThreshold), FieldFloat },
+    { "roiX", offsetof(FlowProperties, roiX), FieldFloat },
+    { "roiY", offsetof(FlowProperties, roiY), FieldFloat },
+    { "roiWidth", offsetof(FlowProperties, roiWidth), FieldFloat },
+    { "roiHeight", offsetof(FlowProperties, roiHeight), FieldFloat },
+    { "outputMode", offsetof(FlowProperties, outputMode), FieldInt },
+    { "gridSize", offsetof(FlowProperties, gridSize), FieldInt },
+    { "pythonModel", offsetof(FlowProperties, pythonModel), FieldBool },
+    { "prefixIndex", offsetof(FlowProperties, prefixIndex), FieldBool },
+    { "fastOpen", offsetof(FlowProperties, fastOpen), FieldBool },
+    { "readAheadMb", offsetof(FlowProperties, readAheadMb), FieldInt },
+    { "mappedIO", offsetof(FlowProperties, mappedIO), FieldBool },
+    { "renditionPolicy", offsetof(FlowProperties, renditionPolicy), FieldInt },
+    { "renditionHeight", offsetof(FlowProperties, renditionHeight), FieldInt },
+    { "fastDecode1", offsetof(FlowProperties, fastDecode1), FieldInt },
+    { "fastDecode3", offsetof(FlowProperties, fastDecode3), FieldInt },
+    { "packetIndex", offsetof(FlowProperties, packetIndex), FieldBool },
+    { "duplicateThreshold", offsetof(FlowProperties, duplicateThreshold), FieldFloat },
+    { "liveWindow", offsetof(FlowProperties, liveWindow), FieldInt },
+    { "intraDecoders", offsetof(FlowProperties, intraDecoders), FieldInt },
+    { "motionEncoder", offsetof(FlowProperties, motionEncoder), FieldInt },
+    { "motionSearch", offsetof(FlowProperties, motionSearch), FieldInt },
+    { "motionRange", offsetof(FlowProperties, motionRange), FieldInt },
+};
+
+// Same defaults as Server/src/flowlib.mjs
+static FlowProperties DefaultProperties()
+{
+    FlowProperties properties = {};
+    properties.numberOfPools = 180;
+    properties.maxValue = 0.2f;
+    properties.focusPoint = 0.5f;
+    properties.focusSize = 0.5f;
+    properties.waveSmoothing1 = 0.5f;
+    return properties;
+}
+
+static bool ParseProperties(PyObject* dict, FlowProperties& properties)
+{
+    properties = DefaultProperties();
+    if(dict == nullptr || dict == Py_None) {
+        return true;
+    }
+    if(!PyDict_Check(dict)) {
+        PyErr_SetString(PyExc_TypeError, "Properties must be a dict");
+        return false;
+    }
+
+    PyObject* key;
+    PyObject* value;
+    Py_ssize_t pos = 0;
+    while(PyDict_Next(dict, &pos, &key, &value)) {
+        const char* name = PyUnicode_AsUTF8(key);
+        if(name == nullptr) {
+            return false;
+        }
+
+        const PropertyField* field = nullptr;
+        for(const PropertyField& f : propertyFields) {
+            if(std::string(f.name) == name) {
+                field = &f;
+                break;
+            }
+        }
+        if(field == nullptr) {
+            PyErr_Format(PyExc_KeyError, "Unknown property '%s'", name);
+            return false;
+        }
+
+        char* target = (char*)&properties + field->offset;
+        if(field->type == FieldInt) {
+            *(int*)target = (int)PyLong_AsLong(value);
+        } else if(field->type == FieldFloat) {
+            *(float*)target = (float)PyFloat_AsDouble(value);
+        } else {
+            *(bool*)target = PyObject_IsTrue(value) == 1;
+        }
+        if(PyErr_Occurred()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static PyObject* FlowError()
+{
+    PyErr_SetString(PyExc_RuntimeError, FlowLastError());
+    return nullptr;
+}
+
+static int Handle_init(HandleObject* self, PyObject* args, PyObject* kwds)
+{
+    static const char* kwlist[] = { "path", "outputs", nullptr };
+    const char* path;
+    PyObject* outputs = nullptr;
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|O", (char**)kwlist, &path, &outputs)) {
+        return -1;
+    }
+
+    // A dict for one output or a list of dicts, one per output
+    std::vector<FlowProperties> properties;
+    if(outputs != nullptr && PyList_Check(outputs)) {
+        for(Py_ssize_t i=0; i<PyList_Size(outputs); i++) {
+            FlowProperties p;
+            if(!ParseProperties(PyList_GetItem(outputs, i), p)) {
+                return -1;
+            }
+            properties.push_back(p);
+        }
+    } else {
+        FlowProperties p;
+        if(!ParseProperties(outputs, p)) {
+            return -1;
+        }
+        properties.push_back(p);
+    }
+    if(properties.empty()) {
+        PyErr_SetString(PyExc_ValueError, "No outputs");
+        return -1;
+    }
+
+    FlowHandle handle;
+    Py_BEGIN_ALLOW_THREADS
+    handle = FlowCreateHandleMulti(path, properties.data(), (int)properties.size());
+    Py_END_ALLOW_THREADS
+    if(handle == nullptr) {
+        FlowError();
+        return -1;
+    }
+
+    self->handle = handle;
+    self->properties = new std::vector<FlowProperties>(properties);
+    self->mirrors = new std::vector<std::vector<char>>(properties.size());
+    return 0;
+}
+
+static void Handle_dealloc(HandleObject* self)
+{
+    if(self->handle) {
+        FlowDestroyHandle(self->handle);
+    }
+    delete self->properties;
+    delete self->mirrors;
+    Py_XDECREF(self->progress);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static bool CheckHandle(HandleObject* self)
+{
+    if(self->handle == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "Handle is not open");
+        return false;
+    }
+    return true;
+}
+
+static void RunCallback(FlowHandle handle, int frame_number)
+{
+    HandleObject* self;
+    {
+        std::lock_guard<std::mutex> lock(runningMutex);
+        auto it = running.find(handle);
+        if(it == running.end()) {
+            return;
+        }
+        self = it->second;
+    }
+
+    if(self->progress == nullptr) {
+        return;
+    }
+
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyObject* result = PyObject_CallFunction(self->progress, "i", frame_number);
+    if(result == nullptr) {
+        PyErr_Print();
+    }
+    Py_XDECREF(result);
+    PyGILState_Release(gil);
+}
+
+static PyObject* Handle_run(HandleObject* self, PyObject* args, PyObject* kwds)
+{
+    static const char* kwlist[] = { "progress", "interval", nullptr };
+    PyObject* progress = nullptr;
+    int interval = 120;
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|Oi", (char**)kwlist, &progress, &interval) || !CheckHandle(self)) {
+        return nullptr;
+    }
+    if(progress == Py_None) {
+        progress = nullptr;
+    }
+    if(progress != nullptr && !PyCallable_Check(progress)) {
+        PyErr_SetString(PyExc_TypeError, "progress must be callable");
+        return nullptr;
+    }
+
+    Py_XINCREF(progress);
+    Py_XSETREF(self->progress, progress);
+
+    {
+        std::lock_guard<std::mutex> lock(runningMutex);
+        running[self->handle] = self;
+    }
+
+    bool success;
+    Py_BEGIN_ALLOW_THREADS
+    success = FlowRun(self->handle, RunCallback, interval);
+    Py_END_ALLOW_THREADS
+
+    {
+        std::lock_guard<std::mutex> lock(runningMutex);
+        running.erase(self->handle);
+    }
+    Py_CLEAR(self->progress);
+
+    if(!success) {
+        return FlowError();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Handle_output(HandleObject* self, PyObject* args)
+{
+    int output = 0;
+    if(!PyArg_ParseTuple(args, "|i", &output) || !CheckHandle(self)) {
+        return nullptr;
+    }
+    if(output < 0 || output >= (int)self->properties->size()) {
+        PyErr_SetString(PyExc_IndexError, "Invalid output");
+        return nullptr;
+    }
+
+    int rowSize = FlowGetOutputRowSize(self->handle, output);
+    if(rowSize <= 0) {
+        return FlowError();
+    }
+    int type = self->properties->at(output).outputMode == FlowOutputAngleMagnitude ? NPY_UINT16 : NPY_INT32;
+
+    // The live window moves, its rows are copied into a new array each time
+    if(self->properties->at(output).liveWindow > 0) {
+        FrameRange range;
+        if(!FlowGetLiveRange(self->handle, &range)) {
+            return FlowError();
+        }
+        npy_intp dims[] = { (npy_intp)(range.toFrame - range.fromFrame), rowSize / (type == NPY_UINT16 ? 2 : 4) };
+        PyObject* array = PyArray_SimpleNew(2, dims, type);
+        if(array == nullptr) {
+            return nullptr;
+        }
+        if(range.toFrame == range.fromFrame) {
+            return array;
+        }
+
+        bool success;
+        void* data = PyArray_DATA((PyArrayObject*)array);
+        Py_BEGIN_ALLOW_THREADS
+        success = FlowGetOutputData(self->handle, output, range, data);
+        Py_END_ALLOW_THREADS
+        if(!success) {
+            Py_DECREF(array);
+            return FlowError();
+        }
+        return array;
+    }
+
+    FrameNumber length = FlowGetLength(self->handle);
+
+    // Sized once, so earlier arrays keep pointing at valid rows that are refreshed in place
+    std::vector<char>& mirror = self->mirrors->at(output);
+    if(mirror.empty()) {
+        mirror.resize((size_t)length * rowSize);
+    }
+
+    bool success;
+    Py_BEGIN_ALLOW_THREADS
+    success = FlowGetOutputData(self->handle, output, FrameRange{ 0, length }, mirror.data());
+    Py_END_ALLOW_THREADS
+    if(!success) {
+        return FlowError();
+    }
+
+    npy_intp dims[] = { (npy_intp)length, rowSize / (type == NPY_UINT16 ? 2 : 4) };
+    PyObject* array = PyArray_SimpleNewFromData(2, dims, type, mirror.data());
+    if(array == nullptr) {
+        return nullptr;
+    }
+
+    // The array keeps the handle, and with it the rows, alive
+    Py_INCREF(self);
+    if(PyArray_SetBaseObject((PyArrayObject*)array, (PyObject*)self) < 0) {
+        Py_DECREF(array);
+        return nullptr;
+    }
+    return array;
+}
+
+static PyObject* Handle_row_state(HandleObject* self, PyObject* Py_UNUSED(ignored))
+{
+    if(!CheckHandle(self)) {
+        return nullptr;
+    }
+
+    npy_intp dims[] = { (npy_intp)FlowGetLength(self->handle) };
+    PyObject* array = PyArray_SimpleNew(1, dims, NPY_UINT8);
+    if(array == nullptr) {
+        return nullptr;
+    }
+    if(!FlowGetRowState(self->handle, FrameRange{ 0, (FrameNumber)dims[0] }, (unsigned char*)PyArray_DATA((PyArrayObject*)array))) {
+        Py_DECREF(array);
+        return FlowError();
+    }
+    return array;
+}
+
+static PyObject* Handle_request_range(HandleObject* self, PyObject* args)
+{
+    unsigned long fromFrame, toFrame;
+    int priority = 0;
+    if(!PyArg_ParseTuple(args, "kk|i", &fromFrame, &toFrame, &priority) || !CheckHandle(self)) {
+        return nullptr;
+    }
+    if(!FlowRequestRange(self->handle, FrameRange{ fromFrame, toFrame }, priority)) {
+        return FlowError();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Handle_range_sums(HandleObject* self, PyObject* args)
+{
+    PyObject* sequence;
+    if(!PyArg_ParseTuple(args, "O", &sequence) || !CheckHandle(self)) {
+        return nullptr;
+    }
+
+    PyObject* fast = PySequence_Fast(sequence, "ranges must be a sequence of (from, to)");
+    if(fast == nullptr) {
+        return nullptr;
+    }
+
+    std::vector<FrameRange> ranges(PySequence_Fast_GET_SIZE(fast));
+    for(size_t i=0; i<ranges.size(); i++) {
+        unsigned long fromFrame, toFrame;
+        if(!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(fast, i), "kk", &fromFrame, &toFrame)) {
+            Py_DECREF(fast);
+            return nullptr;
+        }
+        ranges[i] = FrameRange{ fromFrame, toFrame };
+    }
+    Py_DECREF(fast);
+
+    npy_intp dims[] = { (npy_intp)ranges.size(), FlowGetOutputBins(self->handle, 0) };
+    PyObject* array = PyArray_SimpleNew(2, dims, NPY_LONGLONG);
+    if(array == nullptr) {
+        return nullptr;
+    }
+
+    bool success;
+    Py_BEGIN_ALLOW_THREADS
+    success = FlowGetRangeSums(self->handle, ranges.data(), (int)ranges.size(), (long long*)PyArray_DATA((PyArrayObject*)array));
+    Py_END_ALLOW_THREADS
+    if(!success) {
+        Py_DECREF(array);
+        return FlowError();
+    }
+    return array;
+}
+
+static PyObject* Handle_get_length(HandleObject* self, void* closure)
+{
+    if(!CheckHandle(self)) {
+        return nullptr;
+    }
+    return PyLong_FromUnsignedLong(FlowGetLength(self->handle));
+}
+
+static PyObject* Handle_get_length_ms(HandleObject* self, void* closure)
+{
+    if(!CheckHandle(self)) {
+        return nullptr;
+    }
+    return PyLong_FromUnsignedLong(FlowGetLengthMs(self->handle));
+}
+
+static PyObject* Handle_get_num_outputs(HandleObject* self, void* closure)
+{
+    return PyLong_FromSize_t(self->properties ? self->properties->size() : 0);
+}
+
+static PyObject* Handle_get_progress(HandleObject* self, void* closure)
+{
+    if(!CheckHandle(self)) {
+        return nullptr;
+    }
+    return PyFloat_FromDouble(FlowProgress(self->handle));
+}
+
+static PyObject* Handle_get_stats(HandleObject* self, void* closure)
+{
+    if(!CheckHandle(self)) {
+        return nullptr;
+    }
+    FlowStats stats;
+    if(!FlowGetStats(self->handle, &stats)) {
+        return FlowError();
+    }
+    return Py_BuildValue("{s:L,s:L,s:d,s:d,s:d}", "frames_decoded", stats.framesDecoded, "frames_duplicate", stats.framesDuplicate,
+        "latency_last_ms", stats.latencyLastMs, "latency_mean_ms", stats.latencyMeanMs, "latency_max_ms", stats.latencyMaxMs);
+}
+
+static PyObject* Handle_get_live_range(HandleObject* self, void* closure)
+{
+    if(!CheckHandle(self)) {
+        return nullptr;
+    }
+    FrameRange range;
+    if(!FlowGetLiveRange(self->handle, &range)) {
+        return FlowError();
+    }
+    return Py_BuildValue("(kk)", range.fromFrame, range.toFrame);
+}
+
+static PyMethodDef Handle_methods[] = {
+    { "run", (PyCFunction)Handle_run, METH_VARARGS | METH_KEYWORDS, "run(progress=None, interval=120), decodes the video without holding the GIL" },
+    { "output", (PyCFunction)Handle_output, METH_VARARGS, "output(index=0), rows of an output as an array sharing the handle's memory, a copy of the live_range rows with liveWindow" },
+    { "row_state", (PyCFunction)Handle_row_state, METH_NOARGS, "FlowRowState of every row" },
+    { "request_range", (PyCFunction)Handle_request_range, METH_VARARGS, "request_range(from, to, priority=0)" },
+    { "range_sums", (PyCFunction)Handle_range_sums, METH_VARARGS, "range_sums([(from, to), ...]), angle bin totals of output 0 per range" },
+    { nullptr }
+};
+
+static PyGetSetDef Handle_getset[] = {
+    { "length", (getter)Handle_get_length, nullptr, "Number of frames", nullptr },
+    { "length_ms", (getter)Handle_get_length_ms, nullptr, "Duration in ms", nullptr },
+    { "num_outputs", (getter)Handle_get_num_outputs, nullptr, "Number of outputs", nullptr },
+    { "progress", (getter)Handle_get_progress, nullptr, "Position of the reader as a fraction of the video", nullptr },
+    { "stats", (getter)Handle_get_stats, nullptr, "Reader counters, frames_decoded, frames_duplicate and the row latency in ms", nullptr },
+    { "live_range", (getter)Handle_get_live_range, nullptr, "(from, to) of the readable rows, the rolling window with liveWindow", nullptr },
+    { nullptr }
+};
+
+static PyTypeObject HandleType = {
+    PyVarObject_HEAD_INIT(nullptr, 0)
+};
+
+// FlowProcessWave passes the actions as rows by cols ints
+static void WaveActions(void* data, int rows, int cols, void* userData)
+{
+    npy_intp dims[] = { rows, cols };
+    PyObject* array = PyArray_SimpleNew(2, dims, NPY_INT32);
+    if(array != nullptr && rows > 0) {
+        memcpy(PyArray_DATA((PyArrayObject*)array), data, (size_t)rows * cols * sizeof(int));
+    }
+    *(PyObject**)userData = array;
+}
+
+static PyObject* jtflow_wave(PyObject* module, PyObject* args)
+{
+    PyObject* object;
+    if(!PyArg_ParseTuple(args, "O", &object)) {
+        return nullptr;
+    }
+
+    PyArrayObject* rows = (PyArrayObject*)PyArray_FROMANY(object, NPY_INT32, 2, 2, NPY_ARRAY_IN_ARRAY);
+    if(rows == nullptr) {
+        return nullptr;
+    }
+
+    PyObject* actions = nullptr;
+    bool success = FlowProcessWave((const int*)PyArray_DATA(rows), (int)PyArray_DIM(rows, 0), (int)PyArray_DIM(rows, 1), WaveActions, &actions);
+    Py_DECREF(rows);
+    if(!success) {
+        Py_XDECREF(actions);
+        return FlowError();
+    }
+    return actions;
+}
+
+static PyMethodDef jtflow_methods[] = {
+    { "wave", (PyCFunction)jtflow_wave, METH_VARARGS, "wave(rows), actions of the native wave port for angle rows, the [frame, pos] rows jtmodel.process returns" },
+    { nullptr }
+};
+
+static PyModuleDef jtflowModule = {
+    PyModuleDef_HEAD_INIT,
+    "jtflow",
+    "Motion vector histograms from FlowLib",
+    -1,
+    jtflow_methods,
+};
+
+PyMODINIT_FUNC PyInit_jtflow(void)
+{
+    import_array();
+
+    HandleType.tp_name = "jtflow.Handle";
+    HandleType.tp_doc = "Handle(path, outputs=None), outputs is a dict of FlowProperties or a list of them";
+    HandleType.tp_basicsize = sizeof(HandleObject);
+    HandleType.tp_flags = Py_TPFLAGS_DEFAULT;
+    HandleType.tp_new = PyType_GenericNew;
+    HandleType.tp_init = (initproc)Handle_init;
+    HandleType.tp_dealloc = (destructor)Handle_dealloc;
+    HandleType.tp_methods = Handle_methods;
+    HandleType.tp_getset = Handle_getset;
+    if(PyType_Ready(&HandleType) < 0) {
+        return nullptr;
+    }
+
+    PyObject* module = PyModule_Create(&jtflowModule);
+    if(module == nullptr) {
+        return nullptr;
+    }
+
+    Py_INCREF(&HandleType);
+    if(PyModule_AddObject(module, "Handle", (PyObject*)&HandleType) < 0) {
+        Py_DECREF(&HandleType);
+        Py_DECREF(module);
+        return nullptr;
+    }
+
+    PyModule_AddIntConstant(module, "OUTPUT_ANGLES", FlowOutputAngles);
+    PyModule_AddIntConstant(module, "OUTPUT_ANGLE_MAGNITUDE", FlowOutputAngleMagnitude);
+    PyModule_AddIntConstant(module, "OUTPUT_SPATIAL_GRID", FlowOutputSpatialGrid);
+    PyModule_AddIntConstant(module, "RENDITION_HIGHEST", FlowRenditionHighest);
+    PyModule_AddIntConstant(module, "RENDITION_AT_LEAST", FlowRenditionAtLeast);
+    PyModule_AddIntConstant(module, "RENDITION_MAX_HEIGHT", FlowRenditionMaxHeight);
+    PyModule_AddIntConstant(module, "FAST_SKIP_LOOP_FILTER", FlowFastSkipLoopFilter);
+    PyModule_AddIntConstant(module, "FAST_SKIP_IDCT", FlowFastSkipIdct);
+    PyModule_AddIntConstant(module, "FAST_FLAGS", FlowFastFlags);
+    PyModule_AddIntConstant(module, "FAST_LOWRES", FlowFastLowres);
+    PyModule_AddIntConstant(module, "ENCODER_X264", FlowEncoderX264);
+    PyModule_AddIntConstant(module, "ENCODER_MPEG4", FlowEncoderMpeg4);
+    PyModule_AddIntConstant(module, "ENCODER_MPEG2", FlowEncoderMpeg2);
+    PyModule_AddIntConstant(module, "SEARCH_DEFAULT", FlowSearchDefault);
+    PyModule_AddIntConstant(module, "SEARCH_ZERO", FlowSearchZero);
+    PyModule_AddIntConstant(module, "SEARCH_EPZS", FlowSearchEpzs);
+    PyModule_AddIntConstant(module, "SEARCH_XONE", FlowSearchXone);
+    PyModule_AddIntConstant(module, "ROW_MISSING", FlowRowMissing);
+    PyModule_AddIntConstant(module, "ROW_APPROXIMATE", FlowRowApproximate);
+    PyModule_AddIntConstant(module, "ROW_EXACT", FlowRowExact);
+    PyModule_AddIntConstant(module, "ROW_SKIPPED", FlowRowSkipped);
+    return module;
+}
@@ -0,0 +1,132 @@
+#ifdef FLOW_PYTHON_MODEL
+#include "PythonModel.hpp"
+
+#include <Python.h>
+#include "numpy/arrayobject.h"
+
+#include <stdexcept>
+
+// Holds the GIL for its scope
+class GilLock {
+public:
+    GilLock() { state = PyGILState_Ensure(); }
+    ~GilLock() { PyGILState_Release(state); }
+
+private:
+    PyGILState_STATE state;
+};
+
+PythonModel& PythonModel::Get()
+{
+    static PythonModel model;
+    return model;
+}
+
+PythonModel::PythonModel()
+{
+    // A Python host already runs an interpreter, only start one when embedded
+    if(!Py_IsInitialized()) {
+        Py_Initialize();
+        mainState = PyEval_SaveThread();
+    }
+
+    GilLock gil;
+    if(_import_array() < 0) {
+        PyErr_Print();
+        throw std::runtime_error("Failed to load numpy");
+    }
+
+    PyObject* sys_path = PySys_GetObject("path");
+    PyObject* path = PyUnicode_FromString(".");
+    PyList_Append(sys_path, path);
+    Py_DECREF(path);
+    path = PyUnicode_FromString("/usr/local/src/model");
+    PyList_Append(sys_path, path);
+    Py_DECREF(path);
+}
+
+PythonModel::~PythonModel()
+{
+    if(!Py_IsInitialized()) {
+        return;
+    }
+
+    {
+        GilLock gil;
+        Py_XDECREF(processFunc);
+        Py_XDECREF(module);
+    }
+
+    if(mainState) {
+        PyEval_RestoreThread(mainState);
+        Py_Finalize();
+    }
+}
+
+// Needs the GIL
+void PythonModel::Load()
+{
+    if(module && !reload) {
+        return;
+    }
+
+    PyObject* loaded = module ? PyImport_ReloadModule(module) : PyImport_ImportModule("jtmodel");
+    if(!loaded) {
+        PyErr_Print();
+        throw std::runtime_error("Failed to load jtmodel.py");
+    }
+
+    PyObject* func = PyObject_GetAttrString(loaded, "process");
+    if(!func || !PyCallable_Check(func)) {
+        PyErr_Print();
+        Py_XDECREF(func);
+        Py_DECREF(loaded);
+        throw std::runtime_error("Cannot find function 'process'");
+    }
+
+    Py_XDECREF(processFunc);
+    Py_XDECREF(module);
+    module = loaded;
+    processFunc = func;
+}
+
+cv::Mat PythonModel::Process(const cv::Mat& rows)
+{
+    cv::Mat input = rows.isContinuous() ? rows : rows.clone();
+    cv::Mat actions;
+
+    std::lock_guard<std::mutex> lock(callMutex);
+    GilLock gil;
+    Load();
+
+    npy_intp mdim[] = { input.rows, input.cols };
+    PyObject* pyMat = PyArray_SimpleNewFromData(2, mdim, NPY_INT32, input.ptr<int>(0));
+    PyObject* result = PyObject_CallFunctionObjArgs(processFunc, pyMat, NULL);
+    Py_DECREF(pyMat);
+
+    if (result == NULL) {
+        PyErr_Print();
+        throw std::runtime_error("Call failed");
+    }
+
+    PyArrayObject* resultArr = reinterpret_cast<PyArrayObject*>(result);
+    if(!PyArray_Check(result) || PyArray_TYPE(resultArr) != NPY_INT32) {
+        Py_DECREF(result);
+        throw std::runtime_error("Invalid result type");
+    }
+
+    npy_intp* dims = PyArray_SHAPE(resultArr);
+    if(PyArray_NDIM(resultArr) != 2 || dims[1] != 2) {
+        Py_DECREF(result);
+        throw std::runtime_error("Invalid result dimensions");
+    }
+
+    // The result belongs to Python, copy it before giving up the GIL
+    PyArrayObject* contiguous = PyArray_GETCONTIGUOUS(resultArr);
+    cv::Mat(dims[0], 2, CV_32SC1, PyArray_DATA(contiguous)).copyTo(actions);
+    Py_DECREF(contiguous);
+    Py_DECREF(result);
+
+    return actions;
+}
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <atomic>
+#include <mutex>
+
+typedef struct _object PyObject;
+typedef struct _ts PyThreadState;
+
+// Model/jtmodel.py in an embedded interpreter, started on first use
+// Calls from any thread are serialized and run under the GIL, the interpreter of a Python host is reused
+class PythonModel {
+public:
+    static PythonModel& Get();
+
+    // jtmodel.process on angle rows (CV_32S), the NumPy array shares the memory of rows
+    cv::Mat Process(const cv::Mat& rows);
+
+    // Reload jtmodel.py before every call, to iterate on the model without restarting
+    void SetReload(bool reload) { this->reload = reload; }
+
+private:
+    PythonModel();
+    ~PythonModel();
+
+    void Load();
+
+    std::mutex callMutex;
+    std::atomic<bool> reload = { false };
+    PyThreadState* mainState = nullptr;
+    PyObject* module = nullptr;
+    PyObject* processFunc = nullptr;
+};
@@ -0,0 +1,243 @@
+#include "ReadAhead.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+ReadAhead* ReadAhead::Open(const char* url, int bufferMb)
+{
+    int numSlots = std::max((int)((int64_t)bufferMb * (1 << 20) / READ_AHEAD_BLOCK_SIZE), READ_AHEAD_CONNECTIONS * 2);
+    ReadAhead* readAhead = new ReadAhead(url, numSlots);
+
+    AVIOContext* connection = readAhead->Connect();
+    if (!connection || avio_size(connection) <= 0 || !(connection->seekable & AVIO_SEEKABLE_NORMAL)) {
+        avio_closep(&connection);
+        delete readAhead;
+        return nullptr;
+    }
+
+    readAhead->Start(connection);
+    return readAhead;
+}
+
+ReadAhead::ReadAhead(const char* url, int numSlots): url(url)
+{
+    slots.resize(numSlots);
+    // Keeps a slot per connection free for the blocks the reader jumps to
+    windowBlocks = numSlots - READ_AHEAD_CONNECTIONS;
+}
+
+AVIOContext* ReadAhead::Connect()
+{
+    AVIOContext* connection = NULL;
+    AVIOInterruptCB interrupt = { &ReadAhead::InterruptCallback, this };
+    AVDictionary* options = NULL;
+    av_dict_set(&options, "multiple_requests", "1", 0);
+    int ret = avio_open2(&connection, url.c_str(), AVIO_FLAG_READ, &interrupt, &options);
+    av_dict_free(&options);
+    return ret < 0 ? NULL : connection;
+}
+
+void ReadAhead::Start(AVIOContext* connection)
+{
+    size = avio_size(connection);
+    numBlocks = (size + READ_AHEAD_BLOCK_SIZE - 1) / READ_AHEAD_BLOCK_SIZE;
+    for (Slot& slot : slots) {
+        slot.data.resize(READ_AHEAD_BLOCK_SIZE);
+    }
+
+    // The probing connection is the first fetcher, the others connect in parallel
+    fetchers.emplace_back(&ReadAhead::Fetch, this, connection);
+    for (int c = 1; c < READ_AHEAD_CONNECTIONS; c++) {
+        fetchers.emplace_back(&ReadAhead::Fetch, this, nullptr);
+    }
+}
+
+ReadAhead::~ReadAhead()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    fetchCondition.notify_all();
+    for (std::thread& fetcher : fetchers) {
+        fetcher.join();
+    }
+}
+
+int ReadAhead::InterruptCallback(void* opaque)
+{
+    return ((ReadAhead*)opaque)->stopping;
+}
+
+int ReadAhead::FindSlot(int64_t block)
+{
+    for (size_t s = 0; s < slots.size(); s++) {
+        if (slots[s].block == block && slots[s].state != SlotEmpty) {
+            return (int)s;
+        }
+    }
+    return -1;
+}
+
+bool ReadAhead::NextFetch(int64_t& block, int& slot)
+{
+    int64_t first = std::min(position / READ_AHEAD_BLOCK_SIZE, numBlocks);
+    int64_t last = std::min(first + windowBlocks, numBlocks);
+
+    block = -1;
+    for (int64_t b = first; b < last; b++) {
+        if (FindSlot(b) < 0) {
+            block = b;
+            break;
+        }
+    }
+    if (block < 0) {
+        return false;
+    }
+
+    // Least recently used slot outside the window
+    slot = -1;
+    for (size_t s = 0; s < slots.size(); s++) {
+        const Slot& candidate = slots[s];
+        bool inWindow = candidate.block >= first && candidate.block < last;
+        if (candidate.state == SlotFetching || (candidate.state != SlotEmpty && inWindow)) {
+            continue;
+        }
+        if (slot < 0 || candidate.state == SlotEmpty || (slots[slot].state != SlotEmpty && candidate.lastUse < slots[slot].lastUse)) {
+            slot = (int)s;
+            if (candidate.state == SlotEmpty) {
+                break;
+            }
+        }
+    }
+    return slot >= 0;
+}
+
+void ReadAhead::Fetch(AVIOContext* connection)
+{
+    if (!connection) {
+        connection = Connect();
+        if (!connection) {
+            // The other connections carry on
+            return;
+        }
+    }
+
+    while (true) {
+        int64_t block;
+        int s;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            fetchCondition.wait(lock, [&] { return stopping || NextFetch(block, s); });
+            if (stopping) {
+                break;
+            }
+            slots[s].block = block;
+            slots[s].state = SlotFetching;
+        }
+
+        // Only this thread touches a fetching slot
+        Slot& slot = slots[s];
+        int64_t offset = block * READ_AHEAD_BLOCK_SIZE;
+        int wanted = (int)std::min<int64_t>(READ_AHEAD_BLOCK_SIZE, size - offset);
+        int filled = 0;
+        int error = 0;
+        int64_t seeked = avio_seek(connection, offset, SEEK_SET);
+        if (seeked < 0) {
+            error = (int)seeked;
+        }
+        while (!error && filled < wanted) {
+            int ret = avio_read(connection, slot.data.data() + filled, wanted - filled);
+            if (ret == AVERROR_EOF || ret == 0) {
+                break;
+            }
+            if (ret < 0) {
+                error = ret;
+            } else {
+                filled += ret;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot.state = error ? SlotFailed : SlotReady;
+            slot.size = error ? error : filled;
+            slot.lastUse = ++useCounter;
+        }
+        readCondition.notify_all();
+    }
+
+    avio_closep(&connection);
+}
+
+int ReadAhead::Read(uint8_t* buffer, int wanted)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (position >= size) {
+        return AVERROR_EOF;
+    }
+
+    int64_t block = position / READ_AHEAD_BLOCK_SIZE;
+    int s = -1;
+    readCondition.wait(lock, [&] {
+        s = FindSlot(block);
+        return s >= 0 && slots[s].state != SlotFetching;
+    });
+
+    Slot& slot = slots[s];
+    if (slot.state == SlotFailed) {
+        // Fetched again on the next read
+        int error = slot.size;
+        slot.state = SlotEmpty;
+        lock.unlock();
+        fetchCondition.notify_all();
+        return error;
+    }
+
+    int offset = (int)(position - block * READ_AHEAD_BLOCK_SIZE);
+    int available = slot.size - offset;
+    if (available <= 0) {
+        return AVERROR_EOF;
+    }
+
+    int n = std::min(wanted, available);
+    memcpy(buffer, slot.data.data() + offset, n);
+    slot.lastUse = ++useCounter;
+    position += n;
+
+    // The window moved, when the read crossed into the next block
+    bool moved = position % READ_AHEAD_BLOCK_SIZE == 0;
+    lock.unlock();
+    if (moved) {
+        fetchCondition.notify_all();
+    }
+    return n;
+}
+
+int64_t ReadAhead::Seek(int64_t offset, int whence)
+{
+    whence &= ~AVSEEK_FORCE;
+    if (whence == AVSEEK_SIZE) {
+        return size;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    int64_t target;
+    if (whence == SEEK_SET) {
+        target = offset;
+    } else if (whence == SEEK_CUR) {
+        target = position + offset;
+    } else if (whence == SEEK_END) {
+        target = size + offset;
+    } else {
+        return AVERROR(EINVAL);
+    }
+
+    if (target < 0) {
+        return AVERROR(EINVAL);
+    }
+    position = target;
+    lock.unlock();
+    fetchCondition.notify_all();
+    return target;
+}
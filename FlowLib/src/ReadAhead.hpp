@@ -0,0 +1,67 @@
+#pragma once
+
+// Read-ahead for network sources, handed to libavformat as a custom AVIOContext
+//
+// The source is split into READ_AHEAD_BLOCK_SIZE blocks, READ_AHEAD_CONNECTIONS threads fetch the missing blocks
+// after the read position with range requests of their own, at most the size of the buffer ahead.
+// A seek only moves the window, blocks outside it are kept until their slot is needed again.
+
+#include "SourceIO.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define READ_AHEAD_BLOCK_SIZE (1 << 20)
+#define READ_AHEAD_CONNECTIONS 4
+
+class ReadAhead : public SourceIO
+{
+public:
+    // Returns nullptr when the source has no known size or can't seek, it is then read directly
+    static ReadAhead* Open(const char* url, int bufferMb);
+    ~ReadAhead();
+
+    int Read(uint8_t* buffer, int size);
+    int64_t Seek(int64_t offset, int whence);
+
+private:
+    ReadAhead(const char* url, int numSlots);
+    AVIOContext* Connect();
+    void Start(AVIOContext* connection);
+
+    enum SlotState { SlotEmpty, SlotFetching, SlotReady, SlotFailed };
+
+    struct Slot {
+        int64_t block = -1;
+        SlotState state = SlotEmpty;
+        int size = 0; // Bytes, or the error when failed
+        uint64_t lastUse = 0;
+        std::vector<uint8_t> data;
+    };
+
+    void Fetch(AVIOContext* connection);
+    // The first block of the window that isn't buffered and a slot to fetch it into
+    bool NextFetch(int64_t& block, int& slot);
+    int FindSlot(int64_t block);
+
+    static int InterruptCallback(void* opaque);
+
+    std::string url;
+    int64_t size = 0;
+    int64_t numBlocks = 0;
+    int64_t windowBlocks = 0;
+
+    int64_t position = 0;
+    uint64_t useCounter = 0;
+    std::vector<Slot> slots;
+    std::mutex mutex;
+    std::condition_variable fetchCondition;
+    std::condition_variable readCondition;
+    std::atomic<bool> stopping = { false };
+    std::vector<std::thread> fetchers;
+};
@@ -2,20 +2,40 @@
 
 extern "C" {
 #include <libavformat/avformat.h>
+
+#include "FlowLib.h"
 }
 
+#include "StreamCache.hpp"
+#include "ReadAhead.hpp"
+#include "SourceIO.hpp"
+#include "PacketIndex.hpp"
+
 #include <map>
+#include <memory>
 #include <cmath>
 #include <string>
+#include <stdexcept>
+#include <cstring>
+
+// Fast open reads at most this much of the source and this many microseconds of it to find the stream parameters
+#define FAST_OPEN_PROBESIZE (512 * 1024)
+#define FAST_OPEN_ANALYZE_US 1000000
 
 struct StreamProgram {
     AVStream* videoStream = nullptr;
     AVStream* audioStream = nullptr;
     AVStream* dataStream = nullptr;
     int64_t bitRate = 0;
+    // Exact frame numbers when the packets were indexed, see IndexPackets()
+    std::shared_ptr<PacketIndex> index;
 
     int64_t GetLengthFrames()
     {
+        if (index) {
+            return index->NumFrames();
+        }
+
         int64_t frames = videoStream->nb_frames;
 
         if (frames == 0) {
@@ -44,9 +64,35 @@ struct StreamProgram {
         int64_t duration = infoStream->duration * av_q2d(infoStream->time_base) * 1000;
         return duration;
     }
+
+    int64_t GetStartPts()
+    {
+        if (videoStream->start_time == AV_NOPTS_VALUE) {
+            return 0;
+        }
+        return videoStream->start_time;
+    }
+
+    // Maps a video pts onto a frame number, assuming a constant frame rate without an index
+    int64_t PtsToFrame(int64_t pts)
+    {
+        if (index) {
+            return index->PtsToFrame(pts);
+        }
+        return av_rescale_q(pts - GetStartPts(), videoStream->time_base, av_inv_q(videoStream->avg_frame_rate));
+    }
+
+    int64_t FrameToPts(int64_t frame)
+    {
+        if (index) {
+            return index->FrameToPts(frame);
+        }
+        return GetStartPts() + av_rescale_q(frame, av_inv_q(videoStream->avg_frame_rate), videoStream->time_base);
+    }
 };
 
-StreamProgram GetStreamProgram(AVFormatContext* fmt_ctx)
+// Picks a program by the FlowRenditionPolicy of properties, the highest bitrate without height information
+StreamProgram GetStreamProgram(AVFormatContext* fmt_ctx, const FlowProperties& properties)
 {
     std::map<int, StreamProgram> programMap;
     int64_t maxBitRate = 0;
@@ -82,5 +128,180 @@ StreamProgram GetStreamProgram(AVFormatContext* fmt_ctx)
         }
     }
 
-    return programMap[maxBitRate];
-}
\ No newline at end of file
+    // Programs come in bitrate order, equal heights go to the lower bitrate for AtLeast and the higher one for MaxHeight
+    int targetHeight = properties.renditionHeight;
+    StreamProgram* chosen = nullptr;
+    for (auto& entry : programMap) {
+        StreamProgram& program = entry.second;
+        int height = program.videoStream ? program.videoStream->codecpar->height : 0;
+        if (height <= 0) {
+            continue;
+        }
+        int chosenHeight = chosen ? chosen->videoStream->codecpar->height : 0;
+
+        if (properties.renditionPolicy == FlowRenditionAtLeast) {
+            // The lowest at or above the target, otherwise the highest below it
+            bool above = height >= targetHeight;
+            bool chosenAbove = chosenHeight >= targetHeight;
+            if (!chosen || (above && (!chosenAbove || height < chosenHeight)) || (!above && !chosenAbove && height > chosenHeight)) {
+                chosen = &program;
+            }
+        }
+        else if (properties.renditionPolicy == FlowRenditionMaxHeight) {
+            // The highest at or below the limit, otherwise the lowest
+            bool below = height <= targetHeight;
+            bool chosenBelow = chosenHeight <= targetHeight;
+            if (!chosen || (below && (!chosenBelow || height >= chosenHeight)) || (!below && !chosenBelow && height < chosenHeight)) {
+                chosen = &program;
+            }
+        }
+    }
+
+    if (chosen == nullptr) {
+        return programMap[maxBitRate];
+    }
+    return *chosen;
+}
+
+// Enough to open the decoders without avformat_find_stream_info
+inline bool HasStreamParameters(AVStream* stream)
+{
+    AVCodecParameters* par = stream->codecpar;
+    return par->codec_id != AV_CODEC_ID_NONE && par->width > 0 && par->height > 0 && par->format >= 0
+        && stream->avg_frame_rate.num > 0 && stream->avg_frame_rate.den > 0;
+}
+
+// Opens a source with its streams probed, close it with CloseFormatContext
+// fastOpen bounds the probing, reuses the cached parameters of the source and only waits for the chosen program
+// readAheadMb reads network sources through a ReadAhead, mappedIO maps local files into memory
+AVFormatContext* OpenFormatContext(const char* url, const FlowProperties& properties)
+{
+    avformat_network_init();
+    bool fastOpen = properties.fastOpen;
+
+    AVFormatContext* fmt_ctx = avformat_alloc_context();
+    if (!fmt_ctx) {
+        throw std::runtime_error("Could not allocate format context");
+    }
+
+    SourceIO* source = NULL;
+    int bufferSize = 0;
+    bool local = !strstr(url, "://") || strncmp(url, "file:", 5) == 0;
+    if (properties.readAheadMb > 0 && !local) {
+        source = ReadAhead::Open(url, properties.readAheadMb);
+        bufferSize = 64 * 1024;
+    }
+    if (properties.mappedIO && local) {
+        source = MappedFile::Open(url);
+        bufferSize = 256 * 1024;
+    }
+    if (source) {
+        fmt_ctx->pb = source->CreateContext(bufferSize);
+        if (!fmt_ctx->pb) {
+            delete source;
+            avformat_free_context(fmt_ctx);
+            throw std::runtime_error("Could not allocate io context");
+        }
+        fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    AVDictionary* options = NULL;
+    if (fastOpen) {
+        av_dict_set_int(&options, "probesize", FAST_OPEN_PROBESIZE, 0);
+        av_dict_set_int(&options, "analyzeduration", FAST_OPEN_ANALYZE_US, 0);
+    }
+
+    // A failed open frees the context but not custom io
+    AVIOContext* pb = fmt_ctx->pb;
+    int ret = avformat_open_input(&fmt_ctx, url, NULL, &options);
+    av_dict_free(&options);
+    if (ret < 0) {
+        if (source) {
+            delete source;
+            av_freep(&pb->buffer);
+            avio_context_free(&pb);
+        }
+        char error[AV_ERROR_MAX_STRING_SIZE];
+        throw std::runtime_error(std::string("Could not open source file: ") + av_make_error_string(error, sizeof(error), ret));
+    }
+
+    if (!fastOpen) {
+        if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
+            CloseFormatContext(&fmt_ctx);
+            throw std::runtime_error("Could not find stream information");
+        }
+        av_dump_format(fmt_ctx, 0, url, 0);
+        return fmt_ctx;
+    }
+
+    if (LoadStreamCache(url, fmt_ctx)) {
+        return fmt_ctx;
+    }
+
+    // Streams outside the chosen program are not waited for, HLS doesn't even fetch their playlists
+    StreamProgram program = GetStreamProgram(fmt_ctx, properties);
+    if (program.videoStream == nullptr || !HasStreamParameters(program.videoStream)) {
+        if (program.videoStream != nullptr) {
+            for (unsigned int i = 0; i < fmt_ctx->nb_streams; i++) {
+                AVStream* stream = fmt_ctx->streams[i];
+                if (stream != program.videoStream && stream != program.audioStream && stream != program.dataStream) {
+                    stream->discard = AVDISCARD_ALL;
+                }
+            }
+        }
+
+        if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
+            CloseFormatContext(&fmt_ctx);
+            throw std::runtime_error("Could not find stream information");
+        }
+    }
+
+    SaveStreamCache(url, fmt_ctx);
+    return fmt_ctx;
+}
+
+// Packets of the other streams are never read or allocated, the demuxers skip them
+void DiscardUnusedStreams(AVFormatContext* fmt_ctx, const StreamProgram& program)
+{
+    for (unsigned int i = 0; i < fmt_ctx->nb_streams; i++) {
+        if (fmt_ctx->streams[i] != program.videoStream) {
+            fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+}
+
+// Indexes the video packets of a local file, or loads its cached index, after DiscardUnusedStreams
+// Network sources would be downloaded in full, they keep the frame counts of the container
+void IndexPackets(AVFormatContext* fmt_ctx, StreamProgram& program, const FlowProperties& properties)
+{
+    const char* url = fmt_ctx->url;
+    bool local = url && (!strstr(url, "://") || strncmp(url, "file:", 5) == 0);
+    if (!properties.packetIndex || properties.liveWindow > 0 || !local || program.videoStream == nullptr) {
+        return;
+    }
+
+    std::shared_ptr<PacketIndex> index = std::make_shared<PacketIndex>();
+    if (LoadPacketIndex(url, program.videoStream, *index)) {
+        program.index = index;
+        return;
+    }
+    if (BuildPacketIndex(fmt_ctx, program.videoStream, *index)) {
+        SavePacketIndex(url, program.videoStream, *index);
+        program.index = index;
+    }
+}
+
+// Seeks so the next packets decode frame and what follows, from the keyframe at or before it
+// With an index that is the exact keyframe, located by byte where the timestamps of the container aren't reliable
+int SeekToFrame(AVFormatContext* fmt_ctx, StreamProgram& program, int64_t frame)
+{
+    if (program.index) {
+        const IndexedPacket& keyframe = program.index->packets[std::min(program.index->KeyframeBefore(frame), program.index->NumFrames() - 1)];
+        bool byteSeek = (fmt_ctx->iformat->flags & AVFMT_TS_DISCONT) && !(fmt_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK);
+        if (byteSeek && keyframe.pos >= 0 && av_seek_frame(fmt_ctx, program.videoStream->index, keyframe.pos, AVSEEK_FLAG_BYTE) >= 0) {
+            return 0;
+        }
+        return av_seek_frame(fmt_ctx, program.videoStream->index, keyframe.pts, AVSEEK_FLAG_BACKWARD);
+    }
+    return av_seek_frame(fmt_ctx, program.videoStream->index, program.FrameToPts(frame), AVSEEK_FLAG_BACKWARD);
+}
@@ -0,0 +1,191 @@
+#include "SourceIO.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+// Chunks the kernel is asked to read ahead of the demuxer
+#define MAPPED_PREFETCH_SIZE (16 << 20)
+
+static int SourceRead(void* opaque, uint8_t* buffer, int size)
+{
+    return ((SourceIO*)opaque)->Read(buffer, size);
+}
+
+static int64_t SourceSeek(void* opaque, int64_t offset, int whence)
+{
+    return ((SourceIO*)opaque)->Seek(offset, whence);
+}
+
+AVIOContext* SourceIO::CreateContext(int bufferSize)
+{
+    uint8_t* buffer = (uint8_t*)av_malloc(bufferSize);
+    if (!buffer) {
+        return NULL;
+    }
+
+    AVIOContext* context = avio_alloc_context(buffer, bufferSize, 0, this, &SourceRead, NULL, &SourceSeek);
+    if (!context) {
+        av_free(buffer);
+        return NULL;
+    }
+    context->seekable = AVIO_SEEKABLE_NORMAL;
+    return context;
+}
+
+void CloseFormatContext(AVFormatContext** fmt_ctx)
+{
+    if (*fmt_ctx == NULL) {
+        return;
+    }
+
+    AVIOContext* pb = ((*fmt_ctx)->flags & AVFMT_FLAG_CUSTOM_IO) ? (*fmt_ctx)->pb : NULL;
+    avformat_close_input(fmt_ctx);
+
+    if (pb) {
+        delete (SourceIO*)pb->opaque;
+        av_freep(&pb->buffer);
+        avio_context_free(&pb);
+    }
+}
+
+// -- MappedFile --
+
+MappedFile* MappedFile::Open(const char* path)
+{
+    if (strncmp(path, "file:", 5) == 0) {
+        path += 5;
+    }
+
+    MappedFile* file = new MappedFile();
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER size;
+    if (handle == INVALID_HANDLE_VALUE) {
+        delete file;
+        return nullptr;
+    }
+    file->file = handle;
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+        delete file;
+        return nullptr;
+    }
+    file->size = size.QuadPart;
+    file->mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    file->data = file->mapping ? (const uint8_t*)MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!file->data) {
+        delete file;
+        return nullptr;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0) {
+        delete file;
+        return nullptr;
+    }
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+        close(fd);
+        delete file;
+        return nullptr;
+    }
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file open
+    close(fd);
+    if (data == MAP_FAILED) {
+        delete file;
+        return nullptr;
+    }
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+    file->data = (const uint8_t*)data;
+    file->size = info.st_size;
+#endif
+
+    file->Prefetch();
+    return file;
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    if (file) {
+        CloseHandle(file);
+    }
+#else
+    if (data) {
+        munmap((void*)data, size);
+    }
+#endif
+}
+
+void MappedFile::Prefetch()
+{
+    // A seek starts the read-ahead over at the new position
+    if (position > prefetched || position + 2 * MAPPED_PREFETCH_SIZE < prefetched) {
+        prefetched = position & ~(int64_t)(MAPPED_PREFETCH_SIZE - 1);
+    }
+
+    // Keeps a chunk requested past the read position
+    while (prefetched < size && prefetched < position + MAPPED_PREFETCH_SIZE) {
+        int64_t length = std::min<int64_t>(MAPPED_PREFETCH_SIZE, size - prefetched);
+#ifdef _WIN32
+        WIN32_MEMORY_RANGE_ENTRY range = { (void*)(data + prefetched), (SIZE_T)length };
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+        madvise((void*)(data + prefetched), length, MADV_WILLNEED);
+#endif
+        prefetched += length;
+    }
+}
+
+int MappedFile::Read(uint8_t* buffer, int wanted)
+{
+    if (position >= size) {
+        return AVERROR_EOF;
+    }
+
+    int n = (int)std::min<int64_t>(wanted, size - position);
+    memcpy(buffer, data + position, n);
+    position += n;
+    Prefetch();
+    return n;
+}
+
+int64_t MappedFile::Seek(int64_t offset, int whence)
+{
+    whence &= ~AVSEEK_FORCE;
+    int64_t target;
+    if (whence == AVSEEK_SIZE) {
+        return size;
+    } else if (whence == SEEK_SET) {
+        target = offset;
+    } else if (whence == SEEK_CUR) {
+        target = position + offset;
+    } else if (whence == SEEK_END) {
+        target = size + offset;
+    } else {
+        return AVERROR(EINVAL);
+    }
+
+    if (target < 0) {
+        return AVERROR(EINVAL);
+    }
+    position = target;
+    Prefetch();
+    return target;
+}
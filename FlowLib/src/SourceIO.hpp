@@ -0,0 +1,50 @@
+#pragma once
+
+// Sources read through a custom AVIOContext instead of the libavformat protocols
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include <cstdint>
+
+class SourceIO
+{
+public:
+    virtual ~SourceIO() = default;
+
+    // AVIOContext callbacks
+    virtual int Read(uint8_t* buffer, int size) = 0;
+    virtual int64_t Seek(int64_t offset, int whence) = 0;
+
+    // An AVIOContext that owns this, for a format context opened with AVFMT_FLAG_CUSTOM_IO
+    AVIOContext* CreateContext(int bufferSize);
+};
+
+// A local file mapped into memory, read ahead by the kernel in large aligned chunks
+class MappedFile : public SourceIO
+{
+public:
+    // Returns nullptr when the file can't be mapped, it is then read through the file protocol
+    static MappedFile* Open(const char* path);
+    ~MappedFile();
+
+    int Read(uint8_t* buffer, int size);
+    int64_t Seek(int64_t offset, int whence);
+
+private:
+    MappedFile() = default;
+    void Prefetch();
+
+    const uint8_t* data = nullptr;
+    int64_t size = 0;
+    int64_t position = 0;
+    int64_t prefetched = 0; // The kernel was asked for everything below
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+// Closes the format context and the custom io it reads through
+void CloseFormatContext(AVFormatContext** fmt_ctx);
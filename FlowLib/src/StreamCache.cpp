@@ -0,0 +1,257 @@
+#include "StreamCache.hpp"
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define STREAM_CACHE_MAGIC 0x43535a4a // "JZSC"
+#define STREAM_CACHE_VERSION 1
+
+struct CachedStream {
+    int32_t codecType;
+    int32_t codecId;
+    uint32_t codecTag;
+    int32_t format;
+    int32_t width;
+    int32_t height;
+    int32_t profile;
+    int32_t level;
+    int64_t bitRate;
+    int32_t videoDelay;
+    int32_t fieldOrder;
+    int32_t colorRange;
+    int32_t colorPrimaries;
+    int32_t colorTrc;
+    int32_t colorSpace;
+    int32_t chromaLocation;
+    AVRational sampleAspectRatio;
+    AVRational timeBase;
+    AVRational avgFrameRate;
+    AVRational rFrameRate;
+    int64_t startTime;
+    int64_t duration;
+    int64_t nbFrames;
+    uint32_t extradataSize;
+};
+
+static void MakeDirectory(const std::string& path)
+{
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+std::string StreamCacheDirectory()
+{
+    const char* dir = getenv("JTFLOW_STREAM_CACHE");
+    if(dir && *dir) {
+        MakeDirectory(dir);
+        return dir;
+    }
+
+#ifdef _WIN32
+    const char* base = getenv("LOCALAPPDATA");
+    if(!base) {
+        return "";
+    }
+    std::string path = std::string(base) + "\\jtflow";
+#else
+    std::string path;
+    if(getenv("XDG_CACHE_HOME")) {
+        path = getenv("XDG_CACHE_HOME");
+    } else if(getenv("HOME")) {
+        path = std::string(getenv("HOME")) + "/.cache";
+        MakeDirectory(path);
+    } else {
+        return "";
+    }
+    path += "/jtflow";
+#endif
+    MakeDirectory(path);
+    return path;
+}
+
+// Sources that change in place get a new key
+static std::string CacheKey(const char* url)
+{
+    std::string key = url;
+    struct stat info;
+    if(!strstr(url, "://") && stat(url, &info) == 0) {
+        key += "|" + std::to_string((long long)info.st_size) + "|" + std::to_string((long long)info.st_mtime);
+    }
+    return key;
+}
+
+static std::string SlotPath(const std::string& key)
+{
+    std::string dir = StreamCacheDirectory();
+    if(dir.empty()) {
+        return "";
+    }
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for(char c : key) {
+        hash = (hash ^ (uint8_t)c) * 1099511628211ull;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "/streams-%02x.bin", (unsigned)(hash % STREAM_CACHE_SLOTS));
+    return dir + name;
+}
+
+bool LoadStreamCache(const char* url, AVFormatContext* fmt_ctx)
+{
+    std::string key = CacheKey(url);
+    std::string path = SlotPath(key);
+    FILE* file = path.empty() ? nullptr : fopen(path.c_str(), "rb");
+    if(!file) {
+        return false;
+    }
+
+    uint32_t header[4];
+    std::string cachedKey;
+    std::vector<CachedStream> streams;
+    std::vector<std::vector<uint8_t>> extradata;
+    bool valid = fread(header, sizeof(header), 1, file) == 1
+        && header[0] == STREAM_CACHE_MAGIC && header[1] == STREAM_CACHE_VERSION
+        && header[2] == key.size() && header[3] == fmt_ctx->nb_streams;
+    if(valid) {
+        cachedKey.resize(header[2]);
+        valid = fread(&cachedKey[0], 1, cachedKey.size(), file) == cachedKey.size() && cachedKey == key;
+    }
+    for(uint32_t i=0; valid && i<header[3]; i++) {
+        CachedStream stream;
+        valid = fread(&stream, sizeof(stream), 1, file) == 1 && stream.extradataSize < (1 << 24);
+        if(valid) {
+            std::vector<uint8_t> data(stream.extradataSize);
+            valid = fread(data.data(), 1, data.size(), file) == data.size();
+            streams.push_back(stream);
+            extradata.push_back(std::move(data));
+        }
+    }
+    fclose(file);
+
+    // The demuxer has to agree on the layout, otherwise the source changed
+    for(size_t i=0; valid && i<streams.size(); i++) {
+        AVCodecParameters* par = fmt_ctx->streams[i]->codecpar;
+        valid = streams[i].codecId == AV_CODEC_ID_NONE || ((par->codec_type == AVMEDIA_TYPE_UNKNOWN || par->codec_type == streams[i].codecType)
+            && (par->codec_id == AV_CODEC_ID_NONE || par->codec_id == streams[i].codecId));
+    }
+    if(!valid) {
+        return false;
+    }
+
+    // Streams that were discarded while probing stay as the demuxer opened them
+    for(size_t i=0; i<streams.size(); i++) {
+        const CachedStream& cached = streams[i];
+        AVStream* stream = fmt_ctx->streams[i];
+        AVCodecParameters* par = stream->codecpar;
+        if(cached.codecId == AV_CODEC_ID_NONE) {
+            continue;
+        }
+
+        par->codec_type = (AVMediaType)cached.codecType;
+        par->codec_id = (AVCodecID)cached.codecId;
+        par->codec_tag = cached.codecTag;
+        par->format = cached.format;
+        par->width = cached.width;
+        par->height = cached.height;
+        par->profile = cached.profile;
+        par->level = cached.level;
+        par->bit_rate = cached.bitRate;
+        par->video_delay = cached.videoDelay;
+        par->field_order = (AVFieldOrder)cached.fieldOrder;
+        par->color_range = (AVColorRange)cached.colorRange;
+        par->color_primaries = (AVColorPrimaries)cached.colorPrimaries;
+        par->color_trc = (AVColorTransferCharacteristic)cached.colorTrc;
+        par->color_space = (AVColorSpace)cached.colorSpace;
+        par->chroma_location = (AVChromaLocation)cached.chromaLocation;
+        par->sample_aspect_ratio = cached.sampleAspectRatio;
+        stream->time_base = cached.timeBase;
+        stream->avg_frame_rate = cached.avgFrameRate;
+        stream->r_frame_rate = cached.rFrameRate;
+        stream->start_time = cached.startTime;
+        stream->duration = cached.duration;
+        stream->nb_frames = cached.nbFrames;
+
+        if(par->extradata_size == 0 && !extradata[i].empty()) {
+            par->extradata = (uint8_t*)av_mallocz(extradata[i].size() + AV_INPUT_BUFFER_PADDING_SIZE);
+            if(par->extradata) {
+                memcpy(par->extradata, extradata[i].data(), extradata[i].size());
+                par->extradata_size = (int)extradata[i].size();
+            }
+        }
+    }
+    return true;
+}
+
+void SaveStreamCache(const char* url, AVFormatContext* fmt_ctx)
+{
+    std::string key = CacheKey(url);
+    std::string path = SlotPath(key);
+    if(path.empty()) {
+        return;
+    }
+
+    // Written next to the slot and renamed, concurrent readers never see half a file
+    std::string tempPath = path + "." + std::to_string((long long)(uintptr_t)fmt_ctx) + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if(!file) {
+        return;
+    }
+
+    uint32_t header[4] = { STREAM_CACHE_MAGIC, STREAM_CACHE_VERSION, (uint32_t)key.size(), fmt_ctx->nb_streams };
+    bool written = fwrite(header, sizeof(header), 1, file) == 1 && fwrite(key.data(), 1, key.size(), file) == key.size();
+    for(unsigned int i=0; written && i<fmt_ctx->nb_streams; i++) {
+        AVStream* stream = fmt_ctx->streams[i];
+        AVCodecParameters* par = stream->codecpar;
+
+        CachedStream cached = {};
+        cached.codecType = par->codec_type;
+        cached.codecId = par->codec_id;
+        cached.codecTag = par->codec_tag;
+        cached.format = par->format;
+        cached.width = par->width;
+        cached.height = par->height;
+        cached.profile = par->profile;
+        cached.level = par->level;
+        cached.bitRate = par->bit_rate;
+        cached.videoDelay = par->video_delay;
+        cached.fieldOrder = par->field_order;
+        cached.colorRange = par->color_range;
+        cached.colorPrimaries = par->color_primaries;
+        cached.colorTrc = par->color_trc;
+        cached.colorSpace = par->color_space;
+        cached.chromaLocation = par->chroma_location;
+        cached.sampleAspectRatio = par->sample_aspect_ratio;
+        cached.timeBase = stream->time_base;
+        cached.avgFrameRate = stream->avg_frame_rate;
+        cached.rFrameRate = stream->r_frame_rate;
+        cached.startTime = stream->start_time;
+        cached.duration = stream->duration;
+        cached.nbFrames = stream->nb_frames;
+        cached.extradataSize = par->extradata_size;
+
+        written = fwrite(&cached, sizeof(cached), 1, file) == 1
+            && fwrite(par->extradata, 1, par->extradata_size, file) == (size_t)par->extradata_size;
+    }
+    written = fclose(file) == 0 && written;
+
+#ifdef _WIN32
+    remove(path.c_str());
+#endif
+    if(!written || rename(tempPath.c_str(), path.c_str()) != 0) {
+        remove(tempPath.c_str());
+    }
+}
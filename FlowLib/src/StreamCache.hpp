@@ -0,0 +1,23 @@
+#pragma once
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include <string>
+
+// Stream parameters per source, so a fast open can skip avformat_find_stream_info on a reopen
+//
+// One file per slot in the cache directory (JTFLOW_STREAM_CACHE, otherwise the user cache directory),
+// STREAM_CACHE_SLOTS slots keyed by a hash of the source. A colliding source overwrites the slot.
+// Local files are keyed by path, size and modification time, URLs by the URL alone.
+
+#define STREAM_CACHE_SLOTS 256
+
+// The cache directory, created when missing, empty when there is none
+std::string StreamCacheDirectory();
+
+// Applies the cached parameters to the streams of an opened context, false when there are none or they don't fit
+bool LoadStreamCache(const char* url, AVFormatContext* fmt_ctx);
+// Best effort, failures leave the cache as it was
+void SaveStreamCache(const char* url, AVFormatContext* fmt_ctx);
@@ -0,0 +1,351 @@
+#include "WaveModel.hpp"
+
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+
+// np.roll(image, shift, axis=1)
+static cv::Mat RollColumns(const cv::Mat& image, int shift)
+{
+    int cols = image.cols;
+    shift = ((shift % cols) + cols) % cols;
+    if(shift == 0) {
+        return image.clone();
+    }
+
+    cv::Mat rolled(image.size(), image.type());
+    image.colRange(0, cols - shift).copyTo(rolled.colRange(shift, cols));
+    image.colRange(cols - shift, cols).copyTo(rolled.colRange(0, shift));
+    return rolled;
+}
+
+static cv::Mat Ones(int rows, int cols)
+{
+    return cv::Mat::ones(rows, cols, CV_8UC1);
+}
+
+static const float WAVE_TRUNCATE = (int)(1280 * 720 * 0.01);
+
+// astype(np.uint8) truncates where convertTo would round
+static cv::Mat TruncateToUchar(const cv::Mat& image)
+{
+    cv::Mat output(image.size(), CV_8UC1);
+    for(int r=0; r<image.rows; r++) {
+        const float* src = image.ptr<float>(r);
+        uchar* dst = output.ptr<uchar>(r);
+        for(int c=0; c<image.cols; c++) {
+            dst[c] = (uchar)src[c];
+        }
+    }
+    return output;
+}
+
+cv::Mat WaveNormalize(const cv::Mat& input)
+{
+    cv::Mat image;
+    input.convertTo(image, CV_32F);
+    cv::threshold(image, image, WAVE_TRUNCATE, WAVE_TRUNCATE, cv::THRESH_TRUNC);
+    cv::normalize(image, image, 0, 255, cv::NORM_MINMAX);
+    return TruncateToUchar(image);
+}
+
+cv::Mat WaveNormalize(const cv::Mat& input, float minValue, float maxValue)
+{
+    // An extra row holding the extremes makes cv::normalize pick the same scale as for the whole matrix
+    cv::Mat image(input.rows + 1, input.cols, CV_32FC1, cv::Scalar(minValue));
+    image.at<float>(input.rows, input.cols - 1) = maxValue;
+
+    cv::Mat rows = image.rowRange(0, input.rows);
+    input.convertTo(rows, CV_32F);
+    cv::threshold(image, image, WAVE_TRUNCATE, WAVE_TRUNCATE, cv::THRESH_TRUNC);
+    cv::normalize(image, image, 0, 255, cv::NORM_MINMAX);
+    return TruncateToUchar(image.rowRange(0, input.rows));
+}
+
+cv::Mat WaveStage1(const cv::Mat& image)
+{
+    cv::Mat rotated;
+    cv::rotate(image, rotated, cv::ROTATE_90_COUNTERCLOCKWISE);
+    cv::medianBlur(rotated, rotated, 3);
+    return rotated;
+}
+
+static cv::Mat PreFilter(const cv::Mat& frame)
+{
+    cv::Mat filtered;
+    cv::dilate(frame, filtered, Ones(2, 2));
+    cv::morphologyEx(filtered, filtered, cv::MORPH_CLOSE, Ones(8, 2), cv::Point(-1, -1), 2);
+    cv::dilate(filtered, filtered, Ones(2, 2));
+    return RollColumns(filtered, -4);
+}
+
+void WaveStage2(const cv::Mat& image, cv::Mat out[2])
+{
+    cv::Mat binary;
+    cv::threshold(image, binary, 15, 255, cv::THRESH_BINARY);
+
+    // Upper and lower half of the angles, moving in opposite directions over time
+    int half = binary.rows / 2;
+    cv::Mat upper = binary.rowRange(0, half);
+    cv::Mat lower = binary.rowRange(half, half * 2);
+
+    cv::Mat im2, im3;
+    cv::min(RollColumns(upper, -2), RollColumns(lower, 2), im2);
+    cv::min(RollColumns(upper, 2), RollColumns(lower, -2), im3);
+
+    cv::Mat im2d, im3d;
+    cv::subtract(im2, im3, im2d);
+    cv::subtract(im3, im2, im3d);
+
+    out[0] = PreFilter(im2d);
+    out[1] = PreFilter(im3d);
+}
+
+static cv::Mat ProcessPart(const cv::Mat& frame1, const cv::Mat& frame2)
+{
+    cv::Mat mask;
+    cv::threshold(frame1, mask, 70, 255, cv::THRESH_BINARY);
+    cv::dilate(mask, mask, Ones(4, 4));
+    cv::morphologyEx(mask, mask, cv::MORPH_CLOSE, Ones(3, 8), cv::Point(-1, -1), 4);
+
+    cv::Mat masked = cv::Mat::zeros(frame2.size(), frame2.type());
+    frame2.copyTo(masked, mask);
+    cv::threshold(masked, masked, 5, 255, cv::THRESH_BINARY);
+    cv::dilate(masked, masked, Ones(4, 2));
+    cv::medianBlur(masked, masked, 3);
+    return masked;
+}
+
+void WaveStage3(const cv::Mat image[2], cv::Mat out[2])
+{
+    out[0] = ProcessPart(image[0], image[1]);
+    out[1] = ProcessPart(image[1], image[0]);
+}
+
+std::vector<double> WaveStage4(const cv::Mat image[2])
+{
+    cv::Mat scores1, scores2;
+    cv::reduce(image[0], scores1, 0, cv::REDUCE_SUM, CV_64F);
+    cv::reduce(image[1], scores2, 0, cv::REDUCE_SUM, CV_64F);
+
+    std::vector<double> scores(scores1.cols);
+    for(int c=0; c<scores1.cols; c++) {
+        scores[c] = (scores1.at<double>(0, c) - scores2.at<double>(0, c)) / (255 * 2);
+    }
+    return scores;
+}
+
+std::vector<WaveBeat> WaveStage5(const std::vector<double>& scores)
+{
+    return ScoresToBeats(scores);
+}
+
+std::vector<int> FindPeaks(const std::vector<double>& x, double height, int distance)
+{
+    // Local maxima, plateaus count once at their middle
+    std::vector<int> peaks;
+    int n = (int)x.size();
+    int i = 1;
+    while(i < n - 1) {
+        if(x[i - 1] < x[i]) {
+            int ahead = i + 1;
+            while(ahead < n - 1 && x[ahead] == x[i]) {
+                ahead++;
+            }
+            if(x[ahead] < x[i]) {
+                if(x[i] >= height) {
+                    peaks.push_back((i + ahead - 1) / 2);
+                }
+                i = ahead;
+            }
+        }
+        i++;
+    }
+
+    // Highest peaks first, each one removes its lower neighbours within the distance
+    std::vector<int> order(peaks.size());
+    for(size_t p=0; p<order.size(); p++) {
+        order[p] = (int)p;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return x[peaks[a]] < x[peaks[b]];
+    });
+
+    std::vector<bool> keep(peaks.size(), true);
+    for(auto it = order.rbegin(); it != order.rend(); it++) {
+        int j = *it;
+        if(!keep[j]) {
+            continue;
+        }
+        for(int k = j - 1; k >= 0 && peaks[j] - peaks[k] < distance; k--) {
+            keep[k] = false;
+        }
+        for(int k = j + 1; k < (int)peaks.size() && peaks[k] - peaks[j] < distance; k++) {
+            keep[k] = false;
+        }
+    }
+
+    std::vector<int> kept;
+    for(size_t p=0; p<peaks.size(); p++) {
+        if(keep[p]) {
+            kept.push_back(peaks[p]);
+        }
+    }
+    return kept;
+}
+
+std::vector<WaveBeat> FindBeats(const std::vector<double>& scores)
+{
+    std::vector<double> inverted(scores.size());
+    for(size_t i=0; i<scores.size(); i++) {
+        inverted[i] = -scores[i];
+    }
+
+    // A frame can't be both a peak and a valley, so merging the sorted lists keeps the order
+    std::vector<WaveBeat> beats;
+    for(int p : FindPeaks(scores, 0, 6)) {
+        beats.push_back({ p, scores[p], 1 });
+    }
+    for(int p : FindPeaks(inverted, 0, 6)) {
+        beats.push_back({ p, scores[p], -1 });
+    }
+    std::stable_sort(beats.begin(), beats.end(), [](const WaveBeat& a, const WaveBeat& b) {
+        return a.frame < b.frame;
+    });
+    return beats;
+}
+
+std::vector<WaveBeat> ScoresToBeats(const std::vector<double>& scores)
+{
+    return FixBeatGroups(FindBeats(scores), scores);
+}
+
+std::vector<WaveBeat> FixBeatGroups(const std::vector<WaveBeat>& beats, const std::vector<double>& scores)
+{
+    // Average out the peaks and valleys with multiple hits
+    std::vector<WaveBeat> fixed;
+    size_t start = 0;
+    while(start < beats.size()) {
+        size_t end = start + 1;
+        double sum = beats[start].frame;
+        while(end < beats.size() && beats[end].direction == beats[start].direction) {
+            sum += beats[end].frame;
+            end++;
+        }
+
+        int center = (int)(sum / (end - start));
+        fixed.push_back({ center, scores[center], beats[start].direction });
+        start = end;
+    }
+    return fixed;
+}
+
+cv::Mat WaveProcess(const cv::Mat& input)
+{
+    cv::Mat actions(0, 2, CV_32SC1);
+    if(input.rows < 2 || input.cols < 2) {
+        return actions;
+    }
+
+    cv::Mat image = WaveStage1(WaveNormalize(input));
+
+    cv::Mat parts[2], masked[2];
+    WaveStage2(image, parts);
+    WaveStage3(parts, masked);
+    std::vector<WaveBeat> beats = WaveStage5(WaveStage4(masked));
+
+    for(const WaveBeat& beat : beats) {
+        int row[2] = { beat.frame, beat.direction > 0 ? 90 : 10 };
+        actions.push_back(cv::Mat(1, 2, CV_32SC1, row));
+    }
+    return actions;
+}
+
+static std::vector<double> WaveScores(const cv::Mat& image)
+{
+    cv::Mat parts[2], masked[2];
+    WaveStage2(WaveStage1(image), parts);
+    WaveStage3(parts, masked);
+    return WaveStage4(masked);
+}
+
+cv::Mat WaveStream::Push(const cv::Mat& rows, cv::Mat& retracted)
+{
+    cv::Mat actions(0, 2, CV_32SC1);
+    retracted = cv::Mat(0, 2, CV_32SC1);
+    if(rows.empty()) {
+        return actions;
+    }
+
+    // A new extreme rescales every row, so all scores are computed again and the groups found again from the start
+    double rowsMin, rowsMax;
+    cv::minMaxLoc(rows, &rowsMin, &rowsMax);
+    float newMin = std::min((float)rowsMin, WAVE_TRUNCATE);
+    float newMax = std::min((float)rowsMax, WAVE_TRUNCATE);
+    if(input.empty() || newMin < minValue || newMax > maxValue) {
+        minValue = input.empty() ? newMin : std::min(minValue, newMin);
+        maxValue = input.empty() ? newMax : std::max(maxValue, newMax);
+        scores.clear();
+        tailFrom = 0;
+        settled = 0;
+    }
+    input.push_back(rows);
+
+    // Scores are final once the rows around them are in, the window starts early enough to hide its own edges
+    int stableEnd = input.rows - WAVE_MARGIN;
+    int scored = (int)scores.size();
+    if(stableEnd <= scored || input.rows < 2) {
+        return actions;
+    }
+
+    int from = std::max(0, scored - WAVE_MARGIN);
+    std::vector<double> windowScores = WaveScores(WaveNormalize(input.rowRange(from, input.rows), minValue, maxValue));
+    scores.insert(scores.end(), windowScores.begin() + (scored - from), windowScores.begin() + (stableEnd - from));
+
+    // Only the scores after the last settled group are searched, with a margin before them so the peak distance
+    // and the suppression between neighbouring peaks see the same scores as the batch search
+    int sliceFrom = std::max(0, tailFrom - WAVE_MARGIN);
+    std::vector<WaveBeat> beats;
+    for(const WaveBeat& beat : FindBeats(std::vector<double>(scores.begin() + sliceFrom, scores.end()))) {
+        if(beat.frame + sliceFrom >= tailFrom) {
+            beats.push_back({ beat.frame + sliceFrom, beat.score, beat.direction });
+        }
+    }
+
+    // A group is settled once the group after it starts before the peaks still to come can suppress it
+    int settledEnd = (int)scores.size() - WAVE_PEAK_LAG;
+    size_t start = 0;
+    while(start < beats.size()) {
+        size_t end = start + 1;
+        while(end < beats.size() && beats[end].direction == beats[start].direction) {
+            end++;
+        }
+        if(end == beats.size() || beats[end].frame >= settledEnd) {
+            break;
+        }
+
+        std::vector<WaveBeat> group(beats.begin() + start, beats.begin() + end);
+        Settle(FixBeatGroups(group, scores)[0], actions, retracted);
+        tailFrom = beats[end].frame;
+        start = end;
+    }
+    return actions;
+}
+
+void WaveStream::Settle(const WaveBeat& beat, cv::Mat& actions, cv::Mat& retracted)
+{
+    int row[2] = { beat.frame, beat.direction > 0 ? 90 : 10 };
+    if(settled < emitted.rows) {
+        if(emitted.at<int>(settled, 0) == row[0] && emitted.at<int>(settled, 1) == row[1]) {
+            settled++;
+            return;
+        }
+
+        // Everything from the first difference on goes, what follows is emitted again as it settles
+        retracted.push_back(emitted.rowRange(settled, emitted.rows).clone());
+        emitted = emitted.rowRange(0, settled).clone();
+    }
+
+    emitted.push_back(cv::Mat(1, 2, CV_32SC1, row));
+    actions.push_back(cv::Mat(1, 2, CV_32SC1, row));
+    settled++;
+}
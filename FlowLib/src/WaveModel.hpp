@@ -0,0 +1,64 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+// Native port of Model/jtmodel.py, every stage takes and returns the same data as its Python counterpart
+
+struct WaveBeat {
+    int frame;
+    double score;
+    int direction; // 1 for a peak, -1 for a valley
+};
+
+// Angle rows (CV_32S) to CV_8U, truncated at 1% of a 720p frame
+cv::Mat WaveNormalize(const cv::Mat& input);
+// Same, scaled as if the rows were part of a matrix with this (truncated) minimum and maximum
+cv::Mat WaveNormalize(const cv::Mat& input, float minValue, float maxValue);
+cv::Mat WaveStage1(const cv::Mat& image);
+void WaveStage2(const cv::Mat& image, cv::Mat out[2]);
+void WaveStage3(const cv::Mat image[2], cv::Mat out[2]);
+std::vector<double> WaveStage4(const cv::Mat image[2]);
+std::vector<WaveBeat> WaveStage5(const std::vector<double>& scores);
+
+// scipy.signal.find_peaks(x, height=height, distance=distance)
+// Peaks of equal height are kept in position order, scipy leaves that order to an unstable sort
+std::vector<int> FindPeaks(const std::vector<double>& x, double height, int distance);
+// Peaks and valleys of the scores in frame order, before FixBeatGroups
+std::vector<WaveBeat> FindBeats(const std::vector<double>& scores);
+std::vector<WaveBeat> ScoresToBeats(const std::vector<double>& scores);
+std::vector<WaveBeat> FixBeatGroups(const std::vector<WaveBeat>& beats, const std::vector<double>& scores);
+
+// Actions (CV_32S, one frame and position per row) for a range of angle rows
+cv::Mat WaveProcess(const cv::Mat& input);
+
+// Rows the stages look at around a frame, more than the reach of the rolls and morphology in stage 1-3
+#define WAVE_MARGIN 64
+// A beat group is final once the next one starts this far before the last score
+#define WAVE_PEAK_LAG 12
+
+// Runs the wave detector over angle rows as they are completed, in order
+// Emitted actions equal the batch result as long as the scale of the rows doesn't grow afterwards,
+// the first frames also depend on the end of the video through the rolls of stage 2
+class WaveStream {
+public:
+    // Appends the next completed rows, returns the actions later rows can no longer change
+    // A new extreme rescales every row; the emitted actions the rescaled rows no longer give are put in retracted
+    cv::Mat Push(const cv::Mat& rows, cv::Mat& retracted);
+
+    int GetNumRows() { return input.rows; }
+
+private:
+    void Settle(const WaveBeat& beat, cv::Mat& actions, cv::Mat& retracted);
+
+    cv::Mat input;
+    std::vector<double> scores;
+    float minValue = 0;
+    float maxValue = 0;
+    // First frame of the beats after the last settled group
+    int tailFrom = 0;
+    // Groups settled since the last rescale, the first ones are checked against emitted
+    int settled = 0;
+    cv::Mat emitted = cv::Mat(0, 2, CV_32SC1);
+};
@@ -0,0 +1,150 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+
+extern "C" {
+#include "FlowLib.h"
+}
+
+#include "FlowRing.hpp"
+
+// Runs one job and publishes the rows of its first output into a FlowRing, for a reader in another process
+// A crash here only loses the job, the reader sees the process exit
+
+static FlowRingWriter ring;
+static FrameNumber published = 0;
+
+// Copies the rows that became final since the last call into the ring, in order
+static bool PublishRows(FlowHandle handle)
+{
+    FrameNumber numFrames = FlowGetLength(handle);
+    FrameNumber to = published;
+    std::vector<unsigned char> states(1024);
+    while(to < numFrames) {
+        FrameNumber blockEnd = std::min<FrameNumber>(to + states.size(), numFrames);
+        if(!FlowGetRowState(handle, FrameRange{ to, blockEnd }, states.data())) {
+            throw std::runtime_error(FlowLastError());
+        }
+
+        FrameNumber blockFrom = to;
+        while(to < blockEnd && states[to - blockFrom] >= FlowRowExact) {
+            to++;
+        }
+        if(to < blockEnd) {
+            break;
+        }
+    }
+
+    while(published < to) {
+        // A range of slots may not wrap around the end of the ring
+        FrameNumber slot = published % ring.GetCapacity();
+        FrameNumber end = std::min<FrameNumber>(to, published + ring.GetCapacity() - slot);
+
+        void* rows = ring.Reserve(published, end);
+        if(rows == nullptr) {
+            return false;
+        }
+        if(!FlowGetOutputData(handle, 0, FrameRange{ published, end }, rows)) {
+            throw std::runtime_error(FlowLastError());
+        }
+
+        published = end;
+        ring.Publish(published);
+    }
+    return true;
+}
+
+// The run callback has no way to stop FlowRun, a cancelled or failed job ends the process
+static void PublishOrExit(FlowHandle handle)
+{
+    try {
+        if(!PublishRows(handle)) {
+            std::cerr << "Cancelled\n";
+            std::_Exit(2);
+        }
+    } catch (const std::runtime_error& e) {
+        ring.Fail(e.what());
+        std::_Exit(1);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        std::cout << "Usage: JTFlowWorker <input video> <shared memory name> [ring frames]\n";
+        return 1;
+    }
+    uint64_t capacity = argc > 3 ? strtoull(argv[3], nullptr, 10) : 0;
+
+    FlowProperties properties = {
+        360/2, // numberOfPools
+        0.02f, // maxValue
+        false, // overlayHalf
+        0.5f, // focusPoint
+        0.5f, // focusSize
+        0.5f, // waveSmoothing1
+        false, // computeOnRead
+        0, // previewWindowMs
+        0, // previewIntervalMs
+        0.0f, // magnitudeThreshold
+        0.0f, // roiX
+        0.0f, // roiY
+        0.0f, // roiWidth
+        0.0f, // roiHeight
+        FlowOutputAngles, // outputMode
+        0, // gridSize
+        false, // pythonModel
+        false, // prefixIndex
+        false, // fastOpen
+        0, // readAheadMb
+        false, // mappedIO
+        FlowRenditionHighest, // renditionPolicy
+        0, // renditionHeight
+        0, // fastDecode1
+        0, // fastDecode3
+        false, // packetIndex
+        0.0f, // duplicateThreshold
+        0, // liveWindow
+        0, // intraDecoders
+        FlowEncoderX264, // motionEncoder
+        FlowSearchDefault, // motionSearch
+        0 // motionRange
+    };
+
+    FlowHandle handle = FlowCreateHandle(argv[1], &properties);
+    if(handle == nullptr) {
+        std::cerr << "Error: " << FlowLastError() << "\n";
+        return 1;
+    }
+
+    try {
+        ring.Create(argv[2], FlowGetLength(handle), FlowGetLengthMs(handle), FlowGetOutputRowSize(handle, 0), capacity);
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        FlowDestroyHandle(handle);
+        return 1;
+    }
+
+    bool success = FlowRun(handle, [](FlowHandle handle, int frame_number) {
+        PublishOrExit(handle);
+    }, 120);
+    if(!success) {
+        ring.Fail(FlowLastError());
+        FlowDestroyHandle(handle);
+        return 1;
+    }
+
+    PublishOrExit(handle);
+    if(published < FlowGetLength(handle)) {
+        ring.Fail("Rows missing after the run");
+        FlowDestroyHandle(handle);
+        return 1;
+    }
+
+    ring.Finish();
+    FlowDestroyHandle(handle);
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include "Check.hpp"
+#include "MotionCapture.hpp"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+#include <zlib.h>
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Captures persist on disk, a file written by an older build has to replay the same vectors
+
+static std::vector<AVMotionVector> ReplayedVectors(AVFrame* frame)
+{
+    AVFrameSideData* sd = av_frame_get_side_data(frame, AV_FRAME_DATA_MOTION_VECTORS);
+    if (!sd) {
+        return {};
+    }
+    const AVMotionVector* vectors = (const AVMotionVector*)sd->data;
+    return std::vector<AVMotionVector>(vectors, vectors + sd->size / sizeof(AVMotionVector));
+}
+
+static bool SameVector(const AVMotionVector& a, const AVMotionVector& b)
+{
+    return a.source == b.source && a.w == b.w && a.h == b.h
+        && a.src_x == b.src_x && a.src_y == b.src_y && a.dst_x == b.dst_x && a.dst_y == b.dst_y
+        && a.motion_x == b.motion_x && a.motion_y == b.motion_y && a.motion_scale == b.motion_scale;
+}
+
+// Written out of order with gaps and more than one chunk, replayed whole and as a range
+static void TestRoundTrip()
+{
+    const char* path = "roundtrip.jtmv";
+    const int numFrames = CAPTURE_CHUNK_FRAMES * 3 + 10;
+
+    std::mt19937 rng(1);
+    std::vector<std::vector<AVMotionVector>> written(numFrames);
+    {
+        MotionCaptureWriter writer(path, numFrames, 12345, cv::Size(640, 360));
+        for (int f = numFrames - 1; f >= 0; f--) {
+            if (f % 7 == 3) {
+                continue;
+            }
+            int numVectors = f % 11 == 0 ? 0 : (int)(rng() % 300);
+            for (int i = 0; i < numVectors; i++) {
+                AVMotionVector vector = {};
+                vector.source = -1;
+                vector.w = 16;
+                vector.h = rng() % 2 ? 8 : 16;
+                vector.dst_x = rng() % 640;
+                vector.dst_y = rng() % 360;
+                vector.motion_scale = 4;
+                vector.motion_x = (int)(rng() % 400) - 200;
+                vector.motion_y = (int)(rng() % 400) - 200;
+                vector.src_x = vector.dst_x + vector.motion_x / vector.motion_scale;
+                vector.src_y = vector.dst_y + vector.motion_y / vector.motion_scale;
+                written[f].push_back(vector);
+            }
+            writer.Write(f, written[f].data(), written[f].size());
+        }
+    }
+
+    CHECK(IsMotionCapture(path));
+
+    std::vector<int> replayed;
+    auto reader = CreateCaptureReader(path, [&](AVFrame* frame, int frame_number) {
+        std::vector<AVMotionVector> vectors = ReplayedVectors(frame);
+        CHECK(vectors.size() == written[frame_number].size());
+        for (size_t i = 0; i < vectors.size(); i++) {
+            CHECK(SameVector(vectors[i], written[frame_number][i]));
+        }
+        replayed.push_back(frame_number);
+    });
+    CHECK(reader->GetNumFrames() == numFrames);
+    CHECK(reader->GetNumMs() == 12345);
+    CHECK(reader->GetVideoSize() == cv::Size(640, 360));
+
+    CHECK(reader->ReadRange(100, 150));
+    CHECK(replayed.size() == 50 && replayed.front() == 100 && replayed.back() == 149);
+
+    replayed.clear();
+    reader->Start();
+    CHECK((int)replayed.size() == numFrames);
+    for (int f = 0; f < numFrames; f++) {
+        CHECK(replayed[f] == f);
+    }
+
+    reader.reset();
+    remove(path);
+}
+
+template<typename T>
+static void Put(std::vector<uint8_t>& out, const T& value)
+{
+    const uint8_t* bytes = (const uint8_t*)&value;
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+// A version 1 file built byte by byte, the layout MotionCapture.hpp describes
+static void TestVersion1()
+{
+    const char* path = "version1.jtmv";
+
+    // Frame 1 with two vectors, zigzag varints: frame table, dst_x and dst_y deltas, w, h, motion_x, motion_y, motion_scale
+    const uint8_t raw[] = {
+        2, 2, 4,
+        16, 32,
+        16, 0,
+        16, 16,
+        16, 8,
+        11, 24,
+        8, 3,
+        8, 8,
+    };
+    uLongf compressedSize = compressBound(sizeof(raw));
+    std::vector<uint8_t> compressed(compressedSize);
+    CHECK(compress2(compressed.data(), &compressedSize, raw, sizeof(raw), Z_BEST_SPEED) == Z_OK);
+    compressed.resize(compressedSize);
+
+    std::vector<uint8_t> file;
+    Put(file, (uint32_t)CAPTURE_MAGIC);
+    Put(file, (uint32_t)1);
+    Put(file, (uint32_t)2); // numFrames
+    Put(file, (uint32_t)80); // numMs
+    Put(file, (uint32_t)64);
+    Put(file, (uint32_t)32);
+    CHECK(file.size() == sizeof(CaptureHeader));
+
+    uint64_t chunkOffset = file.size();
+    Put(file, (uint32_t)compressed.size());
+    Put(file, (uint32_t)sizeof(raw));
+    file.insert(file.end(), compressed.begin(), compressed.end());
+
+    uint64_t indexOffset = file.size();
+    Put(file, chunkOffset);
+    Put(file, (uint32_t)CAPTURE_NO_CHUNK);
+    Put(file, (uint32_t)0);
+    Put(file, indexOffset);
+    Put(file, (uint32_t)1); // numChunks
+    Put(file, (uint32_t)CAPTURE_INDEX_MAGIC);
+    CHECK(file.size() - indexOffset == sizeof(uint64_t) + 2 * sizeof(uint32_t) + sizeof(CaptureTrailer));
+
+    FILE* out = fopen(path, "wb");
+    CHECK(out);
+    CHECK(fwrite(file.data(), 1, file.size(), out) == file.size());
+    fclose(out);
+
+    std::vector<std::vector<AVMotionVector>> replayed(2);
+    auto reader = CreateCaptureReader(path, [&](AVFrame* frame, int frame_number) {
+        replayed[frame_number] = ReplayedVectors(frame);
+    });
+    CHECK(reader->GetNumFrames() == 2);
+    CHECK(reader->GetNumMs() == 80);
+    CHECK(reader->GetVideoSize() == cv::Size(64, 32));
+    reader->Start();
+
+    // src is restored from dst and motion, the fields that aren't stored come back as -1 and 0
+    CHECK(replayed[0].empty());
+    CHECK(replayed[1].size() == 2);
+    const AVMotionVector& a = replayed[1][0];
+    const AVMotionVector& b = replayed[1][1];
+    CHECK(a.dst_x == 8 && a.dst_y == 8 && a.w == 16 && a.h == 16);
+    CHECK(a.motion_x == -6 && a.motion_y == 4 && a.motion_scale == 4);
+    CHECK(a.src_x == 7 && a.src_y == 9 && a.source == -1 && a.flags == 0);
+    CHECK(b.dst_x == 24 && b.dst_y == 8 && b.w == 16 && b.h == 8);
+    CHECK(b.motion_x == 12 && b.motion_y == -2 && b.motion_scale == 4);
+    CHECK(b.src_x == 27 && b.src_y == 8 && b.source == -1 && b.flags == 0);
+
+    reader.reset();
+    remove(path);
+}
+
+int main()
+{
+    TestRoundTrip();
+    TestVersion1();
+    printf("CaptureTest passed\n");
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include "Check.hpp"
+#include "PacketIndex.hpp"
+
+#include <sys/stat.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+// .jtidx files persist next to the videos, an index saved by an older build has to load the same packets
+
+// Decode order, pts in ms: keyframes at 0 and 4000, b-frames in between
+static PacketIndex MakeIndex()
+{
+    PacketIndex index;
+    const int64_t pts[] = { 0, 3000, 1000, 2000, 4000, 6000, 5000 };
+    for (int64_t p : pts) {
+        index.packets.push_back({ p, 100 + p, (int32_t)(p / 100 + 10), p % 4000 == 0 ? 1 : 0 });
+    }
+    index.Finish();
+    return index;
+}
+
+static void TestLookups()
+{
+    PacketIndex index = MakeIndex();
+
+    CHECK(index.NumFrames() == 7);
+    for (int64_t f = 0; f < 7; f++) {
+        CHECK(index.packets[f].pts == f * 1000);
+        CHECK(index.packets[f].pos == 100 + f * 1000);
+    }
+    CHECK(index.keyframes == std::vector<int64_t>({ 0, 4 }));
+
+    CHECK(index.PtsToFrame(2000) == 2);
+    CHECK(index.PtsToFrame(2500) == 3);
+    CHECK(index.PtsToFrame(-5) == 0);
+    CHECK(index.PtsToFrame(99999) == 7);
+
+    CHECK(index.FrameToPts(3) == 3000);
+    CHECK(index.FrameToPts(-1) == 0);
+    CHECK(index.FrameToPts(9) == 9000);
+
+    CHECK(index.KeyframeBefore(0) == 0);
+    CHECK(index.KeyframeBefore(3) == 0);
+    CHECK(index.KeyframeBefore(4) == 4);
+    CHECK(index.KeyframeBefore(6) == 4);
+    CHECK(index.KeyframeBefore(100) == 4);
+
+    CHECK(index.SplitPoints(1) == std::vector<int64_t>({ 0 }));
+    CHECK(index.SplitPoints(2) == std::vector<int64_t>({ 0 }));
+    CHECK(index.SplitPoints(4) == std::vector<int64_t>({ 0, 4 }));
+}
+
+static void WriteVideo(const char* path, const char* content)
+{
+    FILE* file = fopen(path, "wb");
+    CHECK(file);
+    fputs(content, file);
+    fclose(file);
+}
+
+static bool SamePackets(const PacketIndex& a, const PacketIndex& b)
+{
+    if (a.packets.size() != b.packets.size() || a.keyframes != b.keyframes) {
+        return false;
+    }
+    for (size_t i = 0; i < a.packets.size(); i++) {
+        const IndexedPacket& p = a.packets[i];
+        const IndexedPacket& q = b.packets[i];
+        if (p.pts != q.pts || p.pos != q.pos || p.size != q.size || p.keyframe != q.keyframe) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void TestSaveLoad(AVStream* stream)
+{
+    const char* path = "packets.mp4";
+    WriteVideo(path, "not really a video");
+    remove("packets.mp4.jtidx");
+
+    PacketIndex loaded;
+    CHECK(!LoadPacketIndex(path, stream, loaded));
+
+    PacketIndex index = MakeIndex();
+    SavePacketIndex(path, stream, index);
+    CHECK(LoadPacketIndex(path, stream, loaded));
+    CHECK(SamePackets(index, loaded));
+    CHECK(LoadPacketIndex("file:packets.mp4", stream, loaded));
+
+    // Another stream of the same file doesn't take the index
+    stream->index = 1;
+    CHECK(!LoadPacketIndex(path, stream, loaded));
+    stream->index = 0;
+
+    // Neither does the file once it changed
+    WriteVideo(path, "a longer replacement for the video");
+    CHECK(!LoadPacketIndex(path, stream, loaded));
+    CHECK(loaded.packets.empty());
+
+    remove("packets.mp4.jtidx");
+    remove(path);
+}
+
+template<typename T>
+static void Put(std::vector<uint8_t>& out, const T& value)
+{
+    const uint8_t* bytes = (const uint8_t*)&value;
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+// A version 1 index built byte by byte: header, then the packets in presentation order
+static void TestVersion1(AVStream* stream)
+{
+    const char* path = "version1.mp4";
+    WriteVideo(path, "version 1");
+    struct stat info;
+    CHECK(stat(path, &info) == 0);
+
+    std::vector<uint8_t> file;
+    Put(file, (uint32_t)0x49505a4a); // "JZPI"
+    Put(file, (uint32_t)1);
+    Put(file, (int32_t)stream->index);
+    Put(file, (int32_t)stream->codecpar->codec_id);
+    Put(file, (int32_t)stream->time_base.num);
+    Put(file, (int32_t)stream->time_base.den);
+    Put(file, (int64_t)info.st_size);
+    Put(file, (int64_t)info.st_mtime);
+    Put(file, (int64_t)3); // numPackets
+    CHECK(file.size() == 48);
+    for (int64_t f = 0; f < 3; f++) {
+        Put(file, (int64_t)(f * 512)); // pts
+        Put(file, (int64_t)(f == 2 ? -1 : 48 + f * 1000)); // pos
+        Put(file, (int32_t)(1000 + f)); // size
+        Put(file, (int32_t)(f != 1)); // keyframe
+    }
+    CHECK(sizeof(IndexedPacket) == 24);
+
+    FILE* out = fopen("version1.mp4.jtidx", "wb");
+    CHECK(out);
+    CHECK(fwrite(file.data(), 1, file.size(), out) == file.size());
+    fclose(out);
+
+    PacketIndex index;
+    CHECK(LoadPacketIndex(path, stream, index));
+    CHECK(index.NumFrames() == 3);
+    CHECK(index.packets[1].pts == 512 && index.packets[1].pos == 1048 && index.packets[1].size == 1001 && index.packets[1].keyframe == 0);
+    CHECK(index.packets[2].pos == -1);
+    CHECK(index.keyframes == std::vector<int64_t>({ 0, 2 }));
+    CHECK(index.PtsToFrame(1024) == 2);
+
+    remove("version1.mp4.jtidx");
+    remove(path);
+}
+
+int main()
+{
+    TestLookups();
+
+    AVFormatContext* fmt_ctx = avformat_alloc_context();
+    AVStream* stream = avformat_new_stream(fmt_ctx, NULL);
+    CHECK(stream && stream->index == 0);
+    stream->time_base = { 1, 1000 };
+    stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    stream->codecpar->codec_id = AV_CODEC_ID_H264;
+
+    TestSaveLoad(stream);
+    TestVersion1(stream);
+
+    avformat_free_context(fmt_ctx);
+    printf("PacketIndexTest passed\n");
+    return 0;
+}
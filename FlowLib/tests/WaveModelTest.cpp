@@ -0,0 +1,72 @@
+#include "Check.hpp"
+#include "WaveModel.hpp"
+
+#include <vector>
+
+// The native port has to give the actions Model/jtmodel.py gives on the same rows
+
+// Strokes that change direction every half period, the period slows down every 100 frames
+// The bins of one half lead the other by 3 frames, which half leads flips with the direction
+static cv::Mat MakeRows(int numFrames)
+{
+    cv::Mat rows = cv::Mat::zeros(numFrames, 180, CV_32SC1);
+    for (int t = 0; t < numFrames; t++) {
+        int period = 20 + (t / 100) * 4;
+        int half = period / 2;
+        int phase = t % period;
+        bool up = phase < half;
+        for (int c = 0; c < 180; c++) {
+            int band = c % 90;
+            if (band < 20 || band >= 70) {
+                continue;
+            }
+            bool lead = (c < 90) == up;
+            int p = ((phase - (lead ? 0 : 3)) % half + half) % half;
+            if (p < period / 4) {
+                rows.at<int>(t, c) = (band * 37 + t * 11) % 200 + 3000 + p * 500;
+            }
+        }
+    }
+    return rows;
+}
+
+// jtmodel.process(rows) on the rows above, their scores have no equal peaks closer than the peak distance
+static const int expected[][2] = {
+    { 13, 90 }, { 23, 10 }, { 33, 90 }, { 43, 10 }, { 53, 90 }, { 63, 10 }, { 73, 90 }, { 83, 10 },
+    { 93, 90 }, { 99, 10 }, { 111, 90 }, { 123, 10 }, { 135, 90 }, { 147, 10 }, { 159, 90 }, { 171, 10 },
+    { 183, 90 }, { 194, 10 }, { 200, 90 }, { 202, 10 }, { 214, 90 }, { 228, 10 }, { 242, 90 }, { 256, 10 },
+    { 270, 90 }, { 284, 10 }, { 304, 90 }, { 324, 10 }, { 340, 90 }, { 356, 10 }, { 372, 90 }, { 395, 10 },
+    { 419, 90 }, { 437, 10 }, { 455, 90 }, { 473, 10 }, { 491, 90 }, { 498, 10 }, { 505, 90 }, { 525, 10 },
+    { 545, 90 }, { 565, 10 },
+};
+
+static void TestProcess()
+{
+    cv::Mat actions = WaveProcess(MakeRows(600));
+
+    int numExpected = sizeof(expected) / sizeof(expected[0]);
+    CHECK(actions.type() == CV_32SC1 && actions.cols == 2);
+    CHECK(actions.rows == numExpected);
+    for (int i = 0; i < numExpected; i++) {
+        CHECK(actions.at<int>(i, 0) == expected[i][0]);
+        CHECK(actions.at<int>(i, 1) == expected[i][1]);
+    }
+}
+
+// scipy.signal.find_peaks on the same input
+static void TestFindPeaks()
+{
+    CHECK(FindPeaks({ 0, 2, 0, 1, 0, 2, 0 }, 0, 3) == std::vector<int>({ 1, 5 }));
+    CHECK(FindPeaks({ 0, 1, 1, 1, 0, 3, 0 }, 0, 2) == std::vector<int>({ 2, 5 }));
+    CHECK(FindPeaks({ 0, 1, 0, 3, 0 }, 2, 1) == std::vector<int>({ 3 }));
+    // Equal peaks within the distance, the later one stays like with a stable sort
+    CHECK(FindPeaks({ 0, 1, 0, 1, 0 }, 0, 3) == std::vector<int>({ 3 }));
+}
+
+int main()
+{
+    TestFindPeaks();
+    TestProcess();
+    printf("WaveModelTest passed\n");
+    return 0;
+}
@@ -0,0 +1,90 @@
+"""Serves files over http with range requests and a delay per request, a stand-in for a slow remote source.
+
+    python3 latency_server.py <directory> [--port 8000] [--latency-ms 200] [--rate-kb 0]
+
+Then open http://127.0.0.1:8000/<file> with and without readAheadMb to compare.
+"""
+
+import argparse
+import os
+import re
+import time
+from functools import partial
+from http.server import SimpleHTTPRequestHandler, ThreadingHTTPServer
+
+
+class LatencyHandler(SimpleHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def __init__(self, *args, latency=0.0, rate=0, **kwargs):
+        self.latency = latency
+        self.rate = rate
+        super().__init__(*args, **kwargs)
+
+    def do_GET(self):
+        time.sleep(self.latency)
+
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            self.send_error(404)
+            return
+
+        size = os.path.getsize(path)
+        start, end = 0, size - 1
+        match = re.match(r"bytes=(\d*)-(\d*)", self.headers.get("Range", ""))
+        if match:
+            if match.group(1):
+                start = int(match.group(1))
+                if match.group(2):
+                    end = min(int(match.group(2)), size - 1)
+            elif match.group(2):
+                start = max(size - int(match.group(2)), 0)
+            if start >= size:
+                self.send_response(416)
+                self.send_header("Content-Range", "bytes */%d" % size)
+                self.send_header("Content-Length", "0")
+                self.end_headers()
+                return
+            self.send_response(206)
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, size))
+        else:
+            self.send_response(200)
+
+        self.send_header("Accept-Ranges", "bytes")
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Length", str(end - start + 1))
+        self.end_headers()
+
+        # A client seeking away closes the connection mid body
+        with open(path, "rb") as f:
+            f.seek(start)
+            remaining = end - start + 1
+            try:
+                while remaining > 0:
+                    chunk = f.read(min(remaining, 64 * 1024))
+                    if not chunk:
+                        break
+                    self.wfile.write(chunk)
+                    remaining -= len(chunk)
+                    if self.rate:
+                        time.sleep(len(chunk) / self.rate)
+            except (BrokenPipeError, ConnectionResetError):
+                self.close_connection = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("directory")
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--latency-ms", type=float, default=200, help="Delay before every response")
+    parser.add_argument("--rate-kb", type=float, default=0, help="Bandwidth per connection in KB/s, 0 is unlimited")
+    args = parser.parse_args()
+
+    handler = partial(LatencyHandler, directory=args.directory, latency=args.latency_ms / 1000, rate=args.rate_kb * 1024)
+    server = ThreadingHTTPServer(("127.0.0.1", args.port), handler)
+    print("Serving %s on http://127.0.0.1:%d with %d ms latency" % (args.directory, args.port, args.latency_ms))
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,77 @@
+"""Runs Model/jtmodel.py and the native wave port (src/WaveModel.cpp) on the same angle rows and diffs their actions.
+
+    python3 tools/wave_compare.py <rows.npy | video | capture.jtmv> [...] [--tolerance 0]
+
+A video or capture is decoded once with jtflow and its rows saved next to it as <path>.npy, so later runs compare
+the same matrix. Exits with 1 when any input differs.
+
+FindPeaks keeps peaks of equal height in position order, scipy.signal.find_peaks leaves that order to an unstable
+sort. When two equal peaks are closer than the distance, the two may keep a different one of them, shifting an
+action by a few frames; --tolerance accepts such shifts.
+"""
+
+import argparse
+import os
+import sys
+
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "Model"))
+
+import jtflow
+import jtmodel
+
+
+def load_rows(path):
+    if path.endswith(".npy"):
+        return np.load(path)
+
+    saved = path + ".npy"
+    if os.path.isfile(saved):
+        return np.load(saved)
+
+    handle = jtflow.Handle(path)
+    handle.run()
+    rows = np.array(handle.output(0), dtype=np.int32)
+    np.save(saved, rows)
+    return rows
+
+
+def compare(python, native, tolerance):
+    # Actions pair up in order, a tie picked differently only moves a frame
+    mismatches = []
+    for i in range(max(len(python), len(native))):
+        if i >= len(python) or i >= len(native):
+            mismatches.append(i)
+            continue
+        if python[i][1] != native[i][1] or abs(int(python[i][0]) - int(native[i][0])) > tolerance:
+            mismatches.append(i)
+    return mismatches
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("inputs", nargs="+")
+    parser.add_argument("--tolerance", type=int, default=0, help="frames an action may move")
+    args = parser.parse_args()
+
+    failed = False
+    for path in args.inputs:
+        rows = np.ascontiguousarray(load_rows(path), dtype=np.int32)
+        python = jtmodel.process(rows)
+        native = jtflow.wave(rows)
+
+        mismatches = compare(python, native, args.tolerance)
+        print("{}: {} rows, {} python actions, {} native actions, {} mismatches".format(
+            path, len(rows), len(python), len(native), len(mismatches)))
+        if mismatches:
+            failed = True
+            i = mismatches[0]
+            print("  first at action {}: python {} native {}".format(
+                i, python[i].tolist() if i < len(python) else None, native[i].tolist() if i < len(native) else None))
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,14 @@
+{
+  "targets": [
+    {
+      "target_name": "flowlib",
+      "sources": [ "native/flowlib.cc" ],
+      "include_dirs": [ "../FlowLib/src" ],
+      "cflags_cc": [ "-std=c++17" ],
+      "conditions": [
+        [ "OS!='win'", { "libraries": [ "-ldl" ] } ],
+        [ "OS=='win'", { "msvs_settings": { "VCCLCompilerTool": { "AdditionalOptions": [ "/std:c++17" ] } } } ]
+      ]
+    }
+  ]
+}
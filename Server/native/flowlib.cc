@@ -0,0 +1,1011 @@
+// N-API binding of FlowLib for the server, the library itself is loaded at runtime so Cuda and Lav builds stay interchangeable
+#include <node_api.h>
+
+extern "C" {
+#include "FlowLib.h"
+}
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define NAPI_CALL(env, call)                                      \
+    do {                                                          \
+        if ((call) != napi_ok) {                                  \
+            const napi_extended_error_info* info = nullptr;       \
+            napi_get_last_error_info((env), &info);               \
+            bool pending;                                         \
+            napi_is_exception_pending((env), &pending);           \
+            if (!pending) {                                       \
+                napi_throw_error((env), nullptr, info && info->error_message ? info->error_message : "N-API call failed"); \
+            }                                                     \
+            return nullptr;                                       \
+        }                                                         \
+    } while (0)
+
+// -- Library --
+
+struct FlowApi {
+    decltype(&FlowCreateHandleMulti) CreateHandleMulti = nullptr;
+    decltype(&FlowDestroyHandle) DestroyHandle = nullptr;
+    decltype(&FlowRun) Run = nullptr;
+    decltype(&FlowRequestRange) RequestRange = nullptr;
+    decltype(&FlowGetLength) GetLength = nullptr;
+    decltype(&FlowGetLengthMs) GetLengthMs = nullptr;
+    decltype(&FlowGetNumOutputs) GetNumOutputs = nullptr;
+    decltype(&FlowGetOutputBins) GetOutputBins = nullptr;
+    decltype(&FlowGetOutputRowSize) GetOutputRowSize = nullptr;
+    decltype(&FlowGetOutputData) GetOutputData = nullptr;
+    decltype(&FlowGetRowState) GetRowState = nullptr;
+    decltype(&FlowGetNumLevels) GetNumLevels = nullptr;
+    decltype(&FlowGetLevelLength) GetLevelLength = nullptr;
+    decltype(&FlowGetLevel) GetLevel = nullptr;
+    decltype(&FlowGetRangeSums) GetRangeSums = nullptr;
+    decltype(&FlowCalcWave) CalcWave = nullptr;
+    decltype(&FlowGetLiveRange) GetLiveRange = nullptr;
+    decltype(&FlowLastError) LastError = nullptr;
+};
+
+static FlowApi api;
+
+template<typename T>
+static bool LoadSymbol(void* library, const char* name, T& target)
+{
+#ifdef _WIN32
+    target = (T)GetProcAddress((HMODULE)library, name);
+#else
+    target = (T)dlsym(library, name);
+#endif
+    return target != nullptr;
+}
+
+static napi_value ThrowFlowError(napi_env env)
+{
+    napi_throw_error(env, nullptr, api.LastError ? api.LastError() : "FlowLib is not loaded");
+    return nullptr;
+}
+
+static napi_value Load(napi_env env, napi_callback_info info)
+{
+    size_t argc = 1;
+    napi_value argv[1];
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+
+    char path[4096];
+    size_t length;
+    NAPI_CALL(env, napi_get_value_string_utf8(env, argv[0], path, sizeof(path), &length));
+
+#ifdef _WIN32
+    void* library = (void*)LoadLibraryA(path);
+#else
+    void* library = dlopen(path, RTLD_NOW);
+#endif
+    if(library == nullptr) {
+        napi_throw_error(env, nullptr, (std::string("Cannot load ") + path).c_str());
+        return nullptr;
+    }
+
+    FlowApi loaded;
+    bool ok = LoadSymbol(library, "FlowCreateHandleMulti", loaded.CreateHandleMulti)
+        && LoadSymbol(library, "FlowDestroyHandle", loaded.DestroyHandle)
+        && LoadSymbol(library, "FlowRun", loaded.Run)
+        && LoadSymbol(library, "FlowRequestRange", loaded.RequestRange)
+        && LoadSymbol(library, "FlowGetLength", loaded.GetLength)
+        && LoadSymbol(library, "FlowGetLengthMs", loaded.GetLengthMs)
+        && LoadSymbol(library, "FlowGetNumOutputs", loaded.GetNumOutputs)
+        && LoadSymbol(library, "FlowGetOutputBins", loaded.GetOutputBins)
+        && LoadSymbol(library, "FlowGetOutputRowSize", loaded.GetOutputRowSize)
+        && LoadSymbol(library, "FlowGetOutputData", loaded.GetOutputData)
+        && LoadSymbol(library, "FlowGetRowState", loaded.GetRowState)
+        && LoadSymbol(library, "FlowGetNumLevels", loaded.GetNumLevels)
+        && LoadSymbol(library, "FlowGetLevelLength", loaded.GetLevelLength)
+        && LoadSymbol(library, "FlowGetLevel", loaded.GetLevel)
+        && LoadSymbol(library, "FlowGetRangeSums", loaded.GetRangeSums)
+        && LoadSymbol(library, "FlowCalcWave", loaded.CalcWave)
+        && LoadSymbol(library, "FlowGetLiveRange", loaded.GetLiveRange)
+        && LoadSymbol(library, "FlowLastError", loaded.LastError);
+    if(!ok) {
+        napi_throw_error(env, nullptr, (std::string("Missing FlowLib functions in ") + path).c_str());
+        return nullptr;
+    }
+
+    api = loaded;
+    napi_value result;
+    NAPI_CALL(env, napi_get_boolean(env, true, &result));
+    return result;
+}
+
+// -- Properties --
+
+enum FieldType { FieldInt, FieldFloat, FieldBool };
+
+struct PropertyField {
+    const char* name;
+    size_t offset;
+    FieldType type;
+};
+
+static const PropertyField propertyFields[] = {
+    { "numberOfPools", offsetof(FlowProperties, numberOfPools), FieldInt },
+    { "maxValue", offsetof(FlowProperties, maxValue), FieldFloat },
+    { "overlayHalf", offsetof(FlowProperties, overlayHalf), FieldBool },
+    { "focusPoint", offsetof(FlowProperties, focusPoint), FieldFloat },
+    { "focusSize", offsetof(FlowProperties, focusSize), FieldFloat },
+    { "waveSmoothing1", offsetof(FlowProperties, waveSmoothing1), FieldFloat },
+    { "computeOnRead", offsetof(FlowProperties, computeOnRead), FieldBool },
+    { "previewWindowMs", offsetof(FlowProperties, previewWindowMs), FieldInt },
+    { "previewIntervalMs", offsetof(FlowProperties, previewIntervalMs), FieldInt },
+    { "magnitudeThreshold", offsetof(FlowProperties, magnitudeThreshold), FieldFloat },
+    { "roiX", offsetof(FlowProperties, roiX), FieldFloat },
+    { "roiY", offsetof(FlowProperties, roiY), FieldFloat },
+    { "roiWidth", offsetof(FlowProperties, roiWidth), FieldFloat },
+    { "roiHeight", offsetof(FlowProperties, roiHeight), FieldFloat },
+    { "outputMode", offsetof(FlowProperties, outputMode), FieldInt },
+    { "gridSize", offsetof(FlowProperties, gridSize), FieldInt },
+    { "pythonModel", offsetof(FlowProperties, pythonModel), FieldBool },
+    { "prefixIndex", offsetof(FlowProperties, prefixIndex), FieldBool },
+    { "fastOpen", offsetof(FlowProperties, fastOpen), FieldBool },
+    { "readAheadMb", offsetof(FlowProperties, readAheadMb), FieldInt },
+    { "mappedIO", offsetof(FlowProperties, mappedIO), FieldBool },
+    { "renditionPolicy", offsetof(FlowProperties, renditionPolicy), FieldInt },
+    { "renditionHeight", offsetof(FlowProperties, renditionHeight), FieldInt },
+    { "fastDecode1", offsetof(FlowProperties, fastDecode1), FieldInt },
+    { "fastDecode3", offsetof(FlowProperties, fastDecode3), FieldInt },
+    { "packetIndex", offsetof(FlowProperties, packetIndex), FieldBool },
+    { "duplicateThreshold", offsetof(FlowProperties, duplicateThreshold), FieldFloat },
+    { "liveWindow", offsetof(FlowProperties, liveWindow), FieldInt },
+    { "intraDecoders", offsetof(FlowProperties, intraDecoders), FieldInt },
+    { "motionEncoder", offsetof(FlowProperties, motionEncoder), FieldInt },
+    { "motionSearch", offsetof(FlowProperties, motionSearch), FieldInt },
+    { "motionRange", offsetof(FlowProperties, motionRange), FieldInt },
+};
+
+// Missing fields are zero, like an unset field of the old ffi struct
+static bool ParseProperties(napi_env env, napi_value object, FlowProperties& properties)
+{
+    properties = {};
+    for(const PropertyField& field : propertyFields) {
+        bool has;
+        if(napi_has_named_property(env, object, field.name, &has) != napi_ok) {
+            return false;
+        }
+        if(!has) {
+            continue;
+        }
+
+        napi_value value;
+        if(napi_get_named_property(env, object, field.name, &value) != napi_ok) {
+            return false;
+        }
+
+        char* target = (char*)&properties + field.offset;
+        napi_status status;
+        if(field.type == FieldInt) {
+            status = napi_get_value_int32(env, value, (int32_t*)target);
+        } else if(field.type == FieldFloat) {
+            double number;
+            status = napi_get_value_double(env, value, &number);
+            *(float*)target = (float)number;
+        } else {
+            status = napi_get_value_bool(env, value, (bool*)target);
+        }
+        if(status != napi_ok) {
+            napi_throw_type_error(env, nullptr, (std::string("Invalid property ") + field.name).c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// -- Handle --
+
+struct Handle {
+    FlowHandle handle = nullptr;
+    bool running = false;
+    bool live = false; // liveWindow, rows are numbered from the start of the stream and only a window is kept
+    int pending = 0; // Async work that still uses the handle, it can't be destroyed before it finishes
+};
+
+// FlowRunCallback carries no user data, runs are found by their FlowHandle
+struct RunState;
+static std::mutex runsMutex;
+static std::map<FlowHandle, RunState*> runs;
+
+static void FinalizeHandle(napi_env env, void* data, void* hint)
+{
+    Handle* handle = (Handle*)data;
+    if(handle->handle && api.DestroyHandle) {
+        api.DestroyHandle(handle->handle);
+    }
+    delete handle;
+}
+
+static napi_value HandleConstructor(napi_env env, napi_callback_info info)
+{
+    size_t argc = 2;
+    napi_value argv[2];
+    napi_value self;
+    NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, &self, nullptr));
+
+    if(api.CreateHandleMulti == nullptr) {
+        return ThrowFlowError(env);
+    }
+    if(argc < 2) {
+        napi_throw_type_error(env, nullptr, "FlowHandle(path, properties)");
+        return nullptr;
+    }
+
+    size_t length;
+    NAPI_CALL(env, napi_get_value_string_utf8(env, argv[0], nullptr, 0, &length));
+    std::string path(length, '\0');
+    NAPI_CALL(env, napi_get_value_string_utf8(env, argv[0], &path[0], length + 1, &length));
+
+    // One properties object, or an array of them for one output each
+    std::vector<FlowProperties> properties;
+    bool isArray;
+    NAPI_CALL(env, napi_is_array(env, argv[1], &isArray));
+    if(isArray) {
+        uint32_t count;
+        NAPI_CALL(env, napi_get_array_length(env, argv[1], &count));
+        for(uint32_t i=0; i<count; i++) {
+            napi_value element;
+            NAPI_CALL(env, napi_get_element(env, argv[1], i, &element));
+            FlowProperties p;
+            if(!ParseProperties(env, element, p)) {
+                return nullptr;
+            }
+            properties.push_back(p);
+        }
+    } else {
+        FlowProperties p;
+        if(!ParseProperties(env, argv[1], p)) {
+            return nullptr;
+        }
+        properties.push_back(p);
+    }
+
+    FlowHandle flowHandle = api.CreateHandleMulti(path.c_str(), properties.data(), (int)properties.size());
+    if(flowHandle == nullptr) {
+        return ThrowFlowError(env);
+    }
+
+    Handle* handle = new Handle();
+    handle->handle = flowHandle;
+    handle->live = properties[0].liveWindow > 0;
+    NAPI_CALL(env, napi_wrap(env, self, handle, FinalizeHandle, nullptr, nullptr));
+    return self;
+}
+
+static Handle* Unwrap(napi_env env, napi_callback_info info, size_t* argc, napi_value* argv, napi_value* self = nullptr)
+{
+    napi_value thisArg;
+    if(napi_get_cb_info(env, info, argc, argv, &thisArg, nullptr) != napi_ok) {
+        return nullptr;
+    }
+
+    Handle* handle = nullptr;
+    if(napi_unwrap(env, thisArg, (void**)&handle) != napi_ok || handle == nullptr || handle->handle == nullptr) {
+        napi_throw_error(env, nullptr, "FlowHandle is destroyed");
+        return nullptr;
+    }
+    if(self) {
+        *self = thisArg;
+    }
+    return handle;
+}
+
+// 0 <= from <= to <= length, or within the live range of a live handle, checked before anything is allocated
+static bool CheckRange(napi_env env, Handle* handle, int64_t fromFrame, int64_t toFrame, int64_t length = -1)
+{
+    int64_t first = 0;
+    if(length < 0 && handle->live) {
+        FrameRange range;
+        if(!api.GetLiveRange(handle->handle, &range)) {
+            ThrowFlowError(env);
+            return false;
+        }
+        first = (int64_t)range.fromFrame;
+        length = (int64_t)range.toFrame;
+    } else if(length < 0) {
+        length = (int64_t)api.GetLength(handle->handle);
+    }
+
+    if(fromFrame < first || fromFrame > toFrame || toFrame > length) {
+        std::string message = "Invalid frame range " + std::to_string(fromFrame) + " - " + std::to_string(toFrame)
+            + ", rows are " + std::to_string(first) + " - " + std::to_string(length);
+        napi_throw_range_error(env, nullptr, message.c_str());
+        return false;
+    }
+    return true;
+}
+
+static napi_value HandleDestroy(napi_env env, napi_callback_info info)
+{
+    size_t argc = 0;
+    Handle* handle = Unwrap(env, info, &argc, nullptr);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+    if(handle->running || handle->pending > 0) {
+        napi_throw_error(env, nullptr, "FlowHandle is running");
+        return nullptr;
+    }
+
+    api.DestroyHandle(handle->handle);
+    handle->handle = nullptr;
+    return nullptr;
+}
+
+static napi_value HandleLength(napi_env env, napi_callback_info info)
+{
+    size_t argc = 0;
+    Handle* handle = Unwrap(env, info, &argc, nullptr);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+
+    napi_value result;
+    NAPI_CALL(env, napi_create_double(env, (double)api.GetLength(handle->handle), &result));
+    return result;
+}
+
+static napi_value HandleLengthMs(napi_env env, napi_callback_info info)
+{
+    size_t argc = 0;
+    Handle* handle = Unwrap(env, info, &argc, nullptr);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+
+    napi_value result;
+    NAPI_CALL(env, napi_create_double(env, (double)api.GetLengthMs(handle->handle), &result));
+    return result;
+}
+
+static napi_value HandleNumOutputs(napi_env env, napi_callback_info info)
+{
+    size_t argc = 0;
+    Handle* handle = Unwrap(env, info, &argc, nullptr);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+
+    napi_value result;
+    NAPI_CALL(env, napi_create_int32(env, api.GetNumOutputs(handle->handle), &result));
+    return result;
+}
+
+static napi_value HandleRowSize(napi_env env, napi_callback_info info)
+{
+    size_t argc = 1;
+    napi_value argv[1];
+    Handle* handle = Unwrap(env, info, &argc, argv);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+
+    int output = 0;
+    if(argc > 0) {
+        NAPI_CALL(env, napi_get_value_int32(env, argv[0], &output));
+    }
+
+    int rowSize = api.GetOutputRowSize(handle->handle, output);
+    if(rowSize <= 0) {
+        return ThrowFlowError(env);
+    }
+
+    napi_value result;
+    NAPI_CALL(env, napi_create_int32(env, rowSize, &result));
+    return result;
+}
+
+static void FreeBlock(napi_env env, void* data, void* hint)
+{
+    free(data);
+}
+
+// Rows in memory of their own, handed to JS without a copy and freed by the finalizer of the ArrayBuffer
+static void* ReadBlock(Handle* handle, int output, FrameRange range, size_t* size)
+{
+    int rowSize = api.GetOutputRowSize(handle->handle, output);
+    if(rowSize <= 0 || range.fromFrame > range.toFrame) {
+        return nullptr;
+    }
+
+    *size = (size_t)rowSize * (range.toFrame - range.fromFrame);
+    void* data = malloc(*size > 0 ? *size : 1);
+    if(data && !api.GetOutputData(handle->handle, output, range, data)) {
+        free(data);
+        return nullptr;
+    }
+    return data;
+}
+
+static napi_value BlockArrayBuffer(napi_env env, void* data, size_t size)
+{
+    napi_value buffer;
+    if(napi_create_external_arraybuffer(env, data, size, FreeBlock, nullptr, &buffer) != napi_ok) {
+        free(data);
+        return nullptr;
+    }
+    return buffer;
+}
+
+static napi_value HandleGetData(napi_env env, napi_callback_info info)
+{
+    size_t argc = 3;
+    napi_value argv[3];
+    Handle* handle = Unwrap(env, info, &argc, argv);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+
+    int64_t fromFrame, toFrame;
+    int output = 0;
+    NAPI_CALL(env, napi_get_value_int64(env, argv[0], &fromFrame));
+    NAPI_CALL(env, napi_get_value_int64(env, argv[1], &toFrame));
+    if(argc > 2) {
+        NAPI_CALL(env, napi_get_value_int32(env, argv[2], &output));
+    }
+    if(!CheckRange(env, handle, fromFrame, toFrame)) {
+        return nullptr;
+    }
+
+    size_t size;
+    void* data = ReadBlock(handle, output, FrameRange{ (FrameNumber)fromFrame, (FrameNumber)toFrame }, &size);
+    if(data == nullptr) {
+        return ThrowFlowError(env);
+    }
+    return BlockArrayBuffer(env, data, size);
+}
+
+static napi_value HandleRowState(napi_env env, napi_callback_info info)
+{
+    size_t argc = 2;
+    napi_value argv[2];
+    Handle* handle = Unwrap(env, info, &argc, argv);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+
+    int64_t fromFrame, toFrame;
+    NAPI_CALL(env, napi_get_value_int64(env, argv[0], &fromFrame));
+    NAPI_CALL(env, napi_get_value_int64(env, argv[1], &toFrame));
+    if(!CheckRange(env, handle, fromFrame, toFrame)) {
+        return nullptr;
+    }
+
+    void* data;
+    napi_value buffer, result;
+    size_t count = (size_t)(toFrame - fromFrame);
+    NAPI_CALL(env, napi_create_arraybuffer(env, count, &data, &buffer));
+    if(!api.GetRowState(handle->handle, FrameRange{ (FrameNumber)fromFrame, (FrameNumber)toFrame }, (unsigned char*)data)) {
+        return ThrowFlowError(env);
+    }
+    NAPI_CALL(env, napi_create_typedarray(env, napi_uint8_array, count, buffer, 0, &result));
+    return result;
+}
+
+// liveRange(), { fromFrame, toFrame } of the rows a live handle keeps
+static napi_value HandleLiveRange(napi_env env, napi_callback_info info)
+{
+    size_t argc = 0;
+    Handle* handle = Unwrap(env, info, &argc, nullptr);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+
+    FrameRange range;
+    if(!api.GetLiveRange(handle->handle, &range)) {
+        return ThrowFlowError(env);
+    }
+
+    napi_value result, fromFrame, toFrame;
+    NAPI_CALL(env, napi_create_object(env, &result));
+    NAPI_CALL(env, napi_create_double(env, (double)range.fromFrame, &fromFrame));
+    NAPI_CALL(env, napi_create_double(env, (double)range.toFrame, &toFrame));
+    NAPI_CALL(env, napi_set_named_property(env, result, "fromFrame", fromFrame));
+    NAPI_CALL(env, napi_set_named_property(env, result, "toFrame", toFrame));
+    return result;
+}
+
+static napi_value HandleRequestRange(napi_env env, napi_callback_info info)
+{
+    size_t argc = 3;
+    napi_value argv[3];
+    Handle* handle = Unwrap(env, info, &argc, argv);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+
+    int64_t fromFrame, toFrame;
+    int priority = 0;
+    NAPI_CALL(env, napi_get_value_int64(env, argv[0], &fromFrame));
+    NAPI_CALL(env, napi_get_value_int64(env, argv[1], &toFrame));
+    if(argc > 2) {
+        NAPI_CALL(env, napi_get_value_int32(env, argv[2], &priority));
+    }
+
+    if(!api.RequestRange(handle->handle, FrameRange{ (FrameNumber)fromFrame, (FrameNumber)toFrame }, priority)) {
+        return ThrowFlowError(env);
+    }
+    return nullptr;
+}
+
+static napi_value HandleNumLevels(napi_env env, napi_callback_info info)
+{
+    size_t argc = 0;
+    Handle* handle = Unwrap(env, info, &argc, nullptr);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+
+    int numLevels = api.GetNumLevels(handle->handle);
+    if(numLevels <= 0) {
+        return ThrowFlowError(env);
+    }
+
+    napi_value result;
+    NAPI_CALL(env, napi_create_int32(env, numLevels, &result));
+    return result;
+}
+
+static napi_value HandleLevelLength(napi_env env, napi_callback_info info)
+{
+    size_t argc = 1;
+    napi_value argv[1];
+    Handle* handle = Unwrap(env, info, &argc, argv);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+
+    int level;
+    NAPI_CALL(env, napi_get_value_int32(env, argv[0], &level));
+
+    napi_value result;
+    NAPI_CALL(env, napi_create_double(env, (double)api.GetLevelLength(handle->handle, level), &result));
+    return result;
+}
+
+// getLevel(level, from, to, format = FlowLevelGray), rows of a pyramid level as a Uint8Array
+static napi_value HandleGetLevel(napi_env env, napi_callback_info info)
+{
+    size_t argc = 4;
+    napi_value argv[4];
+    Handle* handle = Unwrap(env, info, &argc, argv);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+
+    int level, format = FlowLevelGray;
+    int64_t fromFrame, toFrame;
+    NAPI_CALL(env, napi_get_value_int32(env, argv[0], &level));
+    NAPI_CALL(env, napi_get_value_int64(env, argv[1], &fromFrame));
+    NAPI_CALL(env, napi_get_value_int64(env, argv[2], &toFrame));
+    if(argc > 3) {
+        NAPI_CALL(env, napi_get_value_int32(env, argv[3], &format));
+    }
+    if(level < 0 || level >= api.GetNumLevels(handle->handle)) {
+        napi_throw_range_error(env, nullptr, "Invalid level");
+        return nullptr;
+    }
+    if(!CheckRange(env, handle, fromFrame, toFrame, (int64_t)api.GetLevelLength(handle->handle, level))) {
+        return nullptr;
+    }
+
+    int bins = api.GetOutputBins(handle->handle, 0);
+    size_t rowSize = format == FlowLevelRGB ? (size_t)(bins / 2) * 3 : (size_t)bins;
+    size_t size = rowSize * (size_t)(toFrame - fromFrame);
+
+    void* data = malloc(size > 0 ? size : 1);
+    if(data == nullptr) {
+        napi_throw_error(env, nullptr, "Out of memory");
+        return nullptr;
+    }
+    if(!api.GetLevel(handle->handle, level, FrameRange{ (FrameNumber)fromFrame, (FrameNumber)toFrame }, format, data)) {
+        free(data);
+        return ThrowFlowError(env);
+    }
+
+    napi_value buffer, result;
+    buffer = BlockArrayBuffer(env, data, size);
+    if(buffer == nullptr) {
+        return nullptr;
+    }
+    NAPI_CALL(env, napi_create_typedarray(env, napi_uint8_array, size, buffer, 0, &result));
+    return result;
+}
+
+// rangeSums([from0, to0, from1, to1, ...]), angle bin totals of output 0 as a BigInt64Array of one row per range
+static napi_value HandleRangeSums(napi_env env, napi_callback_info info)
+{
+    size_t argc = 1;
+    napi_value argv[1];
+    Handle* handle = Unwrap(env, info, &argc, argv);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+
+    uint32_t length;
+    NAPI_CALL(env, napi_get_array_length(env, argv[0], &length));
+    std::vector<FrameRange> ranges(length / 2);
+    for(uint32_t i=0; i<ranges.size(); i++) {
+        napi_value fromValue, toValue;
+        int64_t fromFrame, toFrame;
+        NAPI_CALL(env, napi_get_element(env, argv[0], i * 2, &fromValue));
+        NAPI_CALL(env, napi_get_element(env, argv[0], i * 2 + 1, &toValue));
+        NAPI_CALL(env, napi_get_value_int64(env, fromValue, &fromFrame));
+        NAPI_CALL(env, napi_get_value_int64(env, toValue, &toFrame));
+        if(!CheckRange(env, handle, fromFrame, toFrame)) {
+            return nullptr;
+        }
+        ranges[i] = FrameRange{ (FrameNumber)fromFrame, (FrameNumber)toFrame };
+    }
+
+    size_t count = ranges.size() * api.GetOutputBins(handle->handle, 0);
+    void* data;
+    napi_value buffer, result;
+    NAPI_CALL(env, napi_create_arraybuffer(env, count * sizeof(long long), &data, &buffer));
+    if(!api.GetRangeSums(handle->handle, ranges.data(), (int)ranges.size(), (long long*)data)) {
+        return ThrowFlowError(env);
+    }
+    NAPI_CALL(env, napi_create_typedarray(env, napi_bigint64_array, count, buffer, 0, &result));
+    return result;
+}
+
+// -- Run --
+
+struct RunMessage {
+    bool done;
+    bool success;
+    std::string error;
+    FrameRange range;
+    void* data;
+    size_t size;
+};
+
+struct RunState {
+    Handle* handle;
+    int output;
+    FrameNumber blockFrames;
+    FrameNumber numFrames;
+    FrameNumber nextFrame = 0;
+    bool live;
+    bool failed = false;
+    std::string error;
+    napi_ref self;
+    napi_deferred deferred;
+    napi_threadsafe_function tsfn;
+};
+
+// Whether every row of range is final, requests and preview passes fill the rows out of order
+static bool RowsFinal(Handle* handle, FrameRange range)
+{
+    std::vector<unsigned char> states(range.toFrame - range.fromFrame);
+    if(!api.GetRowState(handle->handle, range, states.data())) {
+        return false;
+    }
+    for(unsigned char state : states) {
+        if(state < FlowRowExact) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sends the whole blocks whose rows are final, in order, or everything left when the run is done
+// Live runs send the blocks of the live range instead, rows that left the window before they were sent are skipped
+// A block that can't be read ends the sending, the run is rejected with its error
+static void SendBlocks(RunState* state, bool done)
+{
+    if(state->failed) {
+        return;
+    }
+
+    FrameNumber end = state->numFrames;
+    if(state->live) {
+        FrameRange range;
+        if(!api.GetLiveRange(state->handle->handle, &range)) {
+            return;
+        }
+        state->nextFrame = std::max(state->nextFrame, range.fromFrame);
+        end = range.toFrame;
+    }
+
+    while(state->nextFrame < end) {
+        FrameNumber toFrame = std::min(state->nextFrame + state->blockFrames, end);
+        FrameRange range = { state->nextFrame, toFrame };
+        if(!done) {
+            // The end of a live range still grows, only the last block of the run is partial
+            if(state->live && toFrame - state->nextFrame < state->blockFrames) {
+                break;
+            }
+            if(!state->live && !RowsFinal(state->handle, range)) {
+                break;
+            }
+        }
+
+        RunMessage* message = new RunMessage();
+        message->done = false;
+        message->range = range;
+        message->data = ReadBlock(state->handle, state->output, range, &message->size);
+        if(message->data == nullptr) {
+            delete message;
+            state->failed = true;
+            state->error = api.LastError();
+            return;
+        }
+
+        state->nextFrame = toFrame;
+        napi_call_threadsafe_function(state->tsfn, message, napi_tsfn_blocking);
+    }
+}
+
+static void RunCallback(FlowHandle flowHandle, int frame_number)
+{
+    RunState* state;
+    {
+        std::lock_guard<std::mutex> lock(runsMutex);
+        auto it = runs.find(flowHandle);
+        if(it == runs.end()) {
+            return;
+        }
+        state = it->second;
+    }
+    SendBlocks(state, false);
+}
+
+static void RunThread(RunState* state)
+{
+    bool success = api.Run(state->handle->handle, RunCallback, (int)state->blockFrames);
+
+    {
+        std::lock_guard<std::mutex> lock(runsMutex);
+        runs.erase(state->handle->handle);
+    }
+
+    RunMessage* message = new RunMessage();
+    message->done = true;
+    if(success) {
+        SendBlocks(state, true);
+    }
+    message->success = success && !state->failed;
+    message->error = success ? state->error : api.LastError();
+    message->data = nullptr;
+
+    napi_call_threadsafe_function(state->tsfn, message, napi_tsfn_blocking);
+    napi_release_threadsafe_function(state->tsfn, napi_tsfn_release);
+}
+
+// On the JS thread, in the order the messages were sent
+static void RunCallJs(napi_env env, napi_value onBlock, void* context, void* data)
+{
+    RunState* state = (RunState*)context;
+    RunMessage* message = (RunMessage*)data;
+
+    if(env == nullptr) {
+        free(message->data);
+        delete message;
+        return;
+    }
+
+    if(message->done) {
+        state->handle->running = false;
+        if(message->success) {
+            napi_value undefined;
+            napi_get_undefined(env, &undefined);
+            napi_resolve_deferred(env, state->deferred, undefined);
+        } else {
+            napi_value text, error;
+            napi_create_string_utf8(env, message->error.c_str(), NAPI_AUTO_LENGTH, &text);
+            napi_create_error(env, nullptr, text, &error);
+            napi_reject_deferred(env, state->deferred, error);
+        }
+        napi_delete_reference(env, state->self);
+        delete message;
+        return;
+    }
+
+    napi_value block, fromFrame, toFrame, buffer, global;
+    buffer = BlockArrayBuffer(env, message->data, message->size);
+    napi_create_object(env, &block);
+    napi_create_double(env, (double)message->range.fromFrame, &fromFrame);
+    napi_create_double(env, (double)message->range.toFrame, &toFrame);
+    napi_set_named_property(env, block, "fromFrame", fromFrame);
+    napi_set_named_property(env, block, "toFrame", toFrame);
+    if(buffer) {
+        napi_set_named_property(env, block, "data", buffer);
+    }
+    delete message;
+
+    napi_get_global(env, &global);
+    napi_call_function(env, global, onBlock, 1, &block, nullptr);
+}
+
+static void RunFinalize(napi_env env, void* data, void* hint)
+{
+    delete (RunState*)data;
+}
+
+// run(blockFrames, onBlock, output = 0), resolves once every block has been delivered
+static napi_value HandleRun(napi_env env, napi_callback_info info)
+{
+    size_t argc = 3;
+    napi_value argv[3];
+    napi_value self;
+    Handle* handle = Unwrap(env, info, &argc, argv, &self);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+    if(handle->running) {
+        napi_throw_error(env, nullptr, "FlowHandle is already running");
+        return nullptr;
+    }
+
+    int blockFrames, output = 0;
+    NAPI_CALL(env, napi_get_value_int32(env, argv[0], &blockFrames));
+    if(argc > 2) {
+        NAPI_CALL(env, napi_get_value_int32(env, argv[2], &output));
+    }
+    if(blockFrames <= 0) {
+        napi_throw_range_error(env, nullptr, "blockFrames must be positive");
+        return nullptr;
+    }
+
+    RunState* state = new RunState();
+    state->handle = handle;
+    state->output = output;
+    state->blockFrames = blockFrames;
+    state->live = handle->live;
+    state->numFrames = handle->live ? 0 : api.GetLength(handle->handle);
+
+    napi_value promise, name;
+    NAPI_CALL(env, napi_create_promise(env, &state->deferred, &promise));
+    // Keeps the handle object alive for as long as the run
+    NAPI_CALL(env, napi_create_reference(env, self, 1, &state->self));
+    NAPI_CALL(env, napi_create_string_utf8(env, "FlowRun", NAPI_AUTO_LENGTH, &name));
+    NAPI_CALL(env, napi_create_threadsafe_function(env, argv[1], nullptr, name, 0, 1, state, RunFinalize, state, RunCallJs, &state->tsfn));
+
+    {
+        std::lock_guard<std::mutex> lock(runsMutex);
+        runs[handle->handle] = state;
+    }
+
+    handle->running = true;
+    std::thread(RunThread, state).detach();
+    return promise;
+}
+
+// -- CalcWave --
+
+struct WaveWork {
+    Handle* handle;
+    FrameRange range;
+    bool success;
+    std::string error;
+    std::vector<int> actions;
+    napi_ref self;
+    napi_deferred deferred;
+    napi_async_work work;
+};
+
+static void WaveCallback(void* data, int width, int height, void* userData)
+{
+    WaveWork* work = (WaveWork*)userData;
+    work->actions.assign((int*)data, (int*)data + width * height);
+}
+
+static void WaveExecute(napi_env env, void* data)
+{
+    WaveWork* work = (WaveWork*)data;
+    work->success = api.CalcWave(work->handle->handle, work->range, WaveCallback, work);
+    if(!work->success) {
+        work->error = api.LastError();
+    }
+}
+
+static void WaveComplete(napi_env env, napi_status status, void* data)
+{
+    WaveWork* work = (WaveWork*)data;
+    work->handle->pending--;
+
+    if(work->success) {
+        // Frame and position pairs
+        void* buffer;
+        napi_value arrayBuffer, result;
+        size_t size = work->actions.size() * sizeof(int);
+        napi_create_arraybuffer(env, size, &buffer, &arrayBuffer);
+        if(size > 0) {
+            memcpy(buffer, work->actions.data(), size);
+        }
+        napi_create_typedarray(env, napi_int32_array, work->actions.size(), arrayBuffer, 0, &result);
+        napi_resolve_deferred(env, work->deferred, result);
+    } else {
+        napi_value text, error;
+        napi_create_string_utf8(env, work->error.c_str(), NAPI_AUTO_LENGTH, &text);
+        napi_create_error(env, nullptr, text, &error);
+        napi_reject_deferred(env, work->deferred, error);
+    }
+
+    napi_delete_reference(env, work->self);
+    napi_delete_async_work(env, work->work);
+    delete work;
+}
+
+static napi_value HandleCalcWave(napi_env env, napi_callback_info info)
+{
+    size_t argc = 2;
+    napi_value argv[2];
+    napi_value self;
+    Handle* handle = Unwrap(env, info, &argc, argv, &self);
+    if(handle == nullptr) {
+        return nullptr;
+    }
+
+    int64_t fromFrame, toFrame;
+    NAPI_CALL(env, napi_get_value_int64(env, argv[0], &fromFrame));
+    NAPI_CALL(env, napi_get_value_int64(env, argv[1], &toFrame));
+    if(!CheckRange(env, handle, fromFrame, toFrame)) {
+        return nullptr;
+    }
+
+    WaveWork* work = new WaveWork();
+    work->handle = handle;
+    work->range = FrameRange{ (FrameNumber)fromFrame, (FrameNumber)toFrame };
+
+    napi_value promise, name;
+    NAPI_CALL(env, napi_create_promise(env, &work->deferred, &promise));
+    NAPI_CALL(env, napi_create_reference(env, self, 1, &work->self));
+    NAPI_CALL(env, napi_create_string_utf8(env, "FlowCalcWave", NAPI_AUTO_LENGTH, &name));
+    NAPI_CALL(env, napi_create_async_work(env, nullptr, name, WaveExecute, WaveComplete, work, &work->work));
+    NAPI_CALL(env, napi_queue_async_work(env, work->work));
+    handle->pending++;
+    return promise;
+}
+
+// -- Module --
+
+static napi_value Init(napi_env env, napi_value exports)
+{
+    napi_property_descriptor methods[] = {
+        { "destroy", nullptr, HandleDestroy, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "length", nullptr, HandleLength, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "lengthMs", nullptr, HandleLengthMs, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "numOutputs", nullptr, HandleNumOutputs, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "rowSize", nullptr, HandleRowSize, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "getData", nullptr, HandleGetData, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "rowState", nullptr, HandleRowState, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "liveRange", nullptr, HandleLiveRange, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "requestRange", nullptr, HandleRequestRange, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "numLevels", nullptr, HandleNumLevels, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "levelLength", nullptr, HandleLevelLength, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "getLevel", nullptr, HandleGetLevel, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "rangeSums", nullptr, HandleRangeSums, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "run", nullptr, HandleRun, nullptr, nullptr, nullptr, napi_default, nullptr },
+        { "calcWave", nullptr, HandleCalcWave, nullptr, nullptr, nullptr, napi_default, nullptr },
+    };
+
+    napi_value handleClass;
+    NAPI_CALL(env, napi_define_class(env, "FlowHandle", NAPI_AUTO_LENGTH, HandleConstructor, nullptr,
+        sizeof(methods) / sizeof(methods[0]), methods, &handleClass));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "FlowHandle", handleClass));
+
+    napi_value load;
+    NAPI_CALL(env, napi_create_function(env, "load", NAPI_AUTO_LENGTH, Load, nullptr, &load));
+    NAPI_CALL(env, napi_set_named_property(env, exports, "load", load));
+    return exports;
+}
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, Init)
@@ -3,6 +3,7 @@ import { WebSocketServer } from 'ws'
 import * as http from 'http';
 
 import {createFlow} from './flowloader.mjs';
+import {createScript} from './flowlib.mjs';
 import {ipfs} from './db.mjs';
 
 import path from 'path'
@@ -66,7 +67,7 @@ app.get('/old/flow/(.*)', async (req, res) => {
     res.end();
 })
 
-app.get('/old/script/.*', (req, res) => {
+app.get('/old/script/.*', async (req, res) => {
     console.log("Script request")
 
     var inputPath = req.originalUrl.substring(8);
@@ -107,7 +108,7 @@ app.get('/old/script/.*', (req, res) => {
         return;
     }
 
-    const actions = createScript(inputPath);
+    const actions = await createScript(inputPath);
 
     var fileExt = path.extname(inputPath);
     var fileName = path.basename(inputPath, fileExt) + '.funscript';
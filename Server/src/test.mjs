@@ -128,7 +128,39 @@ async function main() {
     }
 }
 
-main().then(() => {
+// node src/test.mjs --live <stream url>, the blocks of a live run follow each other and are inside the window
+async function testLive(url) {
+    const liveWindow = 1000
+    const blockFrames = 50
+    let blocks = 0
+    let lastFrame = 0
+
+    await flowlib.runLive(url, liveWindow, blockFrames, (block, range) => {
+        if(block.fromFrame < lastFrame || block.toFrame <= block.fromFrame) {
+            throw new Error("Live block out of order: " + block.fromFrame + " - " + block.toFrame + " after " + lastFrame)
+        }
+        if(block.toFrame > range.toFrame || range.toFrame - range.fromFrame > liveWindow) {
+            throw new Error("Live block outside the window: " + block.fromFrame + " - " + block.toFrame + ", window " + range.fromFrame + " - " + range.toFrame)
+        }
+        if(!block.data || block.data.byteLength % (block.toFrame - block.fromFrame) != 0) {
+            throw new Error("Live block without its rows: " + block.fromFrame + " - " + block.toFrame)
+        }
+        lastFrame = block.toFrame
+        blocks++
+        console.log('Live block', block.fromFrame, block.toFrame, 'window', range.fromFrame, range.toFrame)
+    })
+
+    if(blocks == 0) {
+        throw new Error("No live blocks")
+    }
+    console.log('Live blocks', blocks, 'rows up to', lastFrame)
+}
+
+const run = process.argv[2] == '--live' ? testLive(process.argv[3]) : main()
+run.then(() => {
     console.log('Done')
-    system.exit(0)
+    process.exit(0)
+}).catch((e) => {
+    console.log('Failed', e)
+    process.exit(1)
 })
\ No newline at end of file